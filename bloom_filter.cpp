@@ -0,0 +1,76 @@
+#include "bloom_filter.hpp"
+
+#include "name_hash.hpp"
+
+const std::size_t BITS_PER_ITEM = 10;  // ~1% false positives with 7 hashes
+const std::size_t MIN_SLOTS = 1024;
+
+BloomFilter::BloomFilter(std::size_t expectedItems) {
+  std::size_t slots = MIN_SLOTS;
+  while (slots < expectedItems * BITS_PER_ITEM) slots *= 2;
+  counters_.assign(slots, 0);
+}
+
+template <typename F>
+void BloomFilter::forEachSlot(const std::string& name, F f) const {
+  std::uint64_t h1 = fnv1a64(name);
+  std::uint64_t h2 = mix64(h1) | 1;
+  std::size_t mask = counters_.size() - 1;
+  for (int i = 0; i < numHashes_; i++) {
+    f((h1 + i * h2) & mask);
+  }
+}
+
+void BloomFilter::add(const std::string& name) {
+  forEachSlot(name, [this](std::size_t slot) {
+    // saturated counters stay set forever, which only costs accuracy
+    if (counters_[slot] != 0xff) counters_[slot]++;
+  });
+  size_++;
+}
+
+void BloomFilter::remove(const std::string& name) {
+  forEachSlot(name, [this](std::size_t slot) {
+    if (counters_[slot] != 0 && counters_[slot] != 0xff) counters_[slot]--;
+  });
+  if (size_ > 0) size_--;
+}
+
+bool BloomFilter::mightContain(const std::string& name) const {
+  bool found = true;
+  forEachSlot(name, [&](std::size_t slot) {
+    if (counters_[slot] == 0) found = false;
+  });
+  return found;
+}
+
+std::size_t BloomFilter::size() const { return size_; }
+
+std::size_t BloomFilter::capacity() const {
+  return counters_.size() / BITS_PER_ITEM;
+}
+
+std::string BloomFilter::toBits() const {
+  std::string bits(counters_.size() / 8, '\0');
+  for (std::size_t i = 0; i < counters_.size(); i++) {
+    if (counters_[i]) bits[i / 8] |= static_cast<char>(1 << (i % 8));
+  }
+  return bits;
+}
+
+bool BloomFilter::fromBits(const std::string& bits, int numHashes,
+                           BloomFilter& filter) {
+  std::size_t slots = bits.size() * 8;
+  // slot math needs a power of two
+  if (slots < MIN_SLOTS || (slots & (slots - 1)) != 0 || numHashes < 1 ||
+      numHashes > 32) {
+    return false;
+  }
+  filter.counters_.assign(slots, 0);
+  filter.numHashes_ = numHashes;
+  filter.size_ = 0;
+  for (std::size_t i = 0; i < slots; i++) {
+    filter.counters_[i] = (bits[i / 8] >> (i % 8)) & 1;
+  }
+  return true;
+}
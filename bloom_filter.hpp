@@ -0,0 +1,42 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Counting Bloom filter of file names. The owner keeps an 8 bit counter per
+// slot so names can be removed again. Peers only get the bits, which answer
+// "might this node have the file" with no false negatives.
+class BloomFilter {
+ public:
+  static const int NUM_HASHES = 7;
+
+  // sized for about 1% false positives at expectedItems names
+  explicit BloomFilter(std::size_t expectedItems = 0);
+
+  void add(const std::string& name);
+  // only for names that were added, or counters go wrong
+  void remove(const std::string& name);
+  bool mightContain(const std::string& name) const;
+
+  std::size_t size() const;
+  // names it can hold before the false positive rate climbs
+  std::size_t capacity() const;
+
+  // one bit per slot, sent to peers in a FILTER reply
+  std::string toBits() const;
+  // false if bits is not a filter
+  static bool fromBits(const std::string& bits, int numHashes,
+                       BloomFilter& filter);
+
+ private:
+  template <typename F>
+  void forEachSlot(const std::string& name, F f) const;
+
+  std::vector<std::uint8_t> counters_;
+  int numHashes_ = NUM_HASHES;
+  std::size_t size_ = 0;
+};
+
+#endif  // BLOOMFILTER_H
@@ -0,0 +1,45 @@
+#include "count_min_sketch.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "name_hash.hpp"
+
+CountMinSketch::CountMinSketch(std::size_t width, int depth)
+    : width_(width), depth_(depth), counters_(width * depth) {}
+
+std::size_t CountMinSketch::slot(std::uint64_t hash, int row) const {
+  // double hashing gives each row its own column
+  std::uint64_t h2 = mix64(hash) | 1;
+  return row * width_ + (hash + row * h2) % width_;
+}
+
+std::uint32_t CountMinSketch::add(const std::string& name,
+                                  std::uint32_t count) {
+  std::uint64_t hash = fnv1a64(name);
+  std::uint32_t estimate = std::numeric_limits<std::uint32_t>::max();
+  for (int row = 0; row < depth_; row++) {
+    std::uint32_t value =
+        counters_[slot(hash, row)].fetch_add(count, std::memory_order_relaxed) +
+        count;
+    estimate = std::min(estimate, value);
+  }
+  return estimate;
+}
+
+std::uint32_t CountMinSketch::estimate(const std::string& name) const {
+  std::uint64_t hash = fnv1a64(name);
+  std::uint32_t estimate = std::numeric_limits<std::uint32_t>::max();
+  for (int row = 0; row < depth_; row++) {
+    estimate = std::min(
+        estimate, counters_[slot(hash, row)].load(std::memory_order_relaxed));
+  }
+  return estimate;
+}
+
+void CountMinSketch::decay() {
+  for (auto& counter : counters_) {
+    counter.store(counter.load(std::memory_order_relaxed) / 2,
+                  std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef COUNTMINSKETCH_H
+#define COUNTMINSKETCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Approximate per-name counts in fixed memory. Estimates never undercount
+// and overcount by about total / width with high probability. Counters are
+// relaxed atomics so the request handler can count while another thread
+// reads or decays them.
+class CountMinSketch {
+ public:
+  explicit CountMinSketch(std::size_t width = 2048, int depth = 4);
+
+  // adds count to name and returns its new estimate
+  std::uint32_t add(const std::string& name, std::uint32_t count = 1);
+  std::uint32_t estimate(const std::string& name) const;
+
+  // Halves every counter so old counts fade. Adds that race with a decay
+  // may be lost, which only matters for a count or two.
+  void decay();
+
+ private:
+  std::size_t slot(std::uint64_t hash, int row) const;
+
+  std::size_t width_;
+  int depth_;
+  std::vector<std::atomic<std::uint32_t>> counters_;  // depth_ rows
+};
+
+#endif  // COUNTMINSKETCH_H
@@ -0,0 +1,341 @@
+#include "delta_sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace DeltaSync {
+
+namespace {
+
+const char COPY_OP = 'C';     // first block, block count
+const char LITERAL_OP = 'L';  // length, then the bytes
+
+const std::uint64_t PRIME1 = 11400714785074694791ULL;
+const std::uint64_t PRIME2 = 14029467366897019727ULL;
+
+void putU64(std::string& out, std::uint64_t value) {
+  for (int byte = 0; byte < 8; byte++) {
+    out.push_back(static_cast<char>((value >> (8 * byte)) & 0xff));
+  }
+}
+
+bool getU64(std::string_view in, std::size_t& pos, std::uint64_t& value) {
+  if (pos > in.size() || in.size() - pos < 8) return false;
+  value = 0;
+  for (int byte = 0; byte < 8; byte++) {
+    value |= std::uint64_t(static_cast<unsigned char>(in[pos + byte]))
+             << (8 * byte);
+  }
+  pos += 8;
+  return true;
+}
+
+std::uint64_t loadU64(const char* data) {
+  std::uint64_t value;
+  std::memcpy(&value, data, 8);
+  return value;
+}
+
+std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+std::uint64_t hashRound(std::uint64_t acc, std::uint64_t word) {
+  return rotl(acc + word * PRIME2, 31) * PRIME1;
+}
+
+const std::uint64_t LANE_SEEDS[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+
+// the lanes over whole 32 byte stripes, returns the bytes consumed
+std::size_t hashStripes(std::uint64_t (&v)[4], const char* data,
+                        std::size_t len) {
+  std::size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    v[0] = hashRound(v[0], loadU64(data + i));
+    v[1] = hashRound(v[1], loadU64(data + i + 8));
+    v[2] = hashRound(v[2], loadU64(data + i + 16));
+    v[3] = hashRound(v[3], loadU64(data + i + 24));
+  }
+  return i;
+}
+
+// folds the lanes, the total length and the last len % 32 bytes in tail
+std::uint64_t finishHash(const std::uint64_t (&v)[4], std::uint64_t total,
+                         const char* tail, std::size_t tailLen) {
+  std::uint64_t hash =
+      total >= 32
+          ? rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18)
+          : PRIME2;
+  hash += total;
+  std::size_t i = 0;
+  for (; i + 8 <= tailLen; i += 8) {
+    hash = rotl(hash ^ hashRound(0, loadU64(tail + i)), 27) * PRIME1;
+  }
+  for (; i < tailLen; i++) {
+    hash = rotl(hash ^ (static_cast<unsigned char>(tail[i]) * PRIME1), 11) *
+           PRIME2;
+  }
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  return hash;
+}
+
+#if defined(__SSE2__)
+std::uint32_t horizontalSum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return static_cast<std::uint32_t>(_mm_cvtsi128_si32(v));
+}
+#endif
+
+}  // namespace
+
+std::size_t chooseBlockSize(std::uint64_t fileSize) {
+  std::size_t blockSize =
+      static_cast<std::size_t>(std::sqrt(static_cast<double>(fileSize)));
+  blockSize = (blockSize + 63) / 64 * 64;
+  if (blockSize < MIN_BLOCK_SIZE) return MIN_BLOCK_SIZE;
+  if (blockSize > MAX_BLOCK_SIZE) return MAX_BLOCK_SIZE;
+  return blockSize;
+}
+
+std::uint32_t weakChecksum(const char* data, std::size_t len) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  // a = sum(x_i), b = sum((len - i) * x_i), both mod 2^16. uint32 math
+  // wraps mod 2^32, which keeps the low 16 bits right.
+  std::uint32_t a = 0, b = 0;
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  // 16 bytes a step: psadbw sums the chunk, pmaddwd weights it by its
+  // offset, and the prefix sum of a gives each chunk its distance from the
+  // start, like the SIMD adler32 kernels.
+  std::size_t chunks = len / 16;
+  if (chunks > 0) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsLo = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m128i weightsHi = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i sums = zero, prefix = zero, weighted = zero;
+    for (std::size_t c = 0; c < chunks; c++) {
+      __m128i chunk = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(bytes + c * 16));
+      prefix = _mm_add_epi32(prefix, sums);
+      sums = _mm_add_epi32(sums, _mm_sad_epu8(chunk, zero));
+      weighted = _mm_add_epi32(
+          weighted,
+          _mm_add_epi32(
+              _mm_madd_epi16(_mm_unpacklo_epi8(chunk, zero), weightsLo),
+              _mm_madd_epi16(_mm_unpackhi_epi8(chunk, zero), weightsHi)));
+    }
+    std::uint32_t total = horizontalSum(sums);
+    // sum over chunks of c * S_c = (chunks - 1) * total - prefix
+    std::uint32_t offsetSum =
+        static_cast<std::uint32_t>(chunks - 1) * total - horizontalSum(prefix);
+    a = total;
+    b = static_cast<std::uint32_t>(len) * total - 16 * offsetSum -
+        horizontalSum(weighted);
+    i = chunks * 16;
+  }
+#endif
+  for (; i < len; i++) {
+    a += bytes[i];
+    b += static_cast<std::uint32_t>(len - i) * bytes[i];
+  }
+  return (a & 0xffff) | (b << 16);
+}
+
+std::uint32_t rollChecksum(std::uint32_t weak, std::size_t len,
+                           unsigned char out, unsigned char in) {
+  std::uint32_t a = weak & 0xffff, b = weak >> 16;
+  a = (a - out + in) & 0xffff;
+  b = (b - static_cast<std::uint32_t>(len) * out + a) & 0xffff;
+  return a | (b << 16);
+}
+
+// four independent lanes over 32 byte stripes so the multiplies pipeline
+std::uint64_t strongHash(const char* data, std::size_t len) {
+  std::uint64_t v[4] = {LANE_SEEDS[0], LANE_SEEDS[1], LANE_SEEDS[2],
+                        LANE_SEEDS[3]};
+  std::size_t i = hashStripes(v, data, len);
+  return finishHash(v, len, data + i, len - i);
+}
+
+void StrongHasher::update(const char* data, std::size_t len) {
+  if (total_ == 0) std::copy(LANE_SEEDS, LANE_SEEDS + 4, lanes_);
+  total_ += len;
+  if (pendingLen_ > 0) {
+    std::size_t take = std::min(len, sizeof(pending_) - pendingLen_);
+    std::memcpy(pending_ + pendingLen_, data, take);
+    pendingLen_ += take;
+    data += take;
+    len -= take;
+    if (pendingLen_ < sizeof(pending_)) return;
+    hashStripes(lanes_, pending_, pendingLen_);
+    pendingLen_ = 0;
+  }
+  std::size_t done = hashStripes(lanes_, data, len);
+  std::memcpy(pending_, data + done, len - done);
+  pendingLen_ = len - done;
+}
+
+std::uint64_t StrongHasher::digest() const {
+  return finishHash(lanes_, total_, pending_, pendingLen_);
+}
+
+BlockSignature signature(const char* block, std::size_t blockSize) {
+  return {weakChecksum(block, blockSize), strongHash(block, blockSize)};
+}
+
+std::vector<BlockSignature> signatures(const std::string& data,
+                                       std::size_t blockSize) {
+  std::vector<BlockSignature> result;
+  for (std::size_t pos = 0; pos + blockSize <= data.size(); pos += blockSize) {
+    result.push_back(signature(data.data() + pos, blockSize));
+  }
+  return result;
+}
+
+std::string encodeSignatures(const std::vector<BlockSignature>& signatures) {
+  std::string out;
+  out.reserve(signatures.size() * 16);
+  for (const auto& signature : signatures) {
+    putU64(out, signature.weak);
+    putU64(out, signature.strong);
+  }
+  return out;
+}
+
+bool decodeSignatures(const std::string& data,
+                      std::vector<BlockSignature>& signatures) {
+  if (data.size() % 16 != 0) return false;
+  signatures.clear();
+  std::size_t pos = 0;
+  while (pos < data.size()) {
+    std::uint64_t weak, strong;
+    getU64(data, pos, weak);
+    getU64(data, pos, strong);
+    signatures.push_back({static_cast<std::uint32_t>(weak), strong});
+  }
+  return true;
+}
+
+std::string computeDelta(const std::string& newData, std::size_t blockSize,
+                         const std::vector<BlockSignature>& basis) {
+  std::unordered_map<std::uint32_t, std::vector<std::uint64_t>> blocksByWeak;
+  for (std::uint64_t i = 0; i < basis.size(); i++) {
+    blocksByWeak[basis[i].weak].push_back(i);
+  }
+
+  std::string delta;
+  const char* data = newData.data();
+  const std::size_t n = newData.size();
+  std::size_t literalStart = 0;
+  std::uint64_t copyStart = 0, copyCount = 0;
+
+  auto flushCopy = [&]() {
+    if (copyCount == 0) return;
+    delta.push_back(COPY_OP);
+    putU64(delta, copyStart);
+    putU64(delta, copyCount);
+    copyCount = 0;
+  };
+  auto flushLiteral = [&](std::size_t end) {
+    if (end <= literalStart) return;
+    flushCopy();
+    delta.push_back(LITERAL_OP);
+    putU64(delta, end - literalStart);
+    delta.append(data + literalStart, end - literalStart);
+  };
+
+  std::size_t pos = 0;
+  std::uint32_t weak =
+      n >= blockSize && blockSize > 0 ? weakChecksum(data, blockSize) : 0;
+  while (!blocksByWeak.empty() && blockSize > 0 && pos + blockSize <= n) {
+    auto it = blocksByWeak.find(weak);
+    bool matched = false;
+    std::uint64_t block = 0;
+    if (it != blocksByWeak.end()) {
+      std::uint64_t strong = strongHash(data + pos, blockSize);
+      for (std::uint64_t candidate : it->second) {
+        if (basis[candidate].strong != strong) continue;
+        block = candidate;
+        matched = true;
+        // the block after the current run keeps it a single instruction
+        if (copyCount > 0 && candidate == copyStart + copyCount) break;
+      }
+    }
+    if (matched) {
+      flushLiteral(pos);
+      if (copyCount > 0 && block == copyStart + copyCount) {
+        copyCount++;
+      } else {
+        flushCopy();
+        copyStart = block;
+        copyCount = 1;
+      }
+      pos += blockSize;
+      literalStart = pos;
+      if (pos + blockSize <= n) weak = weakChecksum(data + pos, blockSize);
+      continue;
+    }
+    if (pos + blockSize < n) {
+      weak = rollChecksum(weak, blockSize, data[pos], data[pos + blockSize]);
+    }
+    pos++;
+  }
+  flushLiteral(n);
+  flushCopy();
+  return delta;
+}
+
+bool applyDelta(const std::string& basis, std::size_t blockSize,
+                const std::string& delta, std::string& result) {
+  result.clear();
+  return applyDelta(
+      basis.size(), blockSize, delta,
+      [&](std::uint64_t offset, std::uint64_t length) {
+        result.append(basis, offset, length);
+        return true;
+      },
+      [&](const char* data, std::size_t length) {
+        result.append(data, length);
+        return true;
+      });
+}
+
+bool applyDelta(std::uint64_t basisSize, std::size_t blockSize,
+                std::string_view delta,
+                const std::function<bool(std::uint64_t, std::uint64_t)>& copy,
+                const std::function<bool(const char*, std::size_t)>& literal) {
+  std::size_t pos = 0;
+  while (pos < delta.size()) {
+    char op = delta[pos++];
+    if (op == COPY_OP) {
+      std::uint64_t first, count;
+      if (!getU64(delta, pos, first) || !getU64(delta, pos, count)) {
+        return false;
+      }
+      if (blockSize == 0 || first > basisSize / blockSize ||
+          count > basisSize / blockSize - first) {
+        return false;
+      }
+      if (!copy(first * blockSize, count * blockSize)) return false;
+    } else if (op == LITERAL_OP) {
+      std::uint64_t length;
+      if (!getU64(delta, pos, length) || length > delta.size() - pos) {
+        return false;
+      }
+      if (!literal(delta.data() + pos, length)) return false;
+      pos += length;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace DeltaSync
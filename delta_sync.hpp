@@ -0,0 +1,74 @@
+#ifndef DELTASYNC_H
+#define DELTASYNC_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// rsync style delta transfer. The receiver sends a signature (weak rolling
+// checksum plus strong hash) of every full block of its old copy. The sender
+// rolls the weak checksum over its file and replies with instructions that
+// copy matching blocks from the old copy or carry literal bytes.
+namespace DeltaSync {
+
+struct BlockSignature {
+  std::uint32_t weak;
+  std::uint64_t strong;
+};
+
+// about sqrt(fileSize), a multiple of 64 between MIN and MAX_BLOCK_SIZE
+const std::size_t MIN_BLOCK_SIZE = 1024;
+const std::size_t MAX_BLOCK_SIZE = 128 * 1024;
+std::size_t chooseBlockSize(std::uint64_t fileSize);
+
+// rsync's adler style checksum, a in the low 16 bits and b in the high
+std::uint32_t weakChecksum(const char* data, std::size_t len);
+// slides a len byte window one byte, dropping out and adding in
+std::uint32_t rollChecksum(std::uint32_t weak, std::size_t len,
+                           unsigned char out, unsigned char in);
+
+// 64 bit hash, also used to check the rebuilt file
+std::uint64_t strongHash(const char* data, std::size_t len);
+
+// strongHash of data that arrives in pieces
+class StrongHasher {
+ public:
+  void update(const char* data, std::size_t len);
+  // strongHash of everything passed to update
+  std::uint64_t digest() const;
+
+ private:
+  std::uint64_t lanes_[4] = {};
+  char pending_[32];  // bytes short of a whole 32 byte stripe
+  std::size_t pendingLen_ = 0;
+  std::uint64_t total_ = 0;
+};
+
+BlockSignature signature(const char* block, std::size_t blockSize);
+
+std::vector<BlockSignature> signatures(const std::string& data,
+                                       std::size_t blockSize);
+std::string encodeSignatures(const std::vector<BlockSignature>& signatures);
+bool decodeSignatures(const std::string& data,
+                      std::vector<BlockSignature>& signatures);
+
+// instructions that turn the receiver's old copy into newData
+std::string computeDelta(const std::string& newData, std::size_t blockSize,
+                         const std::vector<BlockSignature>& basis);
+// false if delta is malformed or refers to blocks basis does not have
+bool applyDelta(const std::string& basis, std::size_t blockSize,
+                const std::string& delta, std::string& result);
+// Like applyDelta for a basis of basisSize bytes that is not in memory.
+// The result is produced in order through copy, given a byte range of the
+// basis, and literal, given bytes of the delta. Either returning false
+// fails the apply.
+bool applyDelta(std::uint64_t basisSize, std::size_t blockSize,
+                std::string_view delta,
+                const std::function<bool(std::uint64_t, std::uint64_t)>& copy,
+                const std::function<bool(const char*, std::size_t)>& literal);
+
+}  // namespace DeltaSync
+
+#endif  // DELTASYNC_H
@@ -0,0 +1,418 @@
+#include "file_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#if defined(SDFSS_IO_URING)
+#include <liburing.h>
+// <linux/fs.h> defines BLOCK_SIZE, which would replace FileReader's
+#undef BLOCK_SIZE
+#endif
+
+const std::size_t FileReader::BLOCK_SIZE;
+const int FileReader::READ_AHEAD;
+
+namespace {
+
+#if defined(SDFSS_IO_URING)
+const std::size_t MAX_IDLE_RINGS = 8;  // per thread, the rest are closed
+#endif
+
+#ifndef _WIN32
+std::int64_t mtimeNs(const struct stat& info) {
+  return std::int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+#endif
+
+// all of data to fd, false on an error
+bool writeAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+#ifndef _WIN32
+    ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0 && errno == EINTR) continue;
+#else
+    int n = _write(fd, data.data(),
+                   static_cast<unsigned>(std::min<std::size_t>(data.size(),
+                                                               1 << 30)));
+#endif
+    if (n <= 0) return false;
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+}  // namespace
+
+#if defined(SDFSS_IO_URING)
+struct FileReader::Ring {
+  io_uring ring;
+  bool initialized = false;
+  char* buffers = nullptr;
+
+  ~Ring() {
+    if (initialized) io_uring_queue_exit(&ring);
+    std::free(buffers);
+  }
+};
+#endif
+
+std::shared_ptr<FileHandle> FileHandle::open(
+    const std::filesystem::path& path) {
+  std::shared_ptr<FileHandle> handle(new FileHandle());
+  handle->path_ = path;
+#ifndef _WIN32
+  handle->fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (handle->fd_ < 0) return nullptr;
+  struct stat info;
+  if (fstat(handle->fd_, &info) != 0 || !S_ISREG(info.st_mode)) {
+    return nullptr;
+  }
+  handle->size_ = info.st_size;
+  handle->mtimeNs_ = mtimeNs(info);
+  handle->device_ = info.st_dev;
+  handle->inode_ = info.st_ino;
+#else
+  std::error_code error;
+  if (!std::filesystem::is_regular_file(path, error)) return nullptr;
+  handle->size_ = std::filesystem::file_size(path, error);
+  handle->mtimeNs_ = std::filesystem::last_write_time(path, error)
+                         .time_since_epoch()
+                         .count();
+  if (error) return nullptr;
+#endif
+  return handle;
+}
+
+FileHandle::~FileHandle() {
+#ifndef _WIN32
+  if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+const std::filesystem::path& FileHandle::path() const { return path_; }
+
+std::uintmax_t FileHandle::size() const { return size_; }
+
+bool FileHandle::current() const {
+#ifndef _WIN32
+  struct stat info;
+  return stat(path_.c_str(), &info) == 0 && info.st_dev == device_ &&
+         info.st_ino == inode_ &&
+         static_cast<std::uintmax_t>(info.st_size) == size_ &&
+         mtimeNs(info) == mtimeNs_;
+#else
+  std::error_code error;
+  std::uintmax_t size = std::filesystem::file_size(path_, error);
+  std::int64_t mtime = std::filesystem::last_write_time(path_, error)
+                           .time_since_epoch()
+                           .count();
+  return !error && size == size_ && mtime == mtimeNs_;
+#endif
+}
+
+#ifndef _WIN32
+int FileHandle::fd() const { return fd_; }
+#endif
+
+FileReader::FileReader() = default;
+
+FileReader::~FileReader() { close(); }
+
+bool FileReader::open(const std::filesystem::path& path) {
+  std::shared_ptr<FileHandle> handle = FileHandle::open(path);
+  if (!handle) {
+    close();
+    return false;
+  }
+  return open(std::move(handle));
+}
+
+bool FileReader::open(std::shared_ptr<FileHandle> handle) {
+  std::uintmax_t size = handle ? handle->size() : 0;
+  return open(std::move(handle), 0, size);
+}
+
+bool FileReader::open(std::shared_ptr<FileHandle> handle, std::uintmax_t offset,
+                      std::uintmax_t length) {
+  close();
+  if (!handle) return false;
+#ifdef _WIN32
+  file_.open(handle->path(), std::ios::binary);
+  if (!file_.is_open()) return false;
+#endif
+  handle_ = std::move(handle);
+  start_ = std::min(offset, handle_->size());
+  size_ = std::min(length, handle_->size() - start_);
+#ifndef _WIN32
+  posix_fadvise(handle_->fd(), start_, size_, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(handle_->fd(), start_,
+                std::min<std::uintmax_t>(size_, READ_AHEAD * BLOCK_SIZE),
+                POSIX_FADV_WILLNEED);
+#endif
+  open_ = true;
+
+#if defined(SDFSS_IO_URING)
+  // a ring only pays off when there is something to read ahead
+  if (size_ > BLOCK_SIZE) ring_ = takeRing();
+  if (ring_) {
+    for (int block = 0; block < READ_AHEAD; block++) submit(block);
+    io_uring_submit(&ring_->ring);
+  }
+#endif
+  return true;
+}
+
+bool FileReader::isOpen() const { return open_; }
+
+std::uintmax_t FileReader::size() const { return size_; }
+
+std::size_t FileReader::read(char* out, std::size_t length) {
+  std::size_t copied = 0;
+  while (copied < length) {
+    if (blockPos_ == blockLength_ && !nextBlock()) break;
+    std::size_t n = std::min(length - copied, blockLength_ - blockPos_);
+    std::memcpy(out + copied, block_ + blockPos_, n);
+    blockPos_ += n;
+    copied += n;
+  }
+  return copied;
+}
+
+std::string_view FileReader::readView() {
+  if (blockPos_ == blockLength_ && !nextBlock()) return {};
+  std::string_view view(block_ + blockPos_, blockLength_ - blockPos_);
+  blockPos_ = blockLength_;
+  return view;
+}
+
+std::uintmax_t FileReader::sendTo(int fd) {
+  std::uintmax_t sent = 0;
+  // what was already read goes out first
+  if (blockPos_ < blockLength_) {
+    std::string_view view = readView();
+    if (!writeAll(fd, view)) return sent;
+    sent += view.size();
+  }
+#if defined(__linux__)
+  if (open_ && !eof_) {
+    off_t offset = start_ + next_ * BLOCK_SIZE;
+    const off_t end = start_ + size_;
+    while (offset < end) {
+      ssize_t n = ::sendfile(fd, handle_->fd(), &offset,
+                             std::min<off_t>(end - offset, 1 << 30));
+      if (n < 0 && errno == EINTR) continue;
+      // fd does not take sendfile, copy through the blocks instead
+      if (n < 0 && (errno == EINVAL || errno == ENOSYS) &&
+          offset == off_t(start_ + next_ * BLOCK_SIZE)) {
+        break;
+      }
+      if (n <= 0) {
+        eof_ = true;
+        return sent;
+      }
+      sent += n;
+    }
+    if (offset >= end) {
+      // blocks still being read ahead are dropped by close()
+      eof_ = true;
+      return sent;
+    }
+  }
+#endif
+  for (std::string_view view = readView(); !view.empty(); view = readView()) {
+    if (!writeAll(fd, view)) break;
+    sent += view.size();
+  }
+  return sent;
+}
+
+void FileReader::close() {
+#if defined(SDFSS_IO_URING)
+  if (ring_) {
+    // the kernel may still be writing into the buffers
+    for (int slot = 0; slot < READ_AHEAD && inFlight_ > 0; slot++) {
+      if (!waitFor(slot)) break;
+    }
+    // a ring with reads still queued is not handed to the next reader
+    if (inFlight_ == 0) returnRing(std::move(ring_));
+    ring_.reset();
+    inFlight_ = 0;
+    std::fill(std::begin(pending_), std::end(pending_), false);
+    std::fill(std::begin(results_), std::end(results_), 0);
+  }
+#endif
+  handle_.reset();
+#ifdef _WIN32
+  file_.close();
+#endif
+  start_ = 0;
+  size_ = 0;
+  next_ = 0;
+  open_ = false;
+  eof_ = false;
+  block_ = nullptr;
+  blockLength_ = 0;
+  blockPos_ = 0;
+}
+
+std::size_t FileReader::blockLength(std::uintmax_t block) const {
+  std::uintmax_t offset = block * BLOCK_SIZE;
+  if (offset >= size_) return 0;
+  return static_cast<std::size_t>(
+      std::min<std::uintmax_t>(BLOCK_SIZE, size_ - offset));
+}
+
+bool FileReader::nextBlock() {
+  if (!open_ || eof_) return false;
+  std::uintmax_t block = next_++;
+  std::size_t expected = blockLength(block);
+  blockPos_ = 0;
+  blockLength_ = 0;
+  if (expected == 0) {
+    eof_ = true;
+    return false;
+  }
+
+#if defined(SDFSS_IO_URING)
+  if (ring_) {
+    // the caller is done with the previous block, reuse its buffer for
+    // the block READ_AHEAD past it. A block that was never queued reads 0
+    // bytes and is read synchronously below.
+    if (block > 0) {
+      submit(block - 1 + READ_AHEAD);
+      io_uring_submit(&ring_->ring);
+    }
+    int slot = static_cast<int>(block % READ_AHEAD);
+    if (waitFor(slot) && results_[slot] >= 0) {
+      char* data = ring_->buffers + slot * BLOCK_SIZE;
+      std::size_t got = results_[slot];
+      results_[slot] = 0;
+      // a short read in the middle of the file gets the rest synchronously
+      if (got < expected) {
+        got += readAt(data + got, expected - got, block * BLOCK_SIZE + got);
+      }
+      block_ = data;
+      blockLength_ = got;
+      if (got < expected) eof_ = true;
+      return got > 0;
+    }
+  }
+#endif
+
+  buffer_.resize(BLOCK_SIZE);
+  std::size_t got = readAt(buffer_.data(), expected, block * BLOCK_SIZE);
+#ifndef _WIN32
+  // the kernel loads the block READ_AHEAD past this one while it is sent,
+  // the ones before it were asked for earlier
+  if (blockLength(block + READ_AHEAD) > 0) {
+    posix_fadvise(handle_->fd(), start_ + (block + READ_AHEAD) * BLOCK_SIZE,
+                  blockLength(block + READ_AHEAD), POSIX_FADV_WILLNEED);
+  }
+#endif
+  block_ = buffer_.data();
+  blockLength_ = got;
+  if (got < expected) eof_ = true;
+  return got > 0;
+}
+
+std::size_t FileReader::readAt(char* out, std::size_t length,
+                               std::uintmax_t offset) {
+#ifndef _WIN32
+  std::size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(handle_->fd(), out + done, length - done,
+                      start_ + offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += n;
+  }
+  return done;
+#else
+  file_.clear();
+  file_.seekg(start_ + offset);
+  file_.read(out, length);
+  return static_cast<std::size_t>(file_.gcount());
+#endif
+}
+
+#if defined(SDFSS_IO_URING)
+std::vector<std::unique_ptr<FileReader::Ring>>& FileReader::idleRings() {
+  thread_local std::vector<std::unique_ptr<Ring>> idle;
+  return idle;
+}
+
+std::unique_ptr<FileReader::Ring> FileReader::takeRing() {
+  auto& idle = idleRings();
+  if (!idle.empty()) {
+    std::unique_ptr<Ring> ring = std::move(idle.back());
+    idle.pop_back();
+    return ring;
+  }
+  auto ring = std::make_unique<Ring>();
+  ring->initialized = io_uring_queue_init(READ_AHEAD, &ring->ring, 0) == 0;
+  void* buffers = nullptr;
+  if (!ring->initialized ||
+      posix_memalign(&buffers, 4096, READ_AHEAD * BLOCK_SIZE) != 0) {
+    return nullptr;
+  }
+  ring->buffers = static_cast<char*>(buffers);
+  iovec iovecs[READ_AHEAD];
+  for (int slot = 0; slot < READ_AHEAD; slot++) {
+    iovecs[slot].iov_base = ring->buffers + slot * BLOCK_SIZE;
+    iovecs[slot].iov_len = BLOCK_SIZE;
+  }
+  if (io_uring_register_buffers(&ring->ring, iovecs, READ_AHEAD) != 0) {
+    return nullptr;
+  }
+  return ring;
+}
+
+void FileReader::returnRing(std::unique_ptr<Ring> ring) {
+  auto& idle = idleRings();
+  if (idle.size() < MAX_IDLE_RINGS) idle.push_back(std::move(ring));
+}
+
+void FileReader::submit(std::uintmax_t block) {
+  std::size_t length = blockLength(block);
+  if (length == 0) return;
+  int slot = static_cast<int>(block % READ_AHEAD);
+  if (pending_[slot]) return;
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_->ring);
+  if (sqe == nullptr) return;  // read synchronously when its turn comes
+  io_uring_prep_read_fixed(sqe, handle_->fd(),
+                           ring_->buffers + slot * BLOCK_SIZE, length,
+                           start_ + block * BLOCK_SIZE, slot);
+  io_uring_sqe_set_data(
+      sqe, reinterpret_cast<void*>(static_cast<std::uintptr_t>(slot)));
+  pending_[slot] = true;
+  inFlight_++;
+}
+
+bool FileReader::waitFor(int slot) {
+  while (pending_[slot]) {
+    io_uring_cqe* cqe = nullptr;
+    int ret = io_uring_wait_cqe(&ring_->ring, &cqe);
+    if (ret == -EINTR) continue;
+    if (ret < 0) return false;
+    int done = static_cast<int>(
+        reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(cqe)));
+    results_[done] = cqe->res;
+    pending_[done] = false;
+    inFlight_--;
+    io_uring_cqe_seen(&ring_->ring, cqe);
+  }
+  return true;
+}
+#endif
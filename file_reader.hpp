@@ -0,0 +1,123 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// An open read-only file. Readers use pread, so any number of them can
+// share one handle.
+class FileHandle {
+ public:
+  // nullptr if path cannot be opened
+  static std::shared_ptr<FileHandle> open(const std::filesystem::path& path);
+  ~FileHandle();
+  FileHandle(const FileHandle&) = delete;
+  FileHandle& operator=(const FileHandle&) = delete;
+
+  const std::filesystem::path& path() const;
+  // size when opened
+  std::uintmax_t size() const;
+  // false once the file at path was changed, replaced or removed
+  bool current() const;
+#ifndef _WIN32
+  int fd() const;
+#endif
+
+ private:
+  FileHandle() = default;
+
+  std::filesystem::path path_;
+  std::uintmax_t size_ = 0;
+  std::int64_t mtimeNs_ = 0;
+#ifndef _WIN32
+  int fd_ = -1;
+  std::uint64_t device_ = 0;
+  std::uint64_t inode_ = 0;
+#endif
+};
+
+// Reads a file front to back while the next READ_AHEAD blocks are already
+// loading, so disk reads overlap with sending what was read. Built with
+// liburing (SDFSS_IO_URING) the blocks are read into registered buffers
+// through io_uring, on a ring borrowed from a per-thread pool. Otherwise, or
+// when the kernel refuses a ring, blocks are read with pread after asking
+// the kernel to prefetch the ones ahead.
+class FileReader {
+ public:
+  static const std::size_t BLOCK_SIZE = 64 * 1024;
+  static const int READ_AHEAD = 4;
+
+  FileReader();
+  ~FileReader();
+  FileReader(const FileReader&) = delete;
+  FileReader& operator=(const FileReader&) = delete;
+
+  bool open(const std::filesystem::path& path);
+  // reads through a handle that may be shared with other readers
+  bool open(std::shared_ptr<FileHandle> handle);
+  // reads only length bytes from offset, as if they were the whole file
+  bool open(std::shared_ptr<FileHandle> handle, std::uintmax_t offset,
+            std::uintmax_t length);
+  bool isOpen() const;
+  // size when opened, of the range if one was given
+  std::uintmax_t size() const;
+
+  // Like std::istream::read, returns how many bytes were copied to out.
+  // Fewer than length only at the end of the file or on a read error.
+  std::size_t read(char* out, std::size_t length);
+  // Like read, but without the copy: the rest of the current block, valid
+  // until the next call. Empty at the end of the file or on a read error.
+  std::string_view readView();
+  // Writes the rest of the file to the file descriptor fd, through sendfile
+  // where the kernel allows so the data never passes through our buffers.
+  // Returns how many bytes were written, fewer only on an error.
+  std::uintmax_t sendTo(int fd);
+
+  void close();
+
+ private:
+  // makes the next block current, false at the end of the file
+  bool nextBlock();
+  std::size_t blockLength(std::uintmax_t block) const;
+  // synchronous fallback, reads length bytes at offset of the range into out
+  std::size_t readAt(char* out, std::size_t length, std::uintmax_t offset);
+
+  std::uintmax_t start_ = 0;  // file offset of the range
+  std::uintmax_t size_ = 0;
+  std::uintmax_t next_ = 0;  // index of the block after the current one
+  bool open_ = false;
+  bool eof_ = false;
+  const char* block_ = nullptr;
+  std::size_t blockLength_ = 0;
+  std::size_t blockPos_ = 0;
+  std::vector<char> buffer_;  // the current block when not using the ring
+  std::shared_ptr<FileHandle> handle_;
+#ifdef _WIN32
+  std::ifstream file_;
+#endif
+
+#if defined(SDFSS_IO_URING)
+  // an io_uring with READ_AHEAD registered blocks, defined with liburing
+  struct Ring;
+  // idle rings of this thread, setting one up costs several syscalls
+  static std::vector<std::unique_ptr<Ring>>& idleRings();
+  // nullptr if the kernel refuses a ring
+  static std::unique_ptr<Ring> takeRing();
+  static void returnRing(std::unique_ptr<Ring> ring);
+
+  void submit(std::uintmax_t block);
+  bool waitFor(int slot);
+
+  std::unique_ptr<Ring> ring_;
+  int results_[READ_AHEAD] = {};  // bytes read per slot, or -errno
+  bool pending_[READ_AHEAD] = {};
+  int inFlight_ = 0;
+#endif
+};
+
+#endif  // FILEREADER_H
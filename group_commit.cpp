@@ -0,0 +1,288 @@
+#include "group_commit.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const std::size_t GroupCommit::DEFAULT_MAX_BATCH;
+const int GroupCommit::DEFAULT_MAX_DELAY_MS;
+const std::size_t GroupCommit::MAX_QUEUED;
+const std::string GroupCommit::TEMP_PREFIX = ".commit-";
+
+GroupCommit::GroupCommit() : thread_(&GroupCommit::run, this) {}
+
+GroupCommit::~GroupCommit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  staged_.notify_one();
+  thread_.join();
+  // temporaries never staged are dropped
+  while (!created_.empty()) discard(created_.begin()->first);
+}
+
+void GroupCommit::setLimits(std::size_t maxBatch, int maxDelayMs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  maxBatch_ = std::max<std::size_t>(maxBatch, 1);
+  maxDelayMs_ = std::max(maxDelayMs, 0);
+}
+
+std::uint64_t GroupCommit::stage(const std::filesystem::path& path,
+                                 const char* data, std::size_t size) {
+  return stage(path, {std::string_view(data, size)});
+}
+
+std::uint64_t GroupCommit::stage(const std::filesystem::path& path,
+                                 const std::vector<std::string_view>& parts) {
+  Staged staged = newTemporary(path);
+  if (staged.ticket == 0) return 0;
+#ifndef _WIN32
+  bool written = true;
+  for (std::string_view part : parts) {
+    std::size_t done = 0;
+    while (done < part.size()) {
+      ssize_t n = ::write(staged.fd, part.data() + done, part.size() - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      done += n;
+    }
+    if (done != part.size()) {
+      written = false;
+      break;
+    }
+  }
+  if (!written) {
+    ::close(staged.fd);
+    ::unlink(staged.temporary.c_str());
+    return 0;
+  }
+#else
+  {
+    std::ofstream file(staged.temporary, std::ios::binary);
+    for (std::string_view part : parts) file.write(part.data(), part.size());
+    if (!file.good()) {
+      file.close();
+      std::error_code error;
+      std::filesystem::remove(staged.temporary, error);
+      return 0;
+    }
+  }
+#endif
+  return enqueue(std::move(staged));
+}
+
+std::uint64_t GroupCommit::create(const std::filesystem::path& path) {
+  Staged staged = newTemporary(path);
+  if (staged.ticket == 0) return 0;
+  std::uint64_t ticket = staged.ticket;
+  std::lock_guard<std::mutex> lock(mutex_);
+  created_.emplace(ticket, std::move(staged));
+  return ticket;
+}
+
+bool GroupCommit::writeAt(std::uint64_t ticket, const char* data,
+                          std::size_t size, std::uint64_t offset) {
+  Staged staged;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = created_.find(ticket);
+    if (it == created_.end()) return false;
+    staged = it->second;
+  }
+#ifndef _WIN32
+  // pwrite leaves the fd's offset alone, so writers need no lock
+  std::size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::pwrite(staged.fd, data + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+#else
+  std::fstream file(staged.temporary,
+                    std::ios::binary | std::ios::in | std::ios::out);
+  file.seekp(offset);
+  file.write(data, size);
+  return file.good();
+#endif
+}
+
+std::uint64_t GroupCommit::stage(std::uint64_t ticket) {
+  Staged staged;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = created_.find(ticket);
+    if (it == created_.end()) return 0;
+    staged = std::move(it->second);
+    created_.erase(it);
+  }
+  return enqueue(std::move(staged));
+}
+
+void GroupCommit::discard(std::uint64_t ticket) {
+  Staged staged;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = created_.find(ticket);
+    if (it == created_.end()) return;
+    staged = std::move(it->second);
+    created_.erase(it);
+  }
+#ifndef _WIN32
+  ::close(staged.fd);
+#endif
+  std::error_code error;
+  std::filesystem::remove(staged.temporary, error);
+}
+
+GroupCommit::Staged GroupCommit::newTemporary(
+    const std::filesystem::path& path) {
+  std::uint64_t ticket;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ticket = nextTicket_++;
+  }
+  Staged staged{ticket, -1,
+                path.parent_path() / (TEMP_PREFIX + std::to_string(ticket) +
+                                      "-" + path.filename().string()),
+                path};
+#ifndef _WIN32
+  staged.fd = ::open(staged.temporary.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (staged.fd < 0) staged.ticket = 0;
+#else
+  std::ofstream file(staged.temporary, std::ios::binary);
+  if (!file.good()) staged.ticket = 0;
+#endif
+  return staged;
+}
+
+std::uint64_t GroupCommit::enqueue(Staged&& staged) {
+#if defined(__linux__)
+  // start writeback now so the sync at commit has less left to wait for
+  sync_file_range(staged.fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+  std::uint64_t ticket = staged.ticket;
+  std::unique_lock<std::mutex> lock(mutex_);
+  // writers that outrun the disk wait here instead of holding more files
+  committed_.wait(lock, [&]() { return queue_.size() < MAX_QUEUED; });
+  queue_.push_back(std::move(staged));
+  lock.unlock();
+  staged_.notify_one();
+  return ticket;
+}
+
+bool GroupCommit::wait(std::uint64_t ticket) {
+  if (ticket == 0) return false;
+  std::unique_lock<std::mutex> lock(mutex_);
+  committed_.wait(lock, [&]() { return results_.count(ticket) > 0; });
+  bool committed = results_[ticket];
+  results_.erase(ticket);
+  return committed;
+}
+
+bool GroupCommit::poll(std::uint64_t ticket, bool& committed) {
+  committed = false;
+  if (ticket == 0) return true;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = results_.find(ticket);
+  if (it == results_.end()) return false;
+  committed = it->second;
+  results_.erase(it);
+  return true;
+}
+
+bool GroupCommit::isTemporary(const std::string& fileName) {
+  return fileName.rfind(TEMP_PREFIX, 0) == 0;
+}
+
+void GroupCommit::removeTemporaries(const std::filesystem::path& dir) {
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+    if (isTemporary(entry.path().filename().string())) {
+      std::filesystem::remove(entry.path(), error);
+    }
+  }
+}
+
+void GroupCommit::run() {
+  while (true) {
+    std::vector<Staged> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      staged_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      // give writes from other threads the window to join this batch
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(maxDelayMs_);
+      staged_.wait_until(lock, deadline, [&]() {
+        return stopping_ || queue_.size() >= maxBatch_;
+      });
+      std::size_t count = std::min(queue_.size(), maxBatch_);
+      std::move(queue_.begin(), queue_.begin() + count,
+                std::back_inserter(batch));
+      queue_.erase(queue_.begin(), queue_.begin() + count);
+    }
+
+    std::vector<bool> committed = commitBatch(batch);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::size_t i = 0; i < batch.size(); i++) {
+        results_[batch[i].ticket] = committed[i];
+      }
+    }
+    committed_.notify_all();
+  }
+}
+
+std::vector<bool> GroupCommit::commitBatch(std::vector<Staged>& batch) {
+  std::vector<bool> committed(batch.size(), true);
+#ifndef _WIN32
+  // The data first, renaming before it is on disk could expose a torn file.
+  // Each file is synced on its own so an error is charged to that file,
+  // writeback already started when it was staged. syncfs would flush the
+  // whole filesystem and before Linux 5.8 does not report errors.
+  for (std::size_t i = 0; i < batch.size(); i++) {
+    bool synced = fdatasync(batch[i].fd) == 0;
+    committed[i] = ::close(batch[i].fd) == 0 && synced;
+  }
+#endif
+  std::set<std::filesystem::path> dirs;
+  for (std::size_t i = 0; i < batch.size(); i++) {
+    std::error_code error;
+    if (committed[i]) {
+      std::filesystem::rename(batch[i].temporary, batch[i].path, error);
+      committed[i] = !error;
+    }
+    if (!committed[i]) {
+      std::cerr << "Failed to commit " << batch[i].path << std::endl;
+      std::filesystem::remove(batch[i].temporary, error);
+    } else {
+      dirs.insert(batch[i].path.parent_path());
+    }
+  }
+#ifndef _WIN32
+  // one sync per directory makes all of the batch's renames durable
+  for (const auto& dir : dirs) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    if (synced) continue;
+    std::cerr << "Failed to sync " << dir << std::endl;
+    for (std::size_t i = 0; i < batch.size(); i++) {
+      if (batch[i].path.parent_path() == dir) committed[i] = false;
+    }
+  }
+#endif
+  return committed;
+}
@@ -0,0 +1,96 @@
+#ifndef GROUPCOMMIT_H
+#define GROUPCOMMIT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Durable whole file writes. A file is written to a temporary next to its
+// path and replaces it by rename once synced, so a crash leaves either the
+// old file or the new one, never a torn one. Writes staged by any thread
+// within maxDelayMs of each other, up to maxBatch of them, are committed
+// together by one background thread: every temporary is synced, renamed,
+// and then each directory is synced once for the whole batch.
+class GroupCommit {
+ public:
+  static const std::size_t DEFAULT_MAX_BATCH = 64;
+  static const int DEFAULT_MAX_DELAY_MS = 2;
+  // staged writes waiting before stage() blocks
+  static const std::size_t MAX_QUEUED = 256;
+  // temporaries are named TEMP_PREFIX + ticket + "-" + file name
+  static const std::string TEMP_PREFIX;
+
+  GroupCommit();
+  // commits everything still staged
+  ~GroupCommit();
+  GroupCommit(const GroupCommit&) = delete;
+  GroupCommit& operator=(const GroupCommit&) = delete;
+
+  void setLimits(std::size_t maxBatch, int maxDelayMs);
+
+  // Writes data to a temporary and queues it to replace path. Returns the
+  // ticket to wait() for, 0 if the temporary could not be written. Every
+  // ticket has to be waited for.
+  std::uint64_t stage(const std::filesystem::path& path, const char* data,
+                      std::size_t size);
+  // the file is the parts one after another
+  std::uint64_t stage(const std::filesystem::path& path,
+                      const std::vector<std::string_view>& parts);
+  // For files written piece by piece, possibly from several threads: a
+  // temporary for path is created empty and filled with writeAt, then
+  // queued with stage(ticket) or dropped with discard. create returns 0 if
+  // the temporary could not be created.
+  std::uint64_t create(const std::filesystem::path& path);
+  bool writeAt(std::uint64_t ticket, const char* data, std::size_t size,
+               std::uint64_t offset);
+  // queues a created temporary like the other stages, 0 if it is unknown
+  std::uint64_t stage(std::uint64_t ticket);
+  void discard(std::uint64_t ticket);
+  // Blocks until ticket's batch is committed, true if the file is in place.
+  bool wait(std::uint64_t ticket);
+  // Like wait without blocking: false while ticket's batch is not committed
+  // yet, otherwise sets committed and forgets the ticket.
+  bool poll(std::uint64_t ticket, bool& committed);
+
+  static bool isTemporary(const std::string& fileName);
+  // deletes temporaries a crash left in dir
+  static void removeTemporaries(const std::filesystem::path& dir);
+
+ private:
+  struct Staged {
+    std::uint64_t ticket;
+    int fd;
+    std::filesystem::path temporary;
+    std::filesystem::path path;
+  };
+
+  // a new empty temporary for path, its ticket is 0 if it could not be
+  // created
+  Staged newTemporary(const std::filesystem::path& path);
+  // hands staged to the commit thread, returns its ticket
+  std::uint64_t enqueue(Staged&& staged);
+  void run();
+  // true per entry of batch whose file is in place
+  std::vector<bool> commitBatch(std::vector<Staged>& batch);
+
+  std::mutex mutex_;
+  std::condition_variable staged_;     // signalled when a write is queued
+  std::condition_variable committed_;  // signalled after every batch
+  std::deque<Staged> queue_;
+  std::map<std::uint64_t, Staged> created_;  // being written with writeAt
+  std::map<std::uint64_t, bool> results_;  // committed, not yet waited for
+  std::uint64_t nextTicket_ = 1;
+  std::size_t maxBatch_ = DEFAULT_MAX_BATCH;
+  int maxDelayMs_ = DEFAULT_MAX_DELAY_MS;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+#endif  // GROUPCOMMIT_H
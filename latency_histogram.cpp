@@ -0,0 +1,99 @@
+#include "latency_histogram.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+// Values below 128 get their own bucket. Above that each power of two is
+// split into 64 linear sub buckets.
+const int SUB_BUCKET_BITS = 6;
+const std::uint64_t LINEAR_LIMIT = 128;
+
+LatencyHistogram::LatencyHistogram() { reset(); }
+
+std::size_t LatencyHistogram::bucketIndex(std::uint64_t value) {
+  if (value < LINEAR_LIMIT) return value;
+  int msb = 63 - __builtin_clzll(value);
+  int magnitude = msb - SUB_BUCKET_BITS;  // >= 1
+  std::uint64_t sub = value >> magnitude;  // [64, 128)
+  return LINEAR_LIMIT + (magnitude - 1) * 64 + (sub - 64);
+}
+
+std::uint64_t LatencyHistogram::bucketUpperBound(std::size_t i) {
+  if (i < LINEAR_LIMIT) return i;
+  std::size_t magnitude = (i - LINEAR_LIMIT) / 64 + 1;
+  std::uint64_t sub = (i - LINEAR_LIMIT) % 64 + 64;
+  return ((sub + 1) << magnitude) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t value) {
+  counts_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  total_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  std::uint64_t prev = max_.load(std::memory_order_relaxed);
+  while (value > prev &&
+         !max_.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  for (std::size_t i = 0; i < NUM_BUCKETS; i++) {
+    std::uint64_t n = other.bucketCount(i);
+    if (n) counts_[i].fetch_add(n, std::memory_order_relaxed);
+  }
+  total_.fetch_add(other.count(), std::memory_order_relaxed);
+  sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+  std::uint64_t otherMax = other.max();
+  std::uint64_t prev = max_.load(std::memory_order_relaxed);
+  while (otherMax > prev && !max_.compare_exchange_weak(
+                                prev, otherMax, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+  total_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::count() const {
+  return total_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::sum() const {
+  return sum_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const {
+  std::uint64_t n = count();
+  return n ? static_cast<double>(sum()) / n : 0.0;
+}
+
+std::uint64_t LatencyHistogram::bucketCount(std::size_t i) const {
+  return counts_[i].load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::percentile(double q) const {
+  std::uint64_t n = count();
+  if (n == 0) return 0;
+  std::uint64_t rank = static_cast<std::uint64_t>(q * n);
+  if (rank == 0) rank = 1;
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < NUM_BUCKETS; i++) {
+    seen += bucketCount(i);
+    if (seen >= rank) return std::min(bucketUpperBound(i), max());
+  }
+  return max();
+}
+
+std::string LatencyHistogram::summary(const std::string& unit) const {
+  return fmt::format(
+      "n={} mean={:.1f}{u} p50={}{u} p90={}{u} p99={}{u} p99.9={}{u} max={}{u}",
+      count(), mean(), percentile(0.5), percentile(0.9), percentile(0.99),
+      percentile(0.999), max(), fmt::arg("u", unit));
+}
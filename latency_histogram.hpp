@@ -0,0 +1,48 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// HDR style log-linear histogram. Values (usually microseconds) are kept to
+// within 1/64 (~1.5%) of their real value. Recording is a few relaxed atomic
+// adds so it can be shared between threads without a lock.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void record(std::uint64_t value);
+
+  // adds other's counts into this histogram
+  void merge(const LatencyHistogram& other);
+
+  void reset();
+
+  std::uint64_t count() const;
+  std::uint64_t sum() const;
+  std::uint64_t max() const;
+  double mean() const;
+
+  // value at quantile q (0.0 - 1.0), rounded up to its bucket
+  std::uint64_t percentile(double q) const;
+
+  // "p50=.. p90=.. p99=.. p99.9=.. max=.." with the given unit suffix
+  std::string summary(const std::string& unit = "us") const;
+
+  // Bucket access for exporters. Upper bound of bucket i is inclusive.
+  static constexpr std::size_t NUM_BUCKETS = 128 + 57 * 64;
+  std::uint64_t bucketCount(std::size_t i) const;
+  static std::uint64_t bucketUpperBound(std::size_t i);
+
+ private:
+  static std::size_t bucketIndex(std::uint64_t value);
+
+  std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> counts_;
+  std::atomic<std::uint64_t> total_;
+  std::atomic<std::uint64_t> sum_;
+  std::atomic<std::uint64_t> max_;
+};
+
+#endif  // LATENCYHISTOGRAM_H
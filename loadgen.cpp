@@ -0,0 +1,547 @@
+#include <fmt/core.h>
+#include <jsoncpp/json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+#include <zmq_addon.hpp>
+
+#include "latency_histogram.hpp"
+
+// Load generator for SDFSS nodes. Talks to nodes with the same DEALER
+// request/reply frames as Node::sendRequest.
+//
+//   loadgen prepare <spec.json> <dir>   writes the spec's files into dir
+//   loadgen run <spec.json>             runs the workload, prints results
+//   loadgen record <listen_port> <node_ip> <node_port> <out> [seconds]
+//                                       proxies to a node, saving requests
+//   loadgen replay <in> <node_ip> <node_port> [speed]
+//                                       resends a recording, speed 2 = 2x
+//
+// Example spec:
+// {
+//   "targets": [{"ip": "localhost", "port": 31415}],
+//   "concurrency": 8,            // worker threads, one socket each
+//   "rate": 2000,                // total ops/sec, 0 = as fast as possible
+//   "duration_sec": 30,
+//   "timeout_ms": 3000,
+//   "mix": {"read": 0.95, "list": 0.05},
+//   "list_burst": {"every_sec": 10, "count": 50},
+//   "file_prefix": "loadgen_",
+//   "file_count": 1000,
+//   "file_sizes": [{"bytes": 4096, "weight": 0.9},
+//                  {"bytes": 1048576, "weight": 0.09},
+//                  {"bytes": 104857600, "weight": 0.01}]
+// }
+
+using Clock = std::chrono::steady_clock;
+
+#define TIMEOUT_MS 3000  // default reply timeout, same as node.cpp
+// a BUSY reply is retried with the same backoff as node.cpp uses
+#define BUSY_RETRY_MS 20
+#define MAX_BUSY_RETRY_MS 1000
+const int MAX_BUSY_RETRIES = 5;
+
+struct SizeClass {
+  std::uint64_t bytes;
+  double weight;
+};
+
+struct WorkloadSpec {
+  std::vector<std::pair<std::string, int>> targets;
+  int concurrency = 1;
+  double rate = 0;
+  double durationSec = 10;
+  int timeoutMs = TIMEOUT_MS;
+  double readWeight = 1.0;
+  double listWeight = 0.0;
+  double burstEverySec = 0;
+  int burstCount = 0;
+  std::string filePrefix = "loadgen_";
+  int fileCount = 100;
+  std::vector<SizeClass> fileSizes;
+};
+
+bool readSpec(const std::string& path, WorkloadSpec& spec) {
+  std::ifstream infile(path);
+  if (!infile.is_open()) {
+    std::cerr << "Error: Could not open file: " << path << std::endl;
+    return false;
+  }
+  Json::CharReaderBuilder readerBuilder;
+  readerBuilder["allowComments"] = true;
+  Json::Value root;
+  std::string errors;
+  if (!Json::parseFromStream(readerBuilder, infile, &root, &errors)) {
+    std::cerr << "Error: Failed to parse JSON: " << errors << std::endl;
+    return false;
+  }
+
+  for (const auto& target : root["targets"]) {
+    spec.targets.push_back({target["ip"].asString(), target["port"].asInt()});
+  }
+  spec.concurrency = root.get("concurrency", 1).asInt();
+  spec.rate = root.get("rate", 0).asDouble();
+  spec.durationSec = root.get("duration_sec", 10).asDouble();
+  spec.timeoutMs = root.get("timeout_ms", TIMEOUT_MS).asInt();
+  spec.readWeight = root["mix"].get("read", 1.0).asDouble();
+  spec.listWeight = root["mix"].get("list", 0.0).asDouble();
+  spec.burstEverySec = root["list_burst"].get("every_sec", 0).asDouble();
+  spec.burstCount = root["list_burst"].get("count", 0).asInt();
+  spec.filePrefix = root.get("file_prefix", "loadgen_").asString();
+  spec.fileCount = root.get("file_count", 100).asInt();
+  for (const auto& size : root["file_sizes"]) {
+    spec.fileSizes.push_back(
+        {size["bytes"].asUInt64(), size["weight"].asDouble()});
+  }
+  if (spec.fileSizes.empty()) spec.fileSizes.push_back({4096, 1.0});
+
+  return true;
+}
+
+// Writes file_count files with sizes drawn from file_sizes. Seeded so every
+// node prepared from the same spec gets the same file sizes.
+int prepare(const WorkloadSpec& spec, const std::filesystem::path& dir) {
+  std::filesystem::create_directories(dir);
+  std::mt19937_64 rng(42);
+  std::vector<double> weights;
+  for (const auto& size : spec.fileSizes) weights.push_back(size.weight);
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+
+  std::vector<char> block(1 << 20, 'x');
+  std::uint64_t totalBytes = 0;
+  for (int i = 0; i < spec.fileCount; i++) {
+    std::uint64_t fileSize = spec.fileSizes[pick(rng)].bytes;
+    std::ofstream file(dir / (spec.filePrefix + std::to_string(i)),
+                       std::ios::binary);
+    for (std::uint64_t written = 0; written < fileSize;) {
+      std::uint64_t n = std::min<std::uint64_t>(block.size(), fileSize - written);
+      file.write(block.data(), n);
+      written += n;
+    }
+    totalBytes += fileSize;
+  }
+  std::cout << fmt::format("Wrote {} files, {} bytes to {}", spec.fileCount,
+                           totalBytes, dir.string())
+            << std::endl;
+  return 0;
+}
+
+struct RunStats {
+  LatencyHistogram readLatency;
+  LatencyHistogram listLatency;
+  std::atomic<std::uint64_t> bytesIn{0};
+  std::atomic<std::uint64_t> timeouts{0};
+  std::atomic<std::uint64_t> busyReplies{0};
+  std::atomic<std::uint64_t> rejected{0};  // still BUSY after every retry
+};
+
+enum class Reply { OK, BUSY, TIMEOUT };
+
+std::unique_ptr<zmq::socket_t> connectDealer(
+    zmq::context_t& context, const std::pair<std::string, int>& target) {
+  auto socket =
+      std::make_unique<zmq::socket_t>(context, zmq::socket_type::dealer);
+  socket->set(zmq::sockopt::linger, 0);
+  socket->connect(fmt::format("tcp://{}:{}", target.first, target.second));
+  return socket;
+}
+
+// One request in the same framing as Node::sendRequest. On TIMEOUT the
+// socket must be replaced so a late reply is not taken for the next
+// request's. On BUSY retryAfterMs is the node's hint.
+Reply doRequest(zmq::socket_t& socket, const std::string& operation,
+                const std::string& fileName, std::uint64_t requestId,
+                int timeoutMs, std::uint64_t& bytesIn,
+                std::int64_t& retryAfterMs) {
+  std::string requestIdStr = fmt::format("{:016x}", requestId);
+  zmq::message_t operationMessage(operation.c_str(), operation.length()),
+      fileNameMessage(fileName.c_str(), fileName.length()),
+      requestIdMessage(requestIdStr.c_str(), requestIdStr.length());
+  socket.send(operationMessage, zmq::send_flags::sndmore);
+  socket.send(fileNameMessage, zmq::send_flags::sndmore);
+  socket.send(requestIdMessage, zmq::send_flags::none);
+
+  zmq_pollitem_t items[] = {{socket, 0, ZMQ_POLLIN, 0}};
+  if (zmq_poll(items, 1, timeoutMs) <= 0) return Reply::TIMEOUT;
+
+  std::vector<zmq::message_t> recv_msgs;
+  if (!zmq::recv_multipart(socket, std::back_inserter(recv_msgs))) {
+    return Reply::TIMEOUT;
+  }
+  // first frame echoes the request id, then [BUSY, retry after ms] from a
+  // node turning the request away
+  if (recv_msgs.size() == 3 && recv_msgs[1].to_string() == "BUSY") {
+    retryAfterMs = std::strtoll(recv_msgs[2].to_string().c_str(), nullptr, 10);
+    return Reply::BUSY;
+  }
+  bytesIn = 0;
+  for (std::size_t i = 1; i < recv_msgs.size(); i++) {
+    bytesIn += recv_msgs[i].size();
+  }
+  return Reply::OK;
+}
+
+void runWorker(const WorkloadSpec& spec, int workerId, Clock::time_point start,
+               zmq::context_t& context, RunStats& stats) {
+  std::mt19937_64 rng(workerId + 1);
+  std::uint64_t nextRequestId = std::uint64_t(workerId + 1) << 40;
+  std::discrete_distribution<int> pickOp({spec.readWeight, spec.listWeight});
+  std::uniform_int_distribution<int> pickFile(0, spec.fileCount - 1);
+  std::uniform_int_distribution<std::size_t> pickTarget(
+      0, spec.targets.size() - 1);
+
+  std::vector<std::unique_ptr<zmq::socket_t>> sockets;
+  for (const auto& target : spec.targets) {
+    sockets.push_back(connectDealer(context, target));
+  }
+
+  // open loop when a rate is given: latency is measured from the intended
+  // start time, so a stalled node does not hide the queueing it causes
+  const bool openLoop = spec.rate > 0;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(openLoop ? spec.concurrency / spec.rate
+                                             : 0.0));
+  const auto end = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(spec.durationSec));
+  auto nextBurst = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(spec.burstEverySec));
+  auto intended = start;
+
+  while (intended < end) {
+    if (openLoop) std::this_thread::sleep_until(intended);
+    auto opStart = openLoop ? intended : Clock::now();
+
+    int requests = 1;
+    bool list = pickOp(rng) == 1;
+    if (spec.burstEverySec > 0 && opStart >= nextBurst) {
+      requests = std::max(1, spec.burstCount / spec.concurrency);
+      list = true;
+      nextBurst += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(spec.burstEverySec));
+    }
+
+    for (int r = 0; r < requests; r++) {
+      std::size_t target = pickTarget(rng);
+      std::string fileName =
+          list ? "No File Name"
+               : spec.filePrefix + std::to_string(pickFile(rng));
+      std::uint64_t bytesIn = 0;
+      Reply reply = Reply::BUSY;
+      std::int64_t backoffMs = 0;
+      for (int busy = 0; reply == Reply::BUSY && busy <= MAX_BUSY_RETRIES;
+           busy++) {
+        if (busy > 0) {
+          // doubling and jittered like a node's retry, never below the hint
+          std::this_thread::sleep_for(std::chrono::milliseconds(
+              backoffMs / 2 + std::uniform_int_distribution<std::int64_t>(
+                                  0, backoffMs / 2)(rng)));
+        }
+        std::int64_t retryAfterMs = 0;
+        reply = doRequest(*sockets[target], list ? "LIST" : "SEND", fileName,
+                          nextRequestId++, spec.timeoutMs, bytesIn,
+                          retryAfterMs);
+        if (reply == Reply::BUSY) {
+          stats.busyReplies++;
+          backoffMs = std::clamp<std::int64_t>(
+              std::max<std::int64_t>(retryAfterMs, BUSY_RETRY_MS << busy),
+              BUSY_RETRY_MS, MAX_BUSY_RETRY_MS);
+        }
+      }
+      if (reply == Reply::TIMEOUT) {
+        stats.timeouts++;
+        sockets[target] = connectDealer(context, spec.targets[target]);
+        continue;
+      }
+      if (reply == Reply::BUSY) {
+        stats.rejected++;
+        continue;
+      }
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                         Clock::now() - opStart)
+                         .count();
+      (list ? stats.listLatency : stats.readLatency).record(latency);
+      stats.bytesIn += bytesIn;
+    }
+    intended = openLoop ? intended + interval : Clock::now();
+  }
+}
+
+int run(const WorkloadSpec& spec) {
+  if (spec.targets.empty() || spec.concurrency < 1) {
+    std::cerr << "Error: spec needs targets and concurrency >= 1" << std::endl;
+    return -1;
+  }
+  zmq::context_t context;
+  RunStats stats;
+  std::vector<std::thread> workers;
+  auto start = Clock::now();
+  for (int i = 0; i < spec.concurrency; i++) {
+    workers.emplace_back(runWorker, std::cref(spec), i, start,
+                         std::ref(context), std::ref(stats));
+  }
+  for (auto& worker : workers) worker.join();
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::uint64_t ops = stats.readLatency.count() + stats.listLatency.count();
+  std::cout << fmt::format("Ran {:.1f}s, {} workers", elapsed,
+                           spec.concurrency)
+            << std::endl;
+  std::cout << fmt::format("Throughput: {:.1f} ops/s, {:.2f} MB/s", ops / elapsed,
+                           stats.bytesIn.load() / elapsed / 1e6)
+            << std::endl;
+  std::cout << "Timeouts: " << stats.timeouts.load() << std::endl;
+  std::cout << fmt::format("BUSY replies: {}, rejected after {} retries: {}",
+                           stats.busyReplies.load(), MAX_BUSY_RETRIES,
+                           stats.rejected.load())
+            << std::endl;
+  std::cout << "read: " << stats.readLatency.summary() << std::endl;
+  std::cout << "list: " << stats.listLatency.summary() << std::endl;
+  LatencyHistogram all;
+  all.merge(stats.readLatency);
+  all.merge(stats.listLatency);
+  std::cout << "all:  " << all.summary() << std::endl;
+  return 0;
+}
+
+// Recording format, repeated per request:
+//   u64 microseconds since start | u32 frame count | (u32 size | bytes)...
+// The first frame is the client's routing id.
+void writeRecord(std::ofstream& out, std::uint64_t timestampUs,
+                 const std::vector<zmq::message_t>& frames) {
+  std::uint32_t frameCount = frames.size();
+  out.write(reinterpret_cast<const char*>(&timestampUs), sizeof(timestampUs));
+  out.write(reinterpret_cast<const char*>(&frameCount), sizeof(frameCount));
+  for (const auto& frame : frames) {
+    std::uint32_t size = frame.size();
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(static_cast<const char*>(frame.data()), size);
+  }
+}
+
+bool readRecord(std::ifstream& in, std::uint64_t& timestampUs,
+                std::vector<std::string>& frames) {
+  std::uint32_t frameCount = 0;
+  if (!in.read(reinterpret_cast<char*>(&timestampUs), sizeof(timestampUs)) ||
+      !in.read(reinterpret_cast<char*>(&frameCount), sizeof(frameCount))) {
+    return false;
+  }
+  frames.clear();
+  for (std::uint32_t i = 0; i < frameCount; i++) {
+    std::uint32_t size = 0;
+    if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    std::string frame(size, '\0');
+    if (!in.read(frame.data(), size)) return false;
+    frames.push_back(std::move(frame));
+  }
+  return true;
+}
+
+// Sits in front of a node. Clients connect to listenPort instead of the
+// node; every request is written to outPath and forwarded, each client
+// through its own DEALER so replies find their way back.
+int record(int listenPort, const std::pair<std::string, int>& node,
+           const std::string& outPath, double seconds) {
+  std::ofstream out(outPath, std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Error: Could not open file: " << outPath << std::endl;
+    return -1;
+  }
+  zmq::context_t context;
+  zmq::socket_t frontend(context, zmq::socket_type::router);
+  frontend.bind(fmt::format("tcp://*:{}", listenPort));
+  std::map<std::string, std::unique_ptr<zmq::socket_t>> backends;
+  std::vector<std::string> backendIds;
+
+  std::cout << fmt::format("Recording tcp://*:{} -> tcp://{}:{} into {}",
+                           listenPort, node.first, node.second, outPath)
+            << std::endl;
+  auto start = Clock::now();
+  std::uint64_t recorded = 0;
+  while (seconds <= 0 ||
+         std::chrono::duration<double>(Clock::now() - start).count() <
+             seconds) {
+    std::vector<zmq_pollitem_t> items = {{frontend, 0, ZMQ_POLLIN, 0}};
+    for (const auto& id : backendIds) {
+      items.push_back({*backends[id], 0, ZMQ_POLLIN, 0});
+    }
+    if (zmq_poll(items.data(), items.size(), 500) <= 0) continue;
+
+    if (items[0].revents & ZMQ_POLLIN) {
+      std::vector<zmq::message_t> frames;
+      if (zmq::recv_multipart(frontend, std::back_inserter(frames)) &&
+          frames.size() > 1) {
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                       Clock::now() - start)
+                       .count();
+        writeRecord(out, now, frames);
+        recorded++;
+        std::string id = frames[0].to_string();
+        if (!backends.count(id)) {
+          backends[id] = connectDealer(context, node);
+          backendIds.push_back(id);
+        }
+        for (std::size_t i = 1; i < frames.size(); i++) {
+          backends[id]->send(frames[i], i + 1 < frames.size()
+                                            ? zmq::send_flags::sndmore
+                                            : zmq::send_flags::none);
+        }
+      }
+    }
+    for (std::size_t i = 1; i < items.size(); i++) {
+      if (!(items[i].revents & ZMQ_POLLIN)) continue;
+      const std::string& id = backendIds[i - 1];
+      std::vector<zmq::message_t> frames;
+      if (!zmq::recv_multipart(*backends[id], std::back_inserter(frames))) {
+        continue;
+      }
+      zmq::message_t idMsg(id.c_str(), id.length());
+      frontend.send(idMsg, zmq::send_flags::sndmore);
+      for (std::size_t f = 0; f < frames.size(); f++) {
+        frontend.send(frames[f], f + 1 < frames.size()
+                                     ? zmq::send_flags::sndmore
+                                     : zmq::send_flags::none);
+      }
+    }
+  }
+  std::cout << "Recorded " << recorded << " requests." << std::endl;
+  return 0;
+}
+
+// Replays a recording against a node. Each recorded client gets its own
+// DEALER and requests keep their original spacing divided by speed.
+int replay(const std::string& inPath, const std::pair<std::string, int>& node,
+           double speed) {
+  std::ifstream in(inPath, std::ios::binary);
+  if (!in.is_open()) {
+    std::cerr << "Error: Could not open file: " << inPath << std::endl;
+    return -1;
+  }
+  struct Request {
+    std::uint64_t timestampUs;
+    std::vector<std::string> frames;
+  };
+  std::vector<Request> requests;
+  Request request;
+  while (readRecord(in, request.timestampUs, request.frames)) {
+    requests.push_back(request);
+  }
+  if (speed <= 0) speed = 1;
+
+  zmq::context_t context;
+  std::map<std::string, std::unique_ptr<zmq::socket_t>> clients;
+  // send times per client by request id. The node schedules requests by
+  // class, so replies can come back in another order than they were sent.
+  std::map<std::string, std::map<std::string, Clock::time_point>> sent;
+  LatencyHistogram latency;
+  std::uint64_t bytesIn = 0;
+
+  auto drain = [&](int timeoutMs) {
+    std::vector<zmq_pollitem_t> items;
+    std::vector<std::string> ids;
+    for (auto& [id, socket] : clients) {
+      if (sent[id].empty()) continue;
+      items.push_back({*socket, 0, ZMQ_POLLIN, 0});
+      ids.push_back(id);
+    }
+    if (items.empty()) return false;
+    if (zmq_poll(items.data(), items.size(), timeoutMs) <= 0) return false;
+    for (std::size_t i = 0; i < items.size(); i++) {
+      if (!(items[i].revents & ZMQ_POLLIN)) continue;
+      std::vector<zmq::message_t> frames;
+      if (!zmq::recv_multipart(*clients[ids[i]], std::back_inserter(frames))) {
+        continue;
+      }
+      for (const auto& frame : frames) bytesIn += frame.size();
+      // [request id, payload...], a streamed reply continues while its
+      // slices start with "+"
+      auto& pending = sent[ids[i]];
+      auto request = pending.find(frames[0].to_string());
+      if (request == pending.end() ||
+          (frames.size() > 1 && frames[1].to_string() == "+")) {
+        continue;
+      }
+      latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                         Clock::now() - request->second)
+                         .count());
+      pending.erase(request);
+    }
+    return true;
+  };
+
+  auto start = Clock::now();
+  for (const auto& req : requests) {
+    auto due = start + std::chrono::microseconds(
+                           static_cast<std::uint64_t>(req.timestampUs / speed));
+    while (Clock::now() < due) {
+      auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        due - Clock::now())
+                        .count();
+      if (!drain(static_cast<int>(waitMs))) std::this_thread::sleep_until(due);
+    }
+    const std::string& id = req.frames[0];
+    if (!clients.count(id)) clients[id] = connectDealer(context, node);
+    for (std::size_t i = 1; i < req.frames.size(); i++) {
+      zmq::message_t msg(req.frames[i].data(), req.frames[i].size());
+      clients[id]->send(msg, i + 1 < req.frames.size()
+                                 ? zmq::send_flags::sndmore
+                                 : zmq::send_flags::none);
+    }
+    // [identity, operation, file name, request id, args...]
+    if (req.frames.size() > 3) sent[id][req.frames[3]] = Clock::now();
+  }
+  // wait for the stragglers
+  while (drain(TIMEOUT_MS)) {
+  }
+
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << fmt::format("Replayed {} requests in {:.1f}s ({:.1f} ops/s, "
+                           "{:.2f} MB/s), {} unanswered",
+                           requests.size(), elapsed, requests.size() / elapsed,
+                           bytesIn / elapsed / 1e6,
+                           requests.size() - latency.count())
+            << std::endl;
+  std::cout << "latency: " << latency.summary() << std::endl;
+  return 0;
+}
+
+void printUsage() {
+  std::cout << "\
+  loadgen prepare <spec.json> <dir>\n\
+  loadgen run <spec.json>\n\
+  loadgen record <listen_port> <node_ip> <node_port> <out> [seconds]\n\
+  loadgen replay <in> <node_ip> <node_port> [speed]"
+            << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  if (args.size() >= 2 && (args[0] == "run" || args[0] == "prepare")) {
+    WorkloadSpec spec;
+    if (!readSpec(args[1], spec)) return -1;
+    if (args[0] == "run") return run(spec);
+    if (args.size() >= 3) return prepare(spec, args[2]);
+  }
+  if (args.size() >= 5 && args[0] == "record") {
+    return record(std::stoi(args[1]), {args[2], std::stoi(args[3])}, args[4],
+                  args.size() >= 6 ? std::stod(args[5]) : 0);
+  }
+  if (args.size() >= 4 && args[0] == "replay") {
+    return replay(args[1], {args[2], std::stoi(args[3])},
+                  args.size() >= 5 ? std::stod(args[4]) : 1);
+  }
+  printUsage();
+  return -1;
+}
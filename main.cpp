@@ -20,6 +20,18 @@ void runNodeRequestHandler(Node &node, std::atomic<bool> &serverRunning) {
   node.handleRequests(serverRunning);
 }
 
+void runNodeHeartbeat(Node &node, std::atomic<bool> &serverRunning) {
+  node.runHeartbeat(serverRunning);
+}
+
+void runNodeAntiEntropy(Node &node, std::atomic<bool> &serverRunning) {
+  node.runAntiEntropy(serverRunning);
+}
+
+void runNodeReplication(Node &node, std::atomic<bool> &serverRunning) {
+  node.runReplication(serverRunning);
+}
+
 std::vector<std::string> split_string(const std::string &str) {
   std::vector<std::string> words;
   std::istringstream iss(str);
@@ -34,7 +46,9 @@ std::vector<std::string> split_string(const std::string &str) {
 
 void readConfigFromFile(std::pair<std::string, int> &nodeIp,
                         std::vector<std::pair<std::string, int>> &targetNodes,
-                        std::string &rootDir) {
+                        std::string &rootDir,
+                        Node::BandwidthLimits &bandwidth,
+                        std::size_t &commitBatch, int &commitDelayMs) {
   std::string jsonName = JSONFILE;
   std::ifstream infile(jsonName);
   if (!infile.is_open()) {
@@ -62,23 +76,45 @@ void readConfigFromFile(std::pair<std::string, int> &nodeIp,
   const Json::Value targetNodesArray = root["target_nodes"];
   for (const auto &targetNode : targetNodesArray) {
     std::pair<std::string, int> target;
-    target.first = targetNode["ip"].asString();
-    target.second = targetNode["port"].asInt();
+    // "endpoint" ("ipc://...", "inproc://...") overrides ip and port
+    if (targetNode.isMember("endpoint")) {
+      target.first = targetNode["endpoint"].asString();
+      target.second = 0;
+    } else {
+      target.first = targetNode["ip"].asString();
+      target.second = targetNode["port"].asInt();
+    }
     targetNodes.push_back(target);
   }
+
+  // optional outbound limits in bytes per second, 0 or missing for none
+  const Json::Value limits = root["bandwidth"];
+  bandwidth.nodeBytesPerSec = limits["node_bytes_per_sec"].asUInt64();
+  bandwidth.peerBytesPerSec = limits["peer_bytes_per_sec"].asUInt64();
+  bandwidth.backgroundBytesPerSec =
+      limits["background_bytes_per_sec"].asUInt64();
+  bandwidth.burstBytes = limits["burst_bytes"].asUInt64();
+
+  // optional group commit window, missing values keep the defaults
+  const Json::Value commit = root["commit"];
+  commitBatch = commit.get("max_batch", Json::UInt64(commitBatch)).asUInt64();
+  commitDelayMs = commit.get("max_delay_ms", commitDelayMs).asInt();
 }
 
 void printHelp() {
   std::cout << "\
   SIMPLE DISTRIBUTED FILE STORAGE SYSTEM COMMANDS\n\
   1) read [filename]     | Prints contents of file. Only use on text documents.\n\
-  2) get [filename]      | Adds a copy of another file on a differnt node to the users node.\n\
+  2) get [filename...]   | Adds a copy of another file on a differnt node to the users node. Several files are fetched together.\n\
   3) create [filename]   | Creates a file on the user's node.\n\
   4) delete [filename]   | Deletes a file from the user's node.\n\
   5) update              | Notifies other nodes of changes to the user's node.\n\
-  6) list                | Updates files. Lists all files in the DFSS. Lists files on user's nodes first, followed by files on other active nodes.\n\
+  6) list [prefix]       | Updates files. Lists all files in the DFSS, or those starting with prefix. Lists files on user's nodes first, followed by files on other active nodes.\n\
   7) refresh             | Refreshes file storage system. Use this if changes are made through another filesystem.\n\
-  8) exit                | Closes node, exits storage system."
+  8) stats [prom|all]    | Prints this node's metrics. \"prom\" prints Prometheus text, \"all\" also asks other nodes.\n\
+  9) trace [file] [all]  | Writes recorded request spans as Chrome trace JSON. \"all\" adds other nodes' spans.\n\
+  10) stripe [filename...] | Spreads large files across the online nodes so they are read from all of them at once. Without names stripes every file of 64 MB or more.\n\
+  11) exit               | Closes node, exits storage system."
             << std::endl;
 }
 
@@ -86,18 +122,45 @@ void createFile(Node &node, std::string fileName) { node.createFile(fileName); }
 void deleteFile(Node &node, std::string fileName) { node.deleteFile(fileName); }
 void readFile(Node &node, std::string fileName) { node.readFile(fileName); }
 void getFile(Node &node, std::string fileName) { node.getFile(fileName); }
+void getFiles(Node &node, std::vector<std::string> input) {
+  node.getFiles(std::vector<std::string>(input.begin() + 1, input.end()));
+}
 void updateFile(Node &node) {}
-void listFiles(Node &node) { node.listFiles(); }
+void listFiles(Node &node, std::vector<std::string> input) {
+  node.listFiles(input.size() > 1 ? input[1] : "");
+}
+void stripeFiles(Node &node, std::vector<std::string> input) {
+  node.stripeFiles(std::vector<std::string>(input.begin() + 1, input.end()));
+}
 void refresh(Node &node) { node.refresh(); }
+void stats(Node &node, std::vector<std::string> input) {
+  bool prometheus = input.size() > 1 && input[1] == "prom";
+  std::cout << node.getStats(prometheus) << std::endl;
+  if (input.size() > 1 && input[1] == "all") {
+    node.sendRequest(Node::FileOperation::STATS);
+  }
+}
+
+void trace(Node &node, std::vector<std::string> input) {
+  std::string path = input.size() > 1 ? input[1] : "trace.json";
+  bool includePeers = input.size() > 2 && input[2] == "all";
+  if (node.dumpTrace(path, includePeers)) {
+    std::cout << "Wrote trace to " << path << std::endl;
+  }
+}
 
 void process(std::vector<std::string> input, Node &node) {
   if (input[0] == "help") printHelp();
   if (input[0] == "create") createFile(node, input[1]);
   if (input[0] == "delete") deleteFile(node, input[1]);
   if (input[0] == "read") readFile(node, input[1]);
-  if (input[0] == "get") getFile(node, input[1]);
+  if (input[0] == "get" && input.size() == 2) getFile(node, input[1]);
+  if (input[0] == "get" && input.size() > 2) getFiles(node, input);
   if (input[0] == "refresh") refresh(node);
-  if (input[0] == "list") listFiles(node);
+  if (input[0] == "list") listFiles(node, input);
+  if (input[0] == "stats") stats(node, input);
+  if (input[0] == "trace") trace(node, input);
+  if (input[0] == "stripe") stripeFiles(node, input);
 }
 
 std::string cleanStr(std::string line) {
@@ -111,8 +174,12 @@ int main(int argc, char *argv[]) {
   std::pair<std::string, int> nodeIp;
   std::vector<std::pair<std::string, int>> targetNodes;
   std::string rootDir;
+  Node::BandwidthLimits bandwidth;
+  std::size_t commitBatch = GroupCommit::DEFAULT_MAX_BATCH;
+  int commitDelayMs = GroupCommit::DEFAULT_MAX_DELAY_MS;
 
-  readConfigFromFile(nodeIp, targetNodes, rootDir);
+  readConfigFromFile(nodeIp, targetNodes, rootDir, bandwidth, commitBatch,
+                     commitDelayMs);
 
   if(!std::filesystem::exists(JSONFILE)) {
     std::cout << "Please provide a config named \""<< JSONFILE << "\"" << std::endl;
@@ -120,11 +187,19 @@ int main(int argc, char *argv[]) {
   }
 
   Node node(rootDir, targetNodes, nodeIp.first, nodeIp.second);
+  node.setBandwidthLimits(bandwidth);
+  node.setCommitLimits(commitBatch, commitDelayMs);
 
   std::atomic<bool> serverRunning(true);
 
   std::thread serverThread(runNodeRequestHandler, std::ref(node),
                            std::ref(serverRunning));
+  std::thread heartbeatThread(runNodeHeartbeat, std::ref(node),
+                              std::ref(serverRunning));
+  std::thread antiEntropyThread(runNodeAntiEntropy, std::ref(node),
+                                std::ref(serverRunning));
+  std::thread replicationThread(runNodeReplication, std::ref(node),
+                                std::ref(serverRunning));
 
   std::cout << "Input \"help\" for commands. " << std::endl;
 
@@ -146,6 +221,9 @@ int main(int argc, char *argv[]) {
 
   serverRunning = false;
   serverThread.join();
+  heartbeatThread.join();
+  antiEntropyThread.join();
+  replicationThread.join();
   std::cout << "See you later alligator!" << std::endl;
 
   return 0;
@@ -0,0 +1,130 @@
+#include "merkle_tree.hpp"
+
+#include "name_hash.hpp"
+
+MerkleTree::MerkleTree() : levels_(DEPTH + 1) {
+  std::size_t width = 1;
+  for (int level = 0; level <= DEPTH; level++) {
+    levels_[level].assign(width, 0);
+    width *= FANOUT;
+  }
+  dirty_ = true;
+}
+
+std::size_t MerkleTree::numBuckets() {
+  std::size_t buckets = 1;
+  for (int level = 0; level < DEPTH; level++) buckets *= FANOUT;
+  return buckets;
+}
+
+std::size_t MerkleTree::bucketOf(const std::string& name) {
+  return fnv1a64(name) % numBuckets();
+}
+
+std::uint64_t MerkleTree::entryHash(
+    const std::string& name, const NodeFileSystem::fileMetadata& metadata) {
+  // '\0' between fields so "ab"+"c" and "a"+"bc" differ
+  std::uint64_t hash = fnv1a64(name + '\0');
+  hash = fnv1a64(std::to_string(metadata.fileSize) + '\0', hash);
+  hash = fnv1a64(metadata.lastModified + '\0', hash);
+  hash = fnv1a64(metadata.storedIpAddress, hash);
+  // only striped files hash their stripe map, other hashes stay as they were
+  if (metadata.stripeSize > 0) {
+    hash = fnv1a64('\0' + std::to_string(metadata.stripeSize), hash);
+    for (const auto& holder : metadata.stripeHolders) {
+      hash = fnv1a64('\0' + holder, hash);
+    }
+  }
+  return mix64(hash);
+}
+
+bool MerkleTree::set(const std::string& name,
+                     const NodeFileSystem::fileMetadata& metadata) {
+  std::size_t bucket = bucketOf(name);
+  std::uint64_t hash = entryHash(name, metadata);
+  auto [it, inserted] = buckets_[bucket].emplace(name, hash);
+  if (!inserted) {
+    levels_[DEPTH][bucket] ^= it->second;
+    it->second = hash;
+  }
+  levels_[DEPTH][bucket] ^= hash;
+  dirty_ = true;
+  return inserted;
+}
+
+bool MerkleTree::erase(const std::string& name) {
+  std::size_t bucket = bucketOf(name);
+  auto bucketIt = buckets_.find(bucket);
+  if (bucketIt == buckets_.end()) return false;
+  auto it = bucketIt->second.find(name);
+  if (it == bucketIt->second.end()) return false;
+  levels_[DEPTH][bucket] ^= it->second;
+  bucketIt->second.erase(it);
+  if (bucketIt->second.empty()) buckets_.erase(bucketIt);
+  dirty_ = true;
+  return true;
+}
+
+void MerkleTree::clear() {
+  buckets_.clear();
+  levels_[DEPTH].assign(numBuckets(), 0);
+  dirty_ = true;
+}
+
+void MerkleTree::recompute() const {
+  if (!dirty_) return;
+  for (int level = DEPTH - 1; level >= 0; level--) {
+    for (std::size_t i = 0; i < levels_[level].size(); i++) {
+      std::uint64_t hash = 14695981039346656037ULL;
+      for (std::size_t c = 0; c < FANOUT; c++) {
+        hash = mix64(hash ^ levels_[level + 1][i * FANOUT + c]);
+      }
+      levels_[level][i] = hash;
+    }
+  }
+  dirty_ = false;
+}
+
+std::uint64_t MerkleTree::hash(int level, std::size_t index) const {
+  if (level < 0 || level > DEPTH || index >= levels_[level].size()) return 0;
+  recompute();
+  return levels_[level][index];
+}
+
+std::vector<std::uint64_t> MerkleTree::childHashes(int level,
+                                                   std::size_t index) const {
+  if (level < 0 || level >= DEPTH || index >= levels_[level].size()) return {};
+  recompute();
+  auto first = levels_[level + 1].begin() + index * FANOUT;
+  return std::vector<std::uint64_t>(first, first + FANOUT);
+}
+
+std::vector<std::string> MerkleTree::bucketNames(std::size_t bucket) const {
+  std::vector<std::string> names;
+  auto it = buckets_.find(bucket);
+  if (it == buckets_.end()) return names;
+  for (const auto& entry : it->second) names.push_back(entry.first);
+  return names;
+}
+
+std::string MerkleTree::encodeHashes(const std::vector<std::uint64_t>& hashes) {
+  std::string data;
+  data.reserve(hashes.size() * 8);
+  for (std::uint64_t hash : hashes) {
+    for (int byte = 0; byte < 8; byte++) {
+      data.push_back(static_cast<char>((hash >> (8 * byte)) & 0xff));
+    }
+  }
+  return data;
+}
+
+std::vector<std::uint64_t> MerkleTree::decodeHashes(const std::string& data) {
+  std::vector<std::uint64_t> hashes(data.size() / 8, 0);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    for (int byte = 0; byte < 8; byte++) {
+      hashes[i] |= std::uint64_t(static_cast<unsigned char>(data[i * 8 + byte]))
+                   << (8 * byte);
+    }
+  }
+  return hashes;
+}
@@ -0,0 +1,56 @@
+#ifndef MERKLETREE_H
+#define MERKLETREE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "node_filesystem.hpp"
+
+// Merkle tree over file metadata. Names are bucketed by hash into
+// FANOUT^DEPTH leaves. A leaf's hash is the XOR of its entries' hashes, so
+// entries are added and removed without rehashing the bucket. Inner hashes
+// are recomputed lazily the next time one is read.
+//
+// Two nodes compare roots and only descend into children whose hashes
+// differ, so a few differing entries cost a few small replies.
+class MerkleTree {
+ public:
+  static const int FANOUT = 16;
+  static const int DEPTH = 3;  // 4096 buckets
+
+  MerkleTree();
+
+  // adds name or replaces its metadata, returns true if name was new
+  bool set(const std::string& name,
+           const NodeFileSystem::fileMetadata& metadata);
+  // returns true if name was in the tree
+  bool erase(const std::string& name);
+  void clear();
+
+  // level 0 is the root, level DEPTH the buckets
+  std::uint64_t hash(int level, std::size_t index) const;
+  std::vector<std::uint64_t> childHashes(int level, std::size_t index) const;
+
+  static std::size_t numBuckets();
+  static std::size_t bucketOf(const std::string& name);
+  std::vector<std::string> bucketNames(std::size_t bucket) const;
+
+  // hashes as 8 byte little endian words for MERKLE replies
+  static std::string encodeHashes(const std::vector<std::uint64_t>& hashes);
+  static std::vector<std::uint64_t> decodeHashes(const std::string& data);
+
+ private:
+  static std::uint64_t entryHash(const std::string& name,
+                                 const NodeFileSystem::fileMetadata& metadata);
+  void recompute() const;
+
+  // bucket -> name -> entry hash, only non-empty buckets are kept since
+  // every peer has a tree
+  std::map<std::size_t, std::map<std::string, std::uint64_t>> buckets_;
+  mutable std::vector<std::vector<std::uint64_t>> levels_;
+  mutable bool dirty_ = false;
+};
+
+#endif  // MERKLETREE_H
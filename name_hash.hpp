@@ -0,0 +1,28 @@
+#ifndef NAMEHASH_H
+#define NAMEHASH_H
+
+#include <cstdint>
+#include <string>
+
+// Hashes that go over the wire, so they are fixed instead of std::hash and
+// every node computes the same values.
+
+// FNV-1a, seed lets callers chain several fields
+inline std::uint64_t fnv1a64(const std::string& data,
+                             std::uint64_t seed = 14695981039346656037ULL) {
+  std::uint64_t hash = seed;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// splitmix64 finalizer
+inline std::uint64_t mix64(std::uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+#endif  // NAMEHASH_H
@@ -2,371 +2,2498 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <zmq.hpp>
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "delta_sync.hpp"
+#include "file_reader.hpp"
+#include "group_commit.hpp"
+#include "merkle_tree.hpp"
 #include "node_filesystem.hpp"
+#include "packed_files.hpp"
+#include "request_scheduler.hpp"
+#include "request_trace.hpp"
+#include "serving_cache.hpp"
 
 const size_t CHUNK_SIZE = 1024;  // 1 kb
 #define TIMEOUT_MS 3000          // 3000 ms (3 seconds)
+const size_t MAX_IN_FLIGHT = 64;  // pipelined requests per peer socket
+#define HEARTBEAT_INTERVAL_MS 500
+#define HEARTBEAT_TIMEOUT_MS 1000
+#define DEAD_PROBE_INTERVAL_MS 2000  // half-open probe rate for dead peers
+const int FAILURES_UNTIL_DEAD = 3;
+const size_t LIST_PAGE_SIZE = 500;       // entries per LIST page we ask for
+const size_t MAX_LIST_PAGE_SIZE = 5000;  // most entries we send in one page
+#define ANTI_ENTROPY_INTERVAL_MS 10000  // background Merkle reconciliation
+#define REPLICATION_INTERVAL_MS 5000  // hot file polling and read count decay
+#define COLD_REPLICA_MS 60000  // replicas not reported hot this long are dropped
+const std::uint32_t HOT_THRESHOLD = 32;  // decayed reads that make a file hot
+const size_t MAX_HOT_FILES = 64;         // files listed in a HOT reply
+const std::uintmax_t BULK_SEND_SIZE = 256 * 1024;  // larger SENDs are bulk
+const std::uintmax_t SEND_SLICE_SIZE = 64 * 1024;  // bulk bytes per turn
+// A SEND asked for with SEND_STREAM_ARG is answered with several replies,
+// each starting with SLICE_MORE, and a final one starting with SLICE_LAST.
+const std::string SEND_STREAM_ARG = "STREAM";
+const std::string SLICE_MORE = "+";
+const std::string SLICE_LAST = ".";
+// after SEND_STREAM_ARG, marks transfers that use the background budget
+const std::string SEND_BACKGROUND_ARG = "BACKGROUND";
+const size_t MAX_PEER_BUCKETS = 1024;  // requesters' buckets before pruning
+const std::uint32_t CACHE_ADMIT_READS = 2;  // reads before a file is cached
+const std::uintmax_t PACK_FILE_SIZE = 64 * 1024;  // larger files get a SEND
+const size_t PACK_MAX_FILES = 256;                // names per PACK request
+const std::size_t PACK_MAX_BYTES = 4 << 20;       // packed bytes per reply
+const size_t PACK_IN_FLIGHT = 4;  // pipelined PACK requests per peer socket
+const std::uintmax_t STRIPE_THRESHOLD = 64 << 20;  // smaller files stay whole
+const std::uint64_t STRIPE_SIZE = 4 << 20;
+const size_t STRIPE_IN_FLIGHT = 4;  // pipelined stripe requests per peer
+// stripes kept for other nodes, and the maps of our own striped files
+const std::string STRIPE_DIR = ".stripes";
+const std::string STRIPE_MAPS_FILE = "maps.json";
+// stripes stored this recently are kept even without a map, it may be on
+// its way
+#define STRIPE_SWEEP_GRACE_MS 600000
+// replies this small time the round trip, larger ones the throughput
+const std::uint64_t THROUGHPUT_MIN_BYTES = 64 * 1024;
+#define HEDGE_MIN_MS 5        // fast peers vary by more than this anyway
+#define HEDGE_UNKNOWN_MS 200  // hedge delay until a peer's replies are timed
+#define HEDGE_POLL_MS 1  // turns two outstanding requests take waiting
+// larger reads are not hedged, a duplicate would cost too much bandwidth
+const std::uintmax_t HEDGE_MAX_SIZE = 1 << 20;
+// DELTAs are computed off the handler thread, this many at a time. Larger
+// files are sent whole, diffing them would hold too much in memory.
+const size_t MAX_DELTA_JOBS = 2;
+const std::uintmax_t MAX_DELTA_SIZE = 64 << 20;
+// Admission control. Past these the handler answers BUSY with a retry hint
+// instead of queueing, so a flood costs a short reply rather than memory.
+const size_t MAX_QUEUED_REQUESTS = 1024;  // per RequestClass queue
+const size_t MAX_SEND_JOBS = 256;  // transfers in progress
+// queued and streaming per requester, above a peer's MAX_IN_FLIGHT
+const size_t MAX_CLIENT_REQUESTS = 2 * MAX_IN_FLIGHT;
+const int RECEIVE_HWM = 4096;  // messages held per peer before TCP pushes back
+// requests taken off the socket per handler iteration, the rest wait there
+const size_t MAX_DRAIN_BATCH = 64;
+const std::string BUSY_REPLY = "BUSY";
+#define BUSY_RETRY_MS 20       // shortest retry hint and first backoff
+#define MAX_BUSY_RETRY_MS 1000  // longest backoff, well inside TIMEOUT_MS
+const int MAX_BUSY_RETRIES = 5;  // then the request fails like a timeout
+
+std::int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
 Node::Node(const std::filesystem::path& rootDir,
            const std::vector<std::pair<std::string, int>>& initialTargetNodes,
            const std::string ipAddress, int port)
+    : Node(rootDir, initialTargetNodes, ipAddress, port, nullptr) {}
+
+Node::Node(const std::filesystem::path& rootDir,
+           const std::vector<std::pair<std::string, int>>& initialTargetNodes,
+           const std::string ipAddress, int port, zmq::context_t& sharedContext)
+    : Node(rootDir, initialTargetNodes, ipAddress, port, &sharedContext) {}
+
+Node::Node(const std::filesystem::path& rootDir,
+           const std::vector<std::pair<std::string, int>>& initialTargetNodes,
+           const std::string ipAddress, int port, zmq::context_t* sharedContext)
     : rootDir_(rootDir),
       targetNodes_(initialTargetNodes),
       fileSystem_(NodeFileSystem(rootDir)),
       ipAddress_(ipAddress),
-      port_(port) {
-  myFileMdata = fileSystem_.getFilesMetadata();
-  for (auto& [filename, metadata] : myFileMdata) {
-    metadata.storedIpAddress = ipAddress_ + ":" + std::to_string(port_);
+      port_(port),
+      sharedContext_(sharedContext != nullptr) {
+  if (sharedContext_) {
+    context_ = sharedContext;
+  } else {
+    ownedContext_ = std::make_unique<zmq::context_t>();
+    context_ = ownedContext_.get();
   }
+  // random high bits keep request ids unique across nodes and restarts
+  nextRequestId_ = std::uint64_t(std::random_device{}()) << 32;
+  // nodes often share a port number, so traces use the random bits instead
+  tracePid_ = static_cast<int>((nextRequestId_ >> 32) & 0x7fffffff);
+  std::map<std::string, NodeFileSystem::fileMetadata> fileMdata =
+      fileSystem_.getFilesMetadata();
+  for (auto& [filename, metadata] : fileMdata) {
+    metadata.storedIpAddress = getNodeName();
+  }
+  applyStripeMaps(fileMdata);
+  GroupCommit::removeTemporaries(rootDir_ / STRIPE_DIR);
+  myFileMdata.store(std::move(fileMdata));
+  // random start so a restarted node never repeats a version peers have
+  filterVersion_ = nextRequestId_.load();
+  rebuildIndexes();
   Node::initialize();
 }
 
 Node::~Node() {
   for (auto& wrapper : clientSockets_) {
-    wrapper->getSocket()->close();
+    wrapper->close();
   }
   serverSocket_.close();
   clientSockets_.clear();
-  context_.close();
+  if (ownedContext_) ownedContext_->close();
+}
+
+// message that takes ownership of data instead of copying it
+zmq::message_t stringMessage(std::string&& data) {
+  auto* owned = new std::string(std::move(data));
+  return zmq::message_t(
+      owned->data(), owned->size(),
+      [](void*, void* hint) { delete static_cast<std::string*>(hint); },
+      owned);
+}
+
+// n bytes of data from pos without a copy, each message keeps data alive
+zmq::message_t sharedMessage(const std::shared_ptr<const std::string>& data,
+                             std::size_t pos, std::size_t n) {
+  auto* owner = new std::shared_ptr<const std::string>(data);
+  return zmq::message_t(
+      const_cast<char*>(data->data()) + pos, n,
+      [](void*, void* hint) {
+        delete static_cast<std::shared_ptr<const std::string>*>(hint);
+      },
+      owner);
+}
+
+// whole file into data, false if it cannot be read
+bool readWholeFile(const std::filesystem::path& path, std::string& data) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+  std::error_code error;
+  std::uintmax_t size = std::filesystem::file_size(path, error);
+  if (error) return false;
+  data.resize(size);
+  file.read(data.data(), size);
+  data.resize(file.gcount());
+  return true;
+}
+
+// "copyof" + name is served as name too, so replicas share read load
+const std::string COPY_PREFIX = "copyof";
+std::string originalName(const std::string& fileName) {
+  return fileName.rfind(COPY_PREFIX, 0) == 0
+             ? fileName.substr(COPY_PREFIX.length())
+             : "";
+}
+
+// a per thread generator for jitter and random choices
+std::mt19937& threadRng() {
+  thread_local std::mt19937 rng(std::random_device{}());
+  return rng;
+}
+
+std::string hashToString(std::uint64_t hash) {
+  return fmt::format("{:016x}", hash);
+}
+
+bool isEndpoint(const std::string& address) {
+  return address.find("://") != std::string::npos;
+}
+
+// endpoints a node listens on besides tcp, so local peers can skip TCP
+std::string ipcEndpoint(int port) {
+  return "ipc://" +
+         (std::filesystem::temp_directory_path() /
+          fmt::format("sdfss-{}.ipc", port))
+             .string();
+}
+
+std::string inprocEndpoint(int port) {
+  return fmt::format("inproc://sdfss-{}", port);
+}
+
+// where a peer keeps stripe index of fileName, relative to its root
+std::string stripeName(const std::string& fileName, std::uint64_t index) {
+  return fmt::format("{}/{}.{}", STRIPE_DIR, fileName, index);
+}
+
+bool Node::isLocalAddress(const std::string& ip) const {
+  return ip == "localhost" || ip == "127.0.0.1" || ip == "::1" ||
+         (ipAddress_ != "*" && ip == ipAddress_);
+}
+
+// Explicit endpoints ("ipc://...", "inproc://...") are used as given. Peers on
+// this host go over ipc, or inproc when the node shares its zmq context with
+// other nodes in the process. Everyone else is reached over tcp.
+std::string Node::resolveEndpoint(const std::string& ip, int port) const {
+  if (isEndpoint(ip)) return ip;
+  if (isLocalAddress(ip)) {
+    if (sharedContext_) return inprocEndpoint(port);
+#ifndef _WIN32
+    return ipcEndpoint(port);
+#endif
+  }
+  return fmt::format("tcp://{}:{}", ip, port);
 }
 
 void Node::initialize() {
-  std::cout << "Initializing server to bind to "
-            << fmt::format("tcp://{}:{}.", ipAddress_, port_) << std::endl;
-  serverSocket_ = zmq::socket_t(context_, zmq::socket_type::router);
-  serverSocket_.bind(fmt::format("tcp://{}:{}", ipAddress_, port_));
+  std::vector<std::string> bindEndpoints;
+  if (isEndpoint(ipAddress_)) {
+    bindEndpoints.push_back(ipAddress_);
+  } else {
+    bindEndpoints.push_back(fmt::format("tcp://{}:{}", ipAddress_, port_));
+#ifndef _WIN32
+    bindEndpoints.push_back(ipcEndpoint(port_));
+#endif
+    if (sharedContext_) bindEndpoints.push_back(inprocEndpoint(port_));
+  }
+
+  serverSocket_ = zmq::socket_t(*context_, zmq::socket_type::router);
+  // applies to connections made after it is set
+  serverSocket_.set(zmq::sockopt::rcvhwm, RECEIVE_HWM);
+  for (const auto& endpoint : bindEndpoints) {
+    std::cout << "Initializing server to bind to " << endpoint << "."
+              << std::endl;
+    try {
+      serverSocket_.bind(endpoint);
+    } catch (const zmq::error_t& e) {
+      // tcp is required, the local transports are only a shortcut
+      if (endpoint == bindEndpoints.front()) throw;
+      std::cerr << "Could not bind " << endpoint << ": " << e.what()
+                << std::endl;
+    }
+  }
   serverSocket_.set(zmq::sockopt::rcvtimeo, 500);
 
   for (const auto& target : targetNodes_) {
-    zmq::socket_t* clientSocket =
-        new zmq::socket_t(context_, zmq::socket_type::dealer);
     std::string targetIp = target.first;
     int targetPort = target.second;
-    // {public ip}:{port}
-    std::cout << "Connecting to: "
-              << fmt::format("tcp://{}:{}.", targetIp, targetPort) << std::endl;
-    clientSocket->connect(fmt::format("tcp://{}:{}", targetIp, targetPort));
-
-    clientSockets_.push_back(
-        std::make_unique<SocketWrapper>(clientSocket, targetIp, targetPort));
+    std::string endpoint = resolveEndpoint(targetIp, targetPort);
+    // each thread that talks to the peer connects its own socket
+    std::cout << "Connecting to: " << endpoint << "." << std::endl;
+    clientSockets_.push_back(std::make_unique<SocketWrapper>(
+        *context_, targetIp, targetPort, endpoint));
   }
+  peerTrees_.resize(clientSockets_.size());
+}
+
+// whether the reply to request comes as slices, each led by a flag
+bool isStreamedRequest(const std::vector<zmq::message_t>& request) {
+  // [identity, operation, file name, request id, args...]
+  if (request.size() < 5 || request[3].size() == 0) return false;
+  std::string operation = request[1].to_string();
+  std::string mode = request[4].to_string();
+  return operation == "PACK" ||
+         (operation == "SEND" && mode == SEND_STREAM_ARG) ||
+         (operation == "STRIPE" && mode == "GET");
+}
+
+bool isBusyReply(const std::vector<zmq::message_t>& reply) {
+  return reply.size() == 2 && reply[0].to_string() == BUSY_REPLY;
+}
+
+// heartbeats, cancels and malformed requests, which are never turned away
+// nor counted against their sender
+bool alwaysAdmitted(const std::vector<zmq::message_t>& request) {
+  if (request.size() < 2) return true;  // dropped by handleRequest
+  std::string operation = request[1].to_string();
+  return operation == "PING" || operation == "CANCEL";
 }
 
 /*
  * Listens to requests infinitely
  * Requests Handled:
  *   READ: Returns
+ *   SEND: Streams the file, or our copy of it, in chunks. With the argument
+ *     STREAM the chunks come as several replies of SEND_SLICE_SIZE, each
+ *     starting with a SLICE_MORE or, for the last one, SLICE_LAST flag.
+ *     STREAM BACKGROUND transfers are held to the background budget.
+ *     Without STREAM the chunks come as one reply, read a slice per turn
+ *     like a stream's and sent once all are read.
  *   DELETE: Removes file from filesystem
- *   LIST: Replies with JSON of the file and metadata map
- *   CREATE: Creates a file in a filesystem
- *   UPDATE: Sends a request to the origin node for an update
+ *   LIST: Replies with JSON of the file and metadata map. With the arguments
+ *     [prefix, cursor, page size] it replies with [page, next cursor] holding
+ *     the names after cursor that start with prefix. The next cursor is empty
+ *     on the last page.
+ *   CREATE: Creates a file in a filesystem. CREATE and STRIPE PUT are
+ *     replied to by sendCommittedReplies once their write is committed, the
+ *     handler serves other requests meanwhile.
+ *   UPDATE: Reconciles with every peer, picking up the origin's changes
  *   UPDATED: Sends a JSON of the file and metadata map
+ *   STATS: Replies with the node's metrics in Prometheus text format
+ *   TRACE: Replies with the node's recorded spans as Chrome trace events
+ *   PING: Replies with PONG, the filter version and the node's name, used by
+ *     the heartbeat
+ *   FILTER: Replies with [version, hash count, bits] of the file name filter
+ *   DELTA: With [block size, signatures] of the requester's old copy, replies
+ *     with [file size, file hash, instructions] to rebuild the current file.
+ *     The delta is computed on a worker, MAX_DELTA_JOBS at a time, and
+ *     files over MAX_DELTA_SIZE are left to a SEND.
+ *   HOT: Replies with JSON {filename: recent reads} of our hot files
+ *   PACK: With [mode, names...] replies like a STREAM SEND with the files
+ *     packed by PackedFiles. Files over PACK_FILE_SIZE are left to a SEND,
+ *     and those past PACK_MAX_BYTES to the next PACK. A BACKGROUND mode is
+ *     held to the background budget.
+ *   STRIPE: With [PUT, index, data] stores a stripe of another node's file
+ *     and replies OK once it is committed. With [GET, index, stripe size,
+ *     mode] replies like a STREAM SEND with that stripe, from a stored
+ *     stripe or our own file.
+ *   CANCEL: With [request id] stops streaming that request to the sender.
+ *     Not replied to.
+ *   MERKLE: With [level, index] below the bucket level, replies with the
+ *     node's hash followed by its children's hashes. At the bucket level it
+ *     replies with the bucket's {filename: metadata} as JSON.
+ * A request is [operation, file name, request id]. The reply starts with the
+ * request id so the requester can match it.
+ * Requests wait in one queue per RequestClass. Control requests are served
+ * first, SENDs and DELTAs of small files next, and SENDs larger than
+ * BULK_SEND_SIZE last, one slice per turn. Slices are limited by the
+ * bandwidth budgets from setBandwidthLimits.
+ * Requests that admitRequest turns away are answered at once with
+ * [BUSY, retry after ms], after the slice flag for a streamed request. The
+ * hint is about how long the requests ahead of it will take.
  */
 void Node::handleRequests(std::atomic<bool>& runServer) {
+  // one queue per RequestClass, served by weight so a LIST never waits
+  // behind more than one slice of a bulk transfer
+  std::array<std::deque<std::vector<zmq::message_t>>, NUM_REQUEST_CLASSES>
+      requestQueues;
+  WeightedScheduler scheduler;
+  // Requests held back by injected latency, by when they are due. They wait
+  // side by side, so their delays overlap the way network latency would.
+  std::multimap<std::int64_t, std::vector<zmq::message_t>> delayed;
+  auto pending = [&]() {
+    std::size_t depth = sendJobs_.size() + deltaJobs_.size() +
+                        commitReplies_.size() + delayed.size();
+    for (const auto& queue : requestQueues) depth += queue.size();
+    return depth;
+  };
+  // smoothed time a request or slice takes, to tell turned away requesters
+  // about when the backlog will have drained
+  double serviceUs = 0;
+  auto serve = [&](auto&& work) {
+    auto start = std::chrono::steady_clock::now();
+    work();
+    double elapsedUs = std::chrono::duration<double, std::micro>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    serviceUs += (elapsedUs - serviceUs) / 8;
+  };
+  auto enqueue = [&](std::vector<zmq::message_t>&& request) {
+    auto& queue = requestQueues[static_cast<std::size_t>(
+        classifyRequest(request))];
+    std::int64_t retryAfterMs = std::clamp<std::int64_t>(
+        static_cast<std::int64_t>(pending() * serviceUs / 1000),
+        BUSY_RETRY_MS, MAX_BUSY_RETRY_MS);
+    if (admitRequest(request, queue.size(), retryAfterMs)) {
+      queue.push_back(std::move(request));
+    }
+  };
+  auto receive = [&](std::vector<zmq::message_t>&& request) {
+    int latencyMs = faultLatencyMs_.load();
+    if (latencyMs > 0) {
+      delayed.emplace(steadyNowMs() + latencyMs, std::move(request));
+    } else {
+      enqueue(std::move(request));
+    }
+  };
   while (runServer.load()) {
-    std::vector<zmq::message_t> recv_msgs;
+    sendFinishedDeltas();
+    sendCommittedReplies();
+    while (!delayed.empty() && delayed.begin()->first <= steadyNowMs()) {
+      enqueue(std::move(delayed.begin()->second));
+      delayed.erase(delayed.begin());
+    }
+    if (pending() == 0) {
+      std::vector<zmq::message_t> request;
+      auto ret =
+          zmq::recv_multipart(serverSocket_, std::back_inserter(request));
+      if (!ret) {
+        // std::cout << "Error accepting message (Handler)" << std::endl;
+        continue;
+      }
+      receive(std::move(request));
+    }
+    // pull in what is already waiting so the queue depth is visible, a few
+    // at a time so a flood cannot keep the handler from serving
+    for (std::size_t drained = 0; drained < MAX_DRAIN_BATCH; drained++) {
+      std::vector<zmq::message_t> request;
+      auto ret = zmq::recv_multipart(
+          serverSocket_, std::back_inserter(request), zmq::recv_flags::dontwait);
+      if (!ret) break;
+      receive(std::move(request));
+    }
+    metrics_.setQueueDepth(pending());
+
+    // the first transfer its bandwidth budgets let send a slice
+    auto readyJob = sendJobs_.end();
+    std::int64_t throttledMs = 0;
+    for (auto it = sendJobs_.begin(); it != sendJobs_.end(); ++it) {
+      std::uintmax_t bytes;
+      std::int64_t waitMs;
+      if (sliceBudget(**it, bytes, waitMs)) {
+        readyJob = it;
+        break;
+      }
+      throttledMs = throttledMs == 0 ? waitMs : std::min(throttledMs, waitMs);
+    }
+
+    std::array<bool, NUM_REQUEST_CLASSES> hasWork;
+    for (std::size_t c = 0; c < NUM_REQUEST_CLASSES; c++) {
+      hasWork[c] = !requestQueues[c].empty();
+    }
+    hasWork[static_cast<std::size_t>(RequestClass::BULK)] |=
+        readyJob != sendJobs_.end();
+    std::size_t next = static_cast<std::size_t>(scheduler.next(hasWork));
+    if (next == NUM_REQUEST_CLASSES) {
+      // Every transfer is out of budget or every request is still delayed,
+      // wait for tokens, a due request or a new one.
+      std::int64_t waitMs = throttledMs;
+      if (!delayed.empty()) {
+        std::int64_t dueMs = delayed.begin()->first - steadyNowMs();
+        waitMs = waitMs == 0 ? dueMs : std::min(waitMs, dueMs);
+      }
+      zmq_pollitem_t items[] = {{serverSocket_, 0, ZMQ_POLLIN, 0}};
+      zmq_poll(items, 1, std::clamp<std::int64_t>(waitMs, 1, 500));
+      continue;
+    }
+
+    if (next == static_cast<std::size_t>(RequestClass::BULK) &&
+        requestQueues[next].empty()) {
+      // bulk turn with no new request, transfers take turns by slice
+      std::unique_ptr<SendJob> job = std::move(*readyJob);
+      sendJobs_.erase(readyJob);
+      serve([&]() {
+        if (!sendSlice(*job)) {
+          sendJobs_.push_back(std::move(job));
+        } else {
+          releaseClient(job->identity);
+        }
+      });
+      continue;
+    }
+    std::vector<zmq::message_t> recv_msgs = std::move(requestQueues[next].front());
+    requestQueues[next].pop_front();
+    // a request that became a stream holds its sender's slot until it ends
+    std::size_t jobs = sendJobs_.size();
+    serve([&]() { handleRequest(recv_msgs); });
+    if (sendJobs_.size() <= jobs && !alwaysAdmitted(recv_msgs)) {
+      releaseClient(recv_msgs[0].to_string());
+    }
+  }
+}
+
+bool Node::admitRequest(const std::vector<zmq::message_t>& request,
+                        std::size_t queued, std::int64_t retryAfterMs) {
+  if (alwaysAdmitted(request)) return true;
+  std::string identity = request[0].to_string();
+  bool streamed = isStreamedRequest(request);
+  // older requesters' SENDs are served by a job too
+  bool job = streamed || request[1].to_string() == "SEND";
+  auto load = clientLoad_.find(identity);
+  if (queued < MAX_QUEUED_REQUESTS &&
+      (!job || sendJobs_.size() < MAX_SEND_JOBS) &&
+      (load == clientLoad_.end() || load->second < MAX_CLIENT_REQUESTS)) {
+    clientLoad_[identity]++;
+    return true;
+  }
+  // [identity, request id, (flag,) BUSY, retry after ms]
+  metrics_.countBusy();
+  zmq::message_t identityMessage(request[0].data(), request[0].size());
+  auto res = serverSocket_.send(identityMessage, zmq::send_flags::sndmore);
+  if (request.size() > 3) {
+    zmq::message_t requestIdMessage(request[3].data(), request[3].size());
+    res = serverSocket_.send(requestIdMessage, zmq::send_flags::sndmore);
+  }
+  if (streamed) {
+    zmq::message_t flagMessage(SLICE_LAST.c_str(), SLICE_LAST.length());
+    res = serverSocket_.send(flagMessage, zmq::send_flags::sndmore);
+  }
+  std::string retryAfter = std::to_string(retryAfterMs);
+  zmq::message_t busyMessage(BUSY_REPLY.c_str(), BUSY_REPLY.length()),
+      retryMessage(retryAfter.c_str(), retryAfter.length());
+  res = serverSocket_.send(busyMessage, zmq::send_flags::sndmore);
+  res = serverSocket_.send(retryMessage, zmq::send_flags::none);
+  return false;
+}
+
+void Node::releaseClient(const std::string& identity) {
+  auto load = clientLoad_.find(identity);
+  if (load == clientLoad_.end()) return;
+  if (--load->second == 0) clientLoad_.erase(load);
+}
+
+void Node::startDeltaJob(const std::string& identity,
+                         const std::string& requestIdStr,
+                         const std::string& fileName, std::size_t blockSize,
+                         std::vector<DeltaSync::BlockSignature> basis) {
+  deltaJobs_.push_back(std::async(
+      std::launch::async,
+      [this, identity, requestIdStr, fileName, blockSize,
+       basis = std::move(basis)]() {
+        DeltaReply reply{identity, requestIdStr, {}};
+        std::error_code error;
+        std::uintmax_t size =
+            std::filesystem::file_size(rootDir_ / fileName, error);
+        std::string data;
+        bool found;
+        {
+          ScopedLatency diskLatency(metrics_, NodeMetrics::Phase::DISK_READ);
+          found = !error && size <= MAX_DELTA_SIZE &&
+                  readWholeFile(rootDir_ / fileName, data);
+        }
+        if (!found) {
+          reply.frames = {!error && size > MAX_DELTA_SIZE
+                              ? "FILE TOO LARGE FOR DELTA."
+                              : "FILE WAS NOT FOUND."};
+          return reply;
+        }
+        std::string delta;
+        {
+          ScopedLatency serializeLatency(metrics_,
+                                         NodeMetrics::Phase::SERIALIZE);
+          RequestTrace::Scope deltaSpan(tracePid_, "compute delta",
+                                        parseRequestId(requestIdStr));
+          delta = DeltaSync::computeDelta(data, blockSize, basis);
+          deltaSpan.setDetail(
+              fmt::format("{} of {} bytes", delta.size(), data.size()));
+        }
+        reply.frames = {
+            std::to_string(data.size()),
+            hashToString(DeltaSync::strongHash(data.data(), data.size())),
+            std::move(delta)};
+        return reply;
+      }));
+}
+
+std::size_t Node::sendCommittedReplies() {
+  for (auto it = commitReplies_.begin(); it != commitReplies_.end();) {
+    bool committed;
+    if (!fileSystem_.pollWrite(it->ticket, committed)) {
+      ++it;
+      continue;
+    }
+    std::string reply = it->finish(committed);
+    // [identity, request id, reply], older requesters send no id
+    zmq::message_t identityMsg(it->identity.c_str(), it->identity.length());
+    auto res = serverSocket_.send(identityMsg, zmq::send_flags::sndmore);
+    if (!it->requestIdStr.empty()) {
+      zmq::message_t requestIdMsg(it->requestIdStr.c_str(),
+                                  it->requestIdStr.length());
+      res = serverSocket_.send(requestIdMsg, zmq::send_flags::sndmore);
+    }
+    metrics_.addBytesOut(reply.size());
+    zmq::message_t msg(reply.c_str(), reply.length());
+    res = serverSocket_.send(msg, zmq::send_flags::none);
+    it = commitReplies_.erase(it);
+  }
+  return commitReplies_.size();
+}
+
+std::size_t Node::sendFinishedDeltas() {
+  for (auto it = deltaJobs_.begin(); it != deltaJobs_.end();) {
+    if (it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    DeltaReply reply = it->get();
+    it = deltaJobs_.erase(it);
+    // [identity, request id, file size, file hash, instructions]
+    zmq::message_t identityMsg(reply.identity.c_str(), reply.identity.length()),
+        requestIdMsg(reply.requestIdStr.c_str(), reply.requestIdStr.length());
+    auto res = serverSocket_.send(identityMsg, zmq::send_flags::sndmore);
+    res = serverSocket_.send(requestIdMsg, zmq::send_flags::sndmore);
+    for (std::size_t i = 0; i < reply.frames.size(); i++) {
+      metrics_.addBytesOut(reply.frames[i].size());
+      zmq::message_t msg = stringMessage(std::move(reply.frames[i]));
+      res = serverSocket_.send(msg, i + 1 < reply.frames.size()
+                                        ? zmq::send_flags::sndmore
+                                        : zmq::send_flags::none);
+    }
+  }
+  return deltaJobs_.size();
+}
+
+RequestClass Node::classifyRequest(
+    const std::vector<zmq::message_t>& request) {
+  // [identity, operation, file name, ...]
+  if (request.size() < 3) return RequestClass::CONTROL;
+  std::string operation = request[1].to_string();
+  // a PACK only holds small files
+  if (operation == "PACK") return RequestClass::INTERACTIVE;
+  if (operation == "STRIPE") return RequestClass::BULK;
+  if (operation != "SEND" && operation != "DELTA") {
+    return RequestClass::CONTROL;
+  }
+  std::shared_ptr<const std::string> content;
+  std::shared_ptr<FileHandle> handle =
+      lookupServed(request[2].to_string(), content);
+  return handle && handle->size() > BULK_SEND_SIZE ? RequestClass::BULK
+                                                   : RequestClass::INTERACTIVE;
+}
+
+void Node::handleRequest(std::vector<zmq::message_t>& recv_msgs) {
+  // std::cout << "Got " << recv_msgs.size() << " messages" << std::endl;
+
+  std::vector<std::string> messagesStr;
+
+  for (zmq::message_t& msg : recv_msgs) {
+    messagesStr.push_back(msg.to_string());
+    metrics_.addBytesIn(msg.size());
+  }
+  if (messagesStr.size() < 2) return;  // not a request
+
+  // injected faults, only set by the simulator
+  if (faultLossRate_.load() > 0) {
+    if (std::uniform_real_distribution<double>(0, 1)(threadRng()) <
+        faultLossRate_.load()) {
+      return;
+    }
+  }
+  metrics_.countRequest(messagesStr[1]);
+
+  // older requesters do not send an id
+  std::string requestIdStr = messagesStr.size() > 3 ? messagesStr[3] : "";
+
+  if (messagesStr[1] == "SEND" && messagesStr.size() > 4 &&
+      messagesStr[4] == SEND_STREAM_ARG && !requestIdStr.empty()) {
+    // replied to a slice at a time, the job records its own latency and span
+    bool background =
+        messagesStr.size() > 5 && messagesStr[5] == SEND_BACKGROUND_ARG;
+    startSendJob(messagesStr[0], requestIdStr, messagesStr[2], background);
+    return;
+  }
+  if (messagesStr[1] == "SEND" && messagesStr.size() > 2) {
+    // older requesters get the file as one reply, still read a slice per
+    // turn so a large file does not hold the handler
+    startSendJob(messagesStr[0], requestIdStr, messagesStr[2], false, true);
+    return;
+  }
+  if (messagesStr[1] == "PACK" && !requestIdStr.empty()) {
+    // [identity, PACK, "", request id, mode, names...]
+    bool background =
+        messagesStr.size() > 4 && messagesStr[4] == SEND_BACKGROUND_ARG;
+    std::vector<std::string> fileNames;
+    if (messagesStr.size() > 5) {
+      fileNames.assign(messagesStr.begin() + 5, messagesStr.end());
+    }
+    startPackJob(messagesStr[0], requestIdStr, fileNames, background);
+    return;
+  }
+  if (messagesStr[1] == "CANCEL") {
+    // [identity, CANCEL, "", request id, id of the SEND to drop], a slice
+    // already sent is the last the requester gets
+    for (auto it = sendJobs_.begin(); it != sendJobs_.end(); ++it) {
+      if (messagesStr.size() > 4 && (*it)->identity == messagesStr[0] &&
+          (*it)->requestIdStr == messagesStr[4]) {
+        (*it)->span->setDetail(
+            fmt::format("cancelled after {} slices", (*it)->slices));
+        sendJobs_.erase(it);
+        releaseClient(messagesStr[0]);
+        break;
+      }
+    }
+    return;
+  }
+  if (messagesStr[1] == "STRIPE" && messagesStr.size() > 7 &&
+      messagesStr[4] == "GET" && !requestIdStr.empty()) {
+    // [identity, STRIPE, name, request id, GET, index, stripe size, mode]
+    startStripeJob(messagesStr[0], requestIdStr, messagesStr[2],
+                   std::strtoull(messagesStr[5].c_str(), nullptr, 10),
+                   std::strtoull(messagesStr[6].c_str(), nullptr, 10),
+                   messagesStr[7] == SEND_BACKGROUND_ARG);
+    return;
+  }
+
+  // will not be used permissions not implemented
+  if (messagesStr[1] == "CREATE" && messagesStr.size() > 2) {
+    std::string fileName = messagesStr[2];
+    commitReplies_.push_back(
+        {messagesStr[0], requestIdStr, fileSystem_.stageWrite(fileName, "", 0),
+         [this, fileName](bool committed) {
+           if (!committed) {
+             std::cerr << "Failed to create the file \"" << fileName
+                       << "\".\n";
+             return "Failed to create file: " + fileName;
+           }
+           NodeFileSystem::fileMetadata metadata =
+               fileSystem_.getFileMetaData(fileName);
+           metadata.storedIpAddress = getNodeName();
+           myFileMdata.update([&](auto& files) { files[fileName] = metadata; });
+           indexFile(fileName);
+           return "Created file: " + fileName;
+         }});
+    return;
+  }
+  if (messagesStr[1] == "STRIPE" && messagesStr.size() > 6 &&
+      messagesStr[4] == "PUT") {
+    // [identity, STRIPE, name, request id, PUT, index, data], kept until
+    // the owner stripes the file again
+    std::error_code error;
+    std::filesystem::create_directories(rootDir_ / STRIPE_DIR, error);
+    std::string stripe = stripeName(
+        messagesStr[2], std::strtoull(messagesStr[5].c_str(), nullptr, 10));
+    const zmq::message_t& data = recv_msgs[6];
+    // a name is never a path, nothing is written outside STRIPE_DIR
+    std::uint64_t ticket =
+        error || messagesStr[2].find('/') != std::string::npos
+            ? 0
+            : fileSystem_.stageWrite(
+                  stripe, static_cast<const char*>(data.data()), data.size());
+    std::string fileName = messagesStr[2];
+    commitReplies_.push_back(
+        {messagesStr[0], requestIdStr, ticket,
+         [this, stripe, fileName](bool committed) {
+           servingCache_.invalidate(rootDir_ / stripe);
+           return committed ? std::string("OK")
+                            : "Failed to store stripe of " + fileName;
+         }});
+    return;
+  }
+
+  ScopedLatency requestLatency(metrics_, NodeMetrics::Phase::REQUEST);
+  RequestTrace::Scope serverSpan(
+      tracePid_, "server " + messagesStr[1], parseRequestId(requestIdStr),
+      messagesStr.size() > 2 ? messagesStr[2] : "", RequestTrace::Flow::IN);
+
+  // for (std::string messageString : messagesStr) {
+  //   std::cout << " Recieved (Handler): " << messageString << std::endl;
+  // }
+
+  // return flag
+  zmq::message_t replyMsg(recv_msgs[0].data(), recv_msgs[0].size());
+  auto res = serverSocket_.send(replyMsg, zmq::send_flags::sndmore);
+  if (!requestIdStr.empty()) {
+    zmq::message_t idMsg(requestIdStr.c_str(), requestIdStr.length());
+    res = serverSocket_.send(idMsg, zmq::send_flags::sndmore);
+  }
+
+  // // set reply message
+  if (messagesStr[1] ==
+      "DELETE") {  // will not be used (permissions not implemented)
+    std::string reply;
+
+    std::string deletedFile = fileSystem_.deleteFile(messagesStr[2]);
+    servingCache_.invalidate(rootDir_ / messagesStr[2]);
+    if (deletedFile != "-1") {
+      reply = "Deleted file: " + deletedFile;
+    } else {
+      reply = "Failed to delete file: " + messagesStr[2];
+    }
+
+    zmq::message_t msg(reply.c_str(), reply.length());
+
+    // std::cout << "Sending " << msg.to_string() << std::endl;
+
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "LIST" && messagesStr.size() > 6) {
+    const std::string& prefix = messagesStr[4];
+    const std::string& cursor = messagesStr[5];
+    std::size_t pageSize = std::clamp<std::size_t>(
+        std::strtoull(messagesStr[6].c_str(), nullptr, 10), 1,
+        MAX_LIST_PAGE_SIZE);
+
+    // the cursor is the last name sent, so pages survive inserts/deletes
+    auto snapshot = myFileMdata.load();
+    const auto& files = *snapshot;
+    auto it = cursor.empty() || cursor < prefix ? files.lower_bound(prefix)
+                                                : files.upper_bound(cursor);
+    auto hasPrefix = [&](const std::string& name) {
+      return name.compare(0, prefix.size(), prefix) == 0;
+    };
+    std::map<std::string, NodeFileSystem::fileMetadata> page;
+    for (; it != files.end() && page.size() < pageSize &&
+           hasPrefix(it->first);
+         ++it) {
+      page.insert(*it);
+    }
+    std::string nextCursor;
+    if (it != files.end() && hasPrefix(it->first)) {
+      nextCursor = page.rbegin()->first;
+    }
+
+    std::string jsonString;
+    {
+      ScopedLatency serializeLatency(metrics_,
+                                     NodeMetrics::Phase::SERIALIZE);
+      RequestTrace::Scope serializeSpan(tracePid_, "serialize",
+                                        parseRequestId(requestIdStr),
+                                        fmt::format("{} entries", page.size()));
+      jsonString = NodeFileSystem::metadataToJsonString(page);
+    }
+    metrics_.addBytesOut(jsonString.length() + nextCursor.length());
+
+    zmq::message_t msg = stringMessage(std::move(jsonString));
+    auto res = serverSocket_.send(msg, zmq::send_flags::sndmore);
+    zmq::message_t cursorMsg(nextCursor.c_str(), nextCursor.length());
+    res = serverSocket_.send(cursorMsg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "LIST") {
+    std::shared_ptr<const std::string> jsonString =
+        encodedMetadata(requestIdStr);
+    metrics_.addBytesOut(jsonString->length());
+
+    // the cached document goes out as is, zmq holds a reference to it
+    zmq::message_t msg = sharedMessage(jsonString, 0, jsonString->length());
+
+    // std::cout << "Sending " << msg.to_string() << std::endl;
+
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "STATS") {
+    std::string reply = getStats(true);
+    metrics_.addBytesOut(reply.length());
+
+    zmq::message_t msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "PING") {
+    // the version tells peers when to fetch our filter again, the name is
+    // how they refer to us in stripe maps
+    std::string reply = "PONG";
+    std::string version = std::to_string(filterVersion_.load());
+    std::string name = getNodeName();
+    zmq::message_t msg(reply.c_str(), reply.length()),
+        versionMsg(version.c_str(), version.length()),
+        nameMsg(name.c_str(), name.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::sndmore);
+    res = serverSocket_.send(versionMsg, zmq::send_flags::sndmore);
+    res = serverSocket_.send(nameMsg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "FILTER") {
+    std::string version, numHashes, bits;
+    {
+      std::lock_guard<std::mutex> lock(indexMutex_);
+      version = std::to_string(filterVersion_.load());
+      numHashes = std::to_string(BloomFilter::NUM_HASHES);
+      bits = fileFilter_.toBits();
+    }
+    metrics_.addBytesOut(bits.length());
+    zmq::message_t versionMsg(version.c_str(), version.length()),
+        hashesMsg(numHashes.c_str(), numHashes.length());
+    auto res = serverSocket_.send(versionMsg, zmq::send_flags::sndmore);
+    res = serverSocket_.send(hashesMsg, zmq::send_flags::sndmore);
+    zmq::message_t bitsMsg = stringMessage(std::move(bits));
+    res = serverSocket_.send(bitsMsg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "DELTA") {
+    std::size_t blockSize =
+        messagesStr.size() > 4
+            ? std::strtoull(messagesStr[4].c_str(), nullptr, 10)
+            : 0;
+    std::vector<DeltaSync::BlockSignature> basis;
+    bool valid = messagesStr.size() > 5 &&
+                 blockSize >= DeltaSync::MIN_BLOCK_SIZE &&
+                 blockSize <= DeltaSync::MAX_BLOCK_SIZE &&
+                 DeltaSync::decodeSignatures(messagesStr[5], basis);
+    std::string reply;
+    if (!valid) {
+      reply = "BAD DELTA REQUEST.";
+    } else if (deltaJobs_.size() >= MAX_DELTA_JOBS) {
+      // the requester's SocketWrapper retries like any BUSY request
+      reply = BUSY_REPLY;
+    } else {
+      // reading and diffing a large file takes far longer than a heartbeat
+      startDeltaJob(messagesStr[0], requestIdStr, messagesStr[2], blockSize,
+                    std::move(basis));
+      return;
+    }
+    zmq::message_t msg(reply.c_str(), reply.length());
+    if (reply == BUSY_REPLY) {
+      std::string retryAfter = std::to_string(BUSY_RETRY_MS);
+      zmq::message_t retryMsg(retryAfter.c_str(), retryAfter.length());
+      auto res = serverSocket_.send(msg, zmq::send_flags::sndmore);
+      res = serverSocket_.send(retryMsg, zmq::send_flags::none);
+      metrics_.countBusy();
+    } else {
+      auto res = serverSocket_.send(msg, zmq::send_flags::none);
+    }
+  } else if (messagesStr[1] == "HOT") {
+    Json::Value hot(Json::objectValue);
+    {
+      std::lock_guard<std::mutex> lock(hotMutex_);
+      // hottest first when there are more than fit
+      std::vector<std::pair<std::uint32_t, std::string>> byReads;
+      for (const auto& [name, reads] : hotFiles_) {
+        byReads.push_back({reads, name});
+      }
+      std::sort(byReads.rbegin(), byReads.rend());
+      if (byReads.size() > MAX_HOT_FILES) byReads.resize(MAX_HOT_FILES);
+      for (const auto& [reads, name] : byReads) hot[name] = reads;
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string reply = Json::writeString(builder, hot);
+    metrics_.addBytesOut(reply.length());
+
+    zmq::message_t msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "MERKLE") {
+    int level =
+        messagesStr.size() > 4 ? std::atoi(messagesStr[4].c_str()) : 0;
+    std::size_t index =
+        messagesStr.size() > 5
+            ? std::strtoull(messagesStr[5].c_str(), nullptr, 10)
+            : 0;
+    std::string reply;
+    if (level < MerkleTree::DEPTH) {
+      std::lock_guard<std::mutex> lock(indexMutex_);
+      std::vector<std::uint64_t> hashes = {merkle_.hash(level, index)};
+      std::vector<std::uint64_t> children = merkle_.childHashes(level, index);
+      hashes.insert(hashes.end(), children.begin(), children.end());
+      reply = MerkleTree::encodeHashes(hashes);
+    } else {
+      std::map<std::string, NodeFileSystem::fileMetadata> bucket;
+      {
+        auto files = myFileMdata.load();
+        std::lock_guard<std::mutex> lock(indexMutex_);
+        for (const auto& name : merkle_.bucketNames(index)) {
+          auto it = files->find(name);
+          if (it != files->end()) bucket.insert(*it);
+        }
+      }
+      reply = NodeFileSystem::metadataToJsonString(bucket);
+    }
+    metrics_.addBytesOut(reply.length());
+
+    zmq::message_t msg = stringMessage(std::move(reply));
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "TRACE") {
+    std::string reply = RequestTrace::eventsJson(tracePid_, getNodeName());
+    metrics_.addBytesOut(reply.length());
+
+    zmq::message_t msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else if (messagesStr[1] == "UPDATE") {
+    // acknowledge first, the requester should not wait for our pull
+    std::string reply = "Updating from peers.";
+    zmq::message_t msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+
+    // the anti-entropy thread pulls, so peers reconciling with each other
+    // never block each other's handlers
+    reconcileRequested_ = true;
+  } else if (messagesStr[1] == "UPDATED") {
+    std::shared_ptr<const std::string> jsonString =
+        encodedMetadata(requestIdStr);
+    metrics_.addBytesOut(jsonString->length());
+
+    // the cached document goes out as is, zmq holds a reference to it
+    zmq::message_t msg = sharedMessage(jsonString, 0, jsonString->length());
+
+    // std::cout << "Sending " << msg.to_string() << std::endl;
+
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  } else {  // always finish the reply or it runs into the next one
+    std::string reply = "UNKNOWN OPERATION.";
+    zmq::message_t msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  }
+}
+
+// LIST and UPDATED replies only change with the metadata, so the JSON is
+// kept until a newer snapshot is published.
+std::shared_ptr<const std::string> Node::encodedMetadata(
+    const std::string& requestIdStr) {
+  std::uint64_t version;
+  auto files = myFileMdata.load(version);
+  if (!encodedMetadata_ || encodedVersion_ != version) {
+    ScopedLatency serializeLatency(metrics_, NodeMetrics::Phase::SERIALIZE);
+    RequestTrace::Scope serializeSpan(tracePid_, "serialize",
+                                      parseRequestId(requestIdStr));
+    encodedMetadata_ = std::make_shared<const std::string>(
+        NodeFileSystem::metadataToJsonString(*files));
+    encodedVersion_ = version;
+  }
+  return encodedMetadata_;
+}
+
+std::shared_ptr<FileHandle> Node::lookupServed(
+    const std::string& fileName, std::shared_ptr<const std::string>& content) {
+  std::shared_ptr<FileHandle> handle =
+      servingCache_.lookup(rootDir_ / fileName, content);
+  if (!handle) {
+    handle = servingCache_.lookup(rootDir_ / (COPY_PREFIX + fileName), content);
+  }
+  return handle;
+}
+
+bool Node::openForSend(const std::string& fileName, SendJob& job) {
+  std::shared_ptr<FileHandle> handle = lookupServed(fileName, job.content);
+  if (!handle) return false;
+  std::uint32_t reads = readSketch_.add(fileName);
+  if (reads >= HOT_THRESHOLD) {
+    std::lock_guard<std::mutex> lock(hotMutex_);
+    hotFiles_[fileName] = reads;
+  }
+  // files read more than once are kept in memory while small enough
+  if (!job.content && reads >= CACHE_ADMIT_READS) {
+    job.content = servingCache_.cacheContent(handle);
+  }
+  metrics_.countSendCache(job.content != nullptr);
+  if (job.content) {
+    job.bytesLeft = job.content->size();
+  } else {
+    job.file.open(handle);
+    job.bytesLeft = handle->size();
+  }
+  return true;
+}
+
+// The next chunkSize bytes of the job's file, fewer if the file shrank.
+zmq::message_t Node::readChunk(SendJob& job, std::size_t chunkSize) {
+  if (job.content) {
+    std::size_t n =
+        std::min(chunkSize, job.content->size() - job.contentPos);
+    if (n == 0) return zmq::message_t();
+    // sent from the cache without a copy
+    zmq::message_t msg = sharedMessage(job.content, job.contentPos, n);
+    job.contentPos += n;
+    return msg;
+  }
+  // read straight into the message so zmq sends it without a copy,
+  // over inproc the receiver gets this very buffer
+  zmq::message_t msg(chunkSize);
+  std::size_t bytes_read =
+      job.file.read(static_cast<char*>(msg.data()), chunkSize);
+  if (bytes_read != chunkSize) msg = zmq::message_t(msg.data(), bytes_read);
+  return msg;
+}
+
+void Node::setBandwidthLimits(const BandwidthLimits& limits) {
+  // a bucket has to hold at least a chunk or a slice never fits
+  std::uint64_t burst = std::max<std::uint64_t>(
+      limits.burstBytes > 0 ? limits.burstBytes : SEND_SLICE_SIZE, CHUNK_SIZE);
+  nodeBucket_ = TokenBucket(limits.nodeBytesPerSec, burst);
+  backgroundBucket_ = TokenBucket(limits.backgroundBytesPerSec, burst);
+  peerBytesPerSec_ = limits.peerBytesPerSec;
+  bucketBurst_ = burst;
+  peerBuckets_.clear();
+}
+
+// The node's bucket and the requester's are shared by every transfer,
+// background ones also draw on backgroundBucket_. A slice is cut down to
+// what all of them allow, in whole chunks.
+bool Node::sliceBudget(const SendJob& job, std::uintmax_t& bytes,
+                       std::int64_t& waitMs) {
+  std::vector<TokenBucket*> buckets = {&nodeBucket_};
+  if (job.background) buckets.push_back(&backgroundBucket_);
+  if (peerBytesPerSec_ > 0) {
+    auto it = peerBuckets_.find(job.identity);
+    if (it == peerBuckets_.end()) {
+      it = peerBuckets_
+               .emplace(job.identity,
+                        TokenBucket(peerBytesPerSec_, bucketBurst_))
+               .first;
+    }
+    buckets.push_back(&it->second);
+  }
+
+  bytes = std::min<std::uintmax_t>(job.bytesLeft, SEND_SLICE_SIZE);
+  std::uintmax_t smallest = std::min<std::uintmax_t>(bytes, CHUNK_SIZE);
+  waitMs = 0;
+  std::uintmax_t allowed = bytes;
+  for (TokenBucket* bucket : buckets) {
+    allowed = std::min<std::uintmax_t>(allowed, bucket->available());
+    waitMs = std::max(waitMs, bucket->waitMs(smallest));
+  }
+  if (allowed < smallest) return false;
+  if (allowed < bytes) allowed -= allowed % CHUNK_SIZE;
+  bytes = allowed;
+  return true;
+}
+
+std::unique_ptr<Node::SendJob> Node::newSendJob(
+    const std::string& identity, const std::string& requestIdStr,
+    const std::string& operation, const std::string& detail, bool background) {
+  auto job = std::make_unique<SendJob>();
+  job->identity = identity;
+  job->requestIdStr = requestIdStr;
+  job->background = background;
+  prunePeerBuckets();
+  job->start = std::chrono::steady_clock::now();
+  job->span = std::make_unique<RequestTrace::Scope>(
+      tracePid_, "server " + operation, parseRequestId(requestIdStr), detail,
+      RequestTrace::Flow::IN);
+  return job;
+}
+
+void Node::runSendJob(std::unique_ptr<SendJob> job, bool found) {
+  if (!found) {
+    const std::string& identity = job->identity;
+    const std::string& requestIdStr = job->requestIdStr;
+    // the usual not found reply as the only slice, or the whole reply
+    std::string flag = SLICE_LAST, reply = "FILE WAS NOT FOUND.";
+    zmq::message_t identityMsg(identity.c_str(), identity.length()),
+        idMsg(requestIdStr.c_str(), requestIdStr.length()),
+        flagMsg(flag.c_str(), flag.length()),
+        msg(reply.c_str(), reply.length());
+    auto res = serverSocket_.send(identityMsg, zmq::send_flags::sndmore);
+    if (!requestIdStr.empty()) {
+      res = serverSocket_.send(idMsg, zmq::send_flags::sndmore);
+    }
+    if (!job->legacy) {
+      res = serverSocket_.send(flagMsg, zmq::send_flags::sndmore);
+    }
+    res = serverSocket_.send(msg, zmq::send_flags::none);
+    metrics_.recordLatency(NodeMetrics::Phase::REQUEST,
+                           std::chrono::steady_clock::now() - job->start);
+    return;
+  }
+  if (!sendSlice(*job)) sendJobs_.push_back(std::move(job));
+}
+
+void Node::startSendJob(const std::string& identity,
+                        const std::string& requestIdStr,
+                        const std::string& fileName, bool background,
+                        bool legacy) {
+  auto job = newSendJob(identity, requestIdStr, "SEND", fileName, background);
+  job->legacy = legacy;
+  bool found = openForSend(fileName, *job);
+  runSendJob(std::move(job), found);
+}
+
+// Stripe index of fileName comes from the stripe a peer keeps for us, or
+// from our own file or copy when we hold the whole of it.
+void Node::startStripeJob(const std::string& identity,
+                          const std::string& requestIdStr,
+                          const std::string& fileName, std::uint64_t index,
+                          std::uint64_t stripeSize, bool background) {
+  auto job = newSendJob(identity, requestIdStr, "STRIPE",
+                        fmt::format("{} #{}", fileName, index), background);
+  std::shared_ptr<const std::string> content;
+  std::shared_ptr<FileHandle> handle =
+      servingCache_.lookup(rootDir_ / stripeName(fileName, index), content);
+  bool found = false;
+  if (handle) {
+    found = job->file.open(handle);
+  } else if (stripeSize > 0 && index < UINT64_MAX / stripeSize) {
+    handle = lookupServed(fileName, content);
+    found = handle && index * stripeSize < handle->size() &&
+            job->file.open(handle, index * stripeSize, stripeSize);
+  }
+  job->bytesLeft = job->file.size();
+  runSendJob(std::move(job), found);
+}
+
+void Node::startPackJob(const std::string& identity,
+                        const std::string& requestIdStr,
+                        const std::vector<std::string>& fileNames,
+                        bool background) {
+  auto job = newSendJob(identity, requestIdStr, "PACK",
+                        fmt::format("{} files", fileNames.size()), background);
+  job->packed = true;
+
+  auto packed = std::make_shared<std::string>();
+  for (const auto& fileName : fileNames) {
+    // the first file always fits, so every PACK makes progress
+    if (packed->size() >= PACK_MAX_BYTES) {
+      PackedFiles::append(*packed, fileName, PackedFiles::Status::DEFERRED);
+      continue;
+    }
+    std::shared_ptr<const std::string> content;
+    std::shared_ptr<FileHandle> handle = lookupServed(fileName, content);
+    if (handle && handle->size() > PACK_FILE_SIZE) {
+      PackedFiles::append(*packed, fileName, PackedFiles::Status::TOO_LARGE);
+      continue;
+    }
+    SendJob file;
+    if (!handle || !openForSend(fileName, file)) {
+      PackedFiles::append(*packed, fileName, PackedFiles::Status::MISSING);
+      continue;
+    }
+    zmq::message_t data = readChunk(file, file.bytesLeft);
+    PackedFiles::append(*packed, fileName, PackedFiles::Status::FOUND,
+                        static_cast<const char*>(data.data()), data.size());
+  }
+  job->diskTime = std::chrono::steady_clock::now() - job->start;
+  job->bytesLeft = packed->size();
+  job->content = std::move(packed);
+  runSendJob(std::move(job), true);
+}
+
+void Node::prunePeerBuckets() {
+  if (peerBuckets_.size() <= MAX_PEER_BUCKETS) return;
+  for (auto it = peerBuckets_.begin(); it != peerBuckets_.end();) {
+    it = it->second.full() ? peerBuckets_.erase(it) : std::next(it);
+  }
+}
+
+// Sends up to SEND_SLICE_SIZE bytes of the file as one complete reply, so
+// other replies can go out before the next slice. Sends nothing while the
+// bandwidth budget is used up. Returns true once the last slice was sent.
+// A legacy job only reads its slice, as a reply's frames can not be split
+// by other replies, and sends all of them after the last.
+bool Node::sendSlice(SendJob& job) {
+  std::uintmax_t budget;
+  std::int64_t waitMs;
+  if (!sliceBudget(job, budget, waitMs)) return false;
+  for (TokenBucket* bucket : {&nodeBucket_, &backgroundBucket_}) {
+    if (bucket == &backgroundBucket_ && !job.background) continue;
+    bucket->take(budget);
+  }
+  auto peerBucket = peerBuckets_.find(job.identity);
+  if (peerBucket != peerBuckets_.end()) peerBucket->second.take(budget);
+
+  zmq::message_t identityMsg(job.identity.c_str(), job.identity.length()),
+      idMsg(job.requestIdStr.c_str(), job.requestIdStr.length());
+  zmq::send_result_t res;
+  // a file that shrinks mid-send ends with an empty last slice
+  bool last = job.bytesLeft <= budget;
+  if (!job.legacy) {
+    res = serverSocket_.send(identityMsg, zmq::send_flags::sndmore);
+    res = serverSocket_.send(idMsg, zmq::send_flags::sndmore);
+    std::string flag = last ? SLICE_LAST : SLICE_MORE;
+    zmq::message_t flagMsg(flag.c_str(), flag.length());
+    res = serverSocket_.send(flagMsg, zmq::send_flags::sndmore);
+  }
+
+  std::uintmax_t sliceLeft = budget;
+  do {
+    std::size_t chunkSize =
+        std::min<std::uintmax_t>(job.packed ? budget : CHUNK_SIZE, sliceLeft);
+    auto readStart = std::chrono::steady_clock::now();
+    zmq::message_t msg = readChunk(job, chunkSize);
+    std::size_t bytes_read = msg.size();
+    auto sendStart = std::chrono::steady_clock::now();
+    job.diskTime += sendStart - readStart;
+    sliceLeft -= chunkSize;
+    job.bytesLeft -= chunkSize;
+    if (bytes_read != chunkSize) {
+      sliceLeft = 0;
+      job.bytesLeft = 0;
+    }
+    metrics_.addBytesOut(bytes_read);
+    if (job.legacy) {
+      job.frames.push_back(std::move(msg));
+      continue;
+    }
+    res = serverSocket_.send(msg, sliceLeft > 0 ? zmq::send_flags::sndmore
+                                                : zmq::send_flags::none);
+    job.sendTime += std::chrono::steady_clock::now() - sendStart;
+  } while (sliceLeft > 0);
+  job.slices++;
+  // a legacy reply has no empty last slice to end it
+  if (job.legacy) last = job.bytesLeft == 0;
+  if (!last) return false;
+
+  if (job.legacy) {
+    // [identity, (request id,) chunks...], the chunks go out without a copy
+    auto sendStart = std::chrono::steady_clock::now();
+    res = serverSocket_.send(identityMsg, zmq::send_flags::sndmore);
+    if (!job.requestIdStr.empty()) {
+      res = serverSocket_.send(idMsg, zmq::send_flags::sndmore);
+    }
+    for (std::size_t i = 0; i < job.frames.size(); i++) {
+      res = serverSocket_.send(job.frames[i], i + 1 < job.frames.size()
+                                                  ? zmq::send_flags::sndmore
+                                                  : zmq::send_flags::none);
+    }
+    job.frames.clear();
+    job.sendTime += std::chrono::steady_clock::now() - sendStart;
+  }
+
+  metrics_.recordLatency(NodeMetrics::Phase::DISK_READ, job.diskTime);
+  metrics_.recordLatency(NodeMetrics::Phase::SEND, job.sendTime);
+  metrics_.recordLatency(NodeMetrics::Phase::REQUEST,
+                         std::chrono::steady_clock::now() - job.start);
+  job.span->setDetail(fmt::format(
+      "slices={} disk_us={} send_us={}", job.slices,
+      std::chrono::duration_cast<std::chrono::microseconds>(job.diskTime)
+          .count(),
+      std::chrono::duration_cast<std::chrono::microseconds>(job.sendTime)
+          .count()));
+  return true;
+}
+
+void Node::runHeartbeat(std::atomic<bool>& running) {
+  // separate sockets so pings never queue behind a transfer
+  struct Probe {
+    std::unique_ptr<zmq::socket_t> socket;
+    std::string requestIdStr;  // empty when nothing is outstanding
+    std::string operationStr;  // PING, or FILTER after the version changed
+    bool wantFilter = false;
+    std::int64_t sentMs = 0;
+    std::chrono::steady_clock::time_point sentAt;  // for the peer's RTT
+    std::int64_t nextSendMs = 0;
+  };
+  std::vector<Probe> probes(clientSockets_.size());
+  for (std::size_t i = 0; i < probes.size(); i++) {
+    probes[i].socket =
+        std::make_unique<zmq::socket_t>(*context_, zmq::socket_type::dealer);
+    probes[i].socket->set(zmq::sockopt::linger, 0);
+    probes[i].socket->connect(clientSockets_[i]->getEndpoint());
+  }
+
+  while (running.load()) {
+    std::int64_t now = steadyNowMs();
+    for (std::size_t i = 0; i < probes.size(); i++) {
+      Probe& probe = probes[i];
+      SocketWrapper& peer = *clientSockets_[i];
+      if (!probe.requestIdStr.empty() &&
+          now - probe.sentMs > HEARTBEAT_TIMEOUT_MS) {
+        peer.markFailure();
+        probe.requestIdStr.clear();
+      }
+      if (probe.requestIdStr.empty() && now >= probe.nextSendMs) {
+        // a dead peer is only probed when its breaker allows it
+        probe.nextSendMs = now + HEARTBEAT_INTERVAL_MS;
+        if (peer.getState() == PeerState::DEAD && !peer.allowRequest()) {
+          continue;
+        }
+        probe.requestIdStr = formatRequestId(nextRequestId_++);
+        probe.operationStr = probe.wantFilter ? "FILTER" : "PING";
+        probe.wantFilter = false;
+        std::string operationStr = probe.operationStr, fileName = "";
+        zmq::message_t operationMessage(operationStr.c_str(),
+                                        operationStr.length()),
+            fileNameMessage(fileName.c_str(), fileName.length()),
+            requestIdMessage(probe.requestIdStr.c_str(),
+                             probe.requestIdStr.length());
+        auto res = probe.socket->send(
+            operationMessage,
+            zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+        if (!res) {  // nothing connected and the queue is full
+          peer.markFailure();
+          probe.requestIdStr.clear();
+          continue;
+        }
+        res = probe.socket->send(fileNameMessage, zmq::send_flags::sndmore);
+        res = probe.socket->send(requestIdMessage, zmq::send_flags::none);
+        probe.sentMs = now;
+        probe.sentAt = std::chrono::steady_clock::now();
+      }
+    }
+
+    std::vector<zmq_pollitem_t> items;
+    for (auto& probe : probes) {
+      items.push_back({*probe.socket, 0, ZMQ_POLLIN, 0});
+    }
+    if (zmq_poll(items.data(), items.size(), 100) <= 0) continue;
+
+    for (std::size_t i = 0; i < probes.size(); i++) {
+      if (!(items[i].revents & ZMQ_POLLIN)) continue;
+      std::vector<zmq::message_t> recv_msgs;
+      while (zmq::recv_multipart(*probes[i].socket,
+                                 std::back_inserter(recv_msgs),
+                                 zmq::recv_flags::dontwait)) {
+        // pongs for pings that already timed out are ignored
+        if (!recv_msgs.empty() &&
+            recv_msgs[0].to_string() == probes[i].requestIdStr) {
+          SocketWrapper& peer = *clientSockets_[i];
+          peer.markAlive();
+          probes[i].requestIdStr.clear();
+          if (probes[i].operationStr == "PING") {
+            peer.recordReply(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - probes[i].sentAt)
+                    .count(),
+                0);
+          }
+          if (probes[i].operationStr == "PING" && recv_msgs.size() > 2) {
+            // fetch the filter right away if it changed
+            std::uint64_t version =
+                std::strtoull(recv_msgs[2].to_string().c_str(), nullptr, 10);
+            if (!peer.hasFilter(version)) {
+              probes[i].wantFilter = true;
+              probes[i].nextSendMs = 0;
+            }
+            if (recv_msgs.size() > 3) {
+              peer.setPeerName(recv_msgs[3].to_string());
+            }
+          } else if (probes[i].operationStr == "FILTER" &&
+                     recv_msgs.size() > 3) {
+            BloomFilter filter;
+            if (BloomFilter::fromBits(recv_msgs[3].to_string(),
+                                      std::atoi(recv_msgs[2].to_string().c_str()),
+                                      filter)) {
+              peer.setFilter(std::strtoull(recv_msgs[1].to_string().c_str(),
+                                           nullptr, 10),
+                             std::move(filter));
+            }
+          }
+        }
+        recv_msgs.clear();
+      }
+    }
+  }
+}
 
-    auto ret =
-        zmq::recv_multipart(serverSocket_, std::back_inserter(recv_msgs));
-    if (!ret) {
-      // std::cout << "Error accepting message (Handler)" << std::endl;
+// will send three messages: operation, file name and request id
+void Node::sendRequest(FileOperation operation, const std::string& fileName) {
+  // one copy is enough, from whichever replica answers first
+  if (operation == FileOperation::SEND) {
+    fetchHedged(fileName);
+    return;
+  }
+  for (const auto& wrapper : clientSockets_) {
+    // skip peers whose breaker is open instead of waiting out TIMEOUT_MS
+    if (!wrapper->allowRequest()) continue;
+
+    if (operation == FileOperation::LIST) {
+      // todo check for collisions
+      listPeerFiles(*wrapper, "", [this](const auto& page) {
+        std::lock_guard<std::mutex> lock(otherMutex_);
+        otherFileMData.insert(page.begin(), page.end());
+      });
       continue;
     }
-    // std::cout << "Got " << *ret << " messages" << std::endl;
+
+    std::string operationStr = operationToString(operation);
+
+    const std::uint64_t requestId = nextRequestId_++;
+    const std::string requestIdStr = formatRequestId(requestId);
+    RequestTrace::Scope clientSpan(tracePid_, "client " + operationStr,
+                                   requestId, wrapper->getIp() + " " + fileName,
+                                   RequestTrace::Flow::OUT);
+
+    // std::cout << "Sending " << operationStr << " " << fileName << std::endl;
+
+    wrapper->issue(requestIdStr, operationStr, fileName);
+    metrics_.addBytesOut(operationStr.length() + fileName.length());
+
+    // get reply, anything left over from an earlier timeout is dropped
+    std::vector<zmq::message_t> recv_msgs;
+    bool replied;
+    {
+      RequestTrace::Scope waitSpan(tracePid_, "wait for reply", requestId);
+      replied = wrapper->awaitReply(requestIdStr, TIMEOUT_MS, recv_msgs);
+    }
+    if (!replied) {
+      // Timeout reached, no response from server
+      std::cerr << "Timeout waiting for" << wrapper->getIp()
+                << "'s response. Proceeding." << std::endl;
+      wrapper->addTimeout();
+      wrapper->markFailure();
+      continue;
+    }
+    wrapper->markAlive();
+    if (recv_msgs.empty()) continue;
 
     std::vector<std::string> messagesStr;
 
     for (zmq::message_t& msg : recv_msgs) {
       messagesStr.push_back(msg.to_string());
+      metrics_.addBytesIn(msg.size());
     }
 
     // for (std::string messageString : messagesStr) {
-    //   std::cout << " Recieved (Handler): " << messageString << std::endl;
+    //   std::cout << " Recieved (Sender): " << messageString << std::endl;
     // }
+    if (operationStr == "TRACE") {
+      if (!messagesStr[0].empty()) {
+        collectedTraceEvents_ += ",\n" + messagesStr[0];
+      }
+    }
+    if (operationStr == "STATS") {
+      std::cout << "Stats from " << wrapper->getIp() << ":\n"
+                << messagesStr[0] << std::endl;
+    }
+    //   if (operationStr == "DELETE") {
+    //   }
+    if (operationStr == "UPDATED") {
+      // convert string to json then json to map
+      std::string received_data(static_cast<char*>(recv_msgs[0].data()),
+                                recv_msgs[0].size());
+      RequestTrace::Scope parseSpan(tracePid_, "parse json", requestId);
+      std::map<std::string, NodeFileSystem::fileMetadata> fileMdata =
+          NodeFileSystem::metadataFromJsonString(received_data);
+      // insert into other map
+      std::lock_guard<std::mutex> lock(otherMutex_);
+      for (auto entry : fileMdata) {
+        otherFileMData[entry.first] = entry.second;
+      }
+    }
+  }
+}
 
-    // return flag
-    zmq::message_t replyMsg(recv_msgs[0].data(), recv_msgs[0].size());
-    auto res = serverSocket_.send(replyMsg, zmq::send_flags::sndmore);
-
-    // // set reply message
-    if (messagesStr[1] == "SEND") {
-      std::string filename = messagesStr[2];
-      if (std::filesystem::exists(rootDir_ / filename)) {
-        std::ifstream file(rootDir_ / filename, std::ios::binary);
-        // std::cout << "opening " << filename << std::endl;
-        if (!file.is_open()) {
-          std::cerr << "Error opening file: " << filename << std::endl;
-          // todo error handling
-        }
-        char buffer[CHUNK_SIZE];
-
-        while (true) {
-          file.read(buffer, CHUNK_SIZE);
-          std::streamsize bytes_read = file.gcount();
-          if (!file.eof()) {
-            // Send chunk (not the last one)
-            // std::cout << "Sending Bytes: " << bytes_read << std::endl;
-            zmq::message_t msg(buffer, bytes_read);
-            auto res = serverSocket_.send(msg, zmq::send_flags::sndmore);
-          } else {
-            // Last chunk - send without ZMQ_SNDMORE flag
-            // std::cout << "Sending Last Byte: " << bytes_read << std::endl;
-            zmq::message_t msg(buffer, bytes_read);
-            auto res = serverSocket_.send(msg, zmq::send_flags::none);
-            break;
-          }
-        }
-        file.close();
-        // std::cout << "Done sending: " << filename << std::endl;
-      } else {  // if file was not found
-        zmq_msg_t replyMsg;
-        std::string endFileStr = "FILE WAS NOT FOUND.";
-
-        zmq::message_t msg(endFileStr.c_str(), endFileStr.length());
-        auto res = serverSocket_.send(msg, zmq::send_flags::none);
+// A read goes to the replica expected to answer first. If it has not
+// answered by about its 95th percentile reply time the next best replica
+// is asked too, and the loser is cancelled, so one straggling peer does
+// not set the read's latency. Returns true once a copy was written.
+bool Node::fetchHedged(const std::string& fileName) {
+  std::uintmax_t size = 0;  // unknown until a LIST told us
+  {
+    std::lock_guard<std::mutex> lock(otherMutex_);
+    auto it = otherFileMData.find(fileName);
+    if (it != otherFileMData.end()) size = it->second.fileSize;
+  }
+  // Fastest first and dead peers last. Peers not timed yet expect 0 and
+  // come first so they get measured, ties are in random order so readers
+  // spread over equal replicas.
+  std::vector<std::pair<std::pair<bool, std::int64_t>, SocketWrapper*>> ranked;
+  for (const auto& wrapper : clientSockets_) {
+    // the peer's filter says it does not have the file
+    if (!wrapper->mightHave(fileName)) {
+      metrics_.countFilterSkip();
+      continue;
+    }
+    ranked.push_back({{wrapper->getState() == PeerState::DEAD,
+                       wrapper->expectedUs(size)},
+                      wrapper.get()});
+  }
+  std::shuffle(ranked.begin(), ranked.end(), threadRng());
+  std::stable_sort(
+      ranked.begin(), ranked.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  struct Attempt {
+    SocketWrapper* wrapper;
+    std::uint64_t requestId;
+    std::string requestIdStr;
+    bool hedge;
+    std::int64_t sentMs;
+    std::chrono::steady_clock::time_point start;
+    std::unique_ptr<RequestTrace::Scope> span;
+  };
+  std::vector<Attempt> active;
+  std::size_t next = 0;
+  auto launch = [&](bool hedge) {
+    while (next < ranked.size()) {
+      SocketWrapper* wrapper = ranked[next++].second;
+      // skip peers whose breaker is open instead of waiting out TIMEOUT_MS
+      if (!wrapper->allowRequest()) continue;
+      Attempt attempt{wrapper, nextRequestId_++, "", hedge, steadyNowMs(),
+                      std::chrono::steady_clock::now(), nullptr};
+      attempt.requestIdStr = formatRequestId(attempt.requestId);
+      attempt.span = std::make_unique<RequestTrace::Scope>(
+          tracePid_, hedge ? "client SEND hedge" : "client SEND",
+          attempt.requestId, wrapper->getIp() + " " + fileName,
+          RequestTrace::Flow::OUT);
+      // files come back in slices so the peer can answer others in between
+      wrapper->issue(attempt.requestIdStr, "SEND", fileName, {SEND_STREAM_ARG},
+                     true);
+      metrics_.addBytesOut(4 + fileName.length());
+      active.push_back(std::move(attempt));
+      return true;
+    }
+    return false;
+  };
+
+  const bool mayHedge = size <= HEDGE_MAX_SIZE;
+  bool hedged = false;
+  std::int64_t hedgeAtMs = 0;
+  auto launchFirst = [&]() {
+    if (!launch(false)) return false;
+    hedged = false;
+    hedgeAtMs = steadyNowMs() + active.back().wrapper->hedgeDelayMs(size);
+    return true;
+  };
+  if (!launchFirst()) return false;
+
+  std::size_t turn = 0;
+  while (!active.empty()) {
+    std::int64_t now = steadyNowMs();
+    // a peer that sent nothing for TIMEOUT_MS has failed this read
+    for (auto it = active.begin(); it != active.end();) {
+      if (now - std::max(it->sentMs,
+                         it->wrapper->getLastReceiveMs(it->requestIdStr)) <
+          TIMEOUT_MS) {
+        ++it;
+        continue;
       }
+      std::cerr << "Timeout waiting for" << it->wrapper->getIp()
+                << "'s response. Proceeding." << std::endl;
+      it->wrapper->cancel(it->requestIdStr);
+      it->wrapper->addTimeout();
+      it->wrapper->markFailure();
+      it = active.erase(it);
+    }
+    if (active.empty()) {
+      if (!launchFirst()) break;
+      continue;
+    }
+    if (mayHedge && !hedged && now >= hedgeAtMs) {
+      hedged = true;
+      launch(true);
     }
-    if (messagesStr[1] ==
-        "DELETE") {  // will not be used (permissions not implemented)
-      std::string reply;
 
-      std::string deletedFile = fileSystem_.deleteFile(messagesStr[2]);
-      if (deletedFile != "-1") {
-        reply = "Deleted file: " + deletedFile;
-      } else {
-        reply = "Failed to delete file: " + messagesStr[2];
+    // alone a request waits for its hedge point, two take turns
+    std::size_t index = turn++ % active.size();
+    Attempt& attempt = active[index];
+    std::int64_t untilMs =
+        std::max(attempt.sentMs,
+                 attempt.wrapper->getLastReceiveMs(attempt.requestIdStr)) +
+        TIMEOUT_MS;
+    if (active.size() > 1) {
+      untilMs = now + HEDGE_POLL_MS;
+    } else if (mayHedge && !hedged) {
+      untilMs = std::min(untilMs, hedgeAtMs);
+    }
+    std::vector<zmq::message_t> recv_msgs;
+    if (!attempt.wrapper->awaitUntil(attempt.requestIdStr, untilMs,
+                                     recv_msgs)) {
+      continue;
+    }
+    attempt.wrapper->markAlive();
+    std::uint64_t bytes = 0;
+    for (const auto& msg : recv_msgs) bytes += msg.size();
+    metrics_.addBytesIn(bytes);
+    attempt.wrapper->recordReply(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - attempt.start)
+            .count(),
+        bytes);
+
+    std::vector<PendingWrite> writes;
+    if (saveReceivedFile(fileName, *attempt.wrapper, recv_msgs,
+                         attempt.requestId, writes) &&
+        commitWrites(writes)) {
+      if (hedged) metrics_.countHedge(attempt.hedge);
+      for (const Attempt& loser : active) {
+        if (&loser != &attempt) {
+          cancelRequest(*loser.wrapper, loser.requestIdStr);
+          loser.span->setDetail("cancelled");
+        }
       }
+      return true;
+    }
+    // not found there, the next replica is asked
+    active.erase(active.begin() + index);
+    if (active.empty() && !launchFirst()) break;
+  }
+  return false;
+}
 
-      zmq::message_t msg(reply.c_str(), reply.length());
+// Forgets a request and tells the peer, which stops streaming it if it
+// still is. A CANCEL gets no reply.
+void Node::cancelRequest(SocketWrapper& wrapper,
+                         const std::string& requestIdStr) {
+  wrapper.cancel(requestIdStr);
+  std::string cancelIdStr = formatRequestId(nextRequestId_++);
+  wrapper.issue(cancelIdStr, "CANCEL", "", {requestIdStr});
+  wrapper.cancel(cancelIdStr);
+  metrics_.addBytesOut(6 + requestIdStr.length());
+}
 
-      // std::cout << "Sending " << msg.to_string() << std::endl;
+// Each page is requested as soon as the previous one arrives, before parsing
+// it, so the peer serializes the next page while this one is parsed. A peer
+// without paging replies with everything in one page and no cursor.
+bool Node::listPeerFiles(
+    SocketWrapper& wrapper, const std::string& prefix,
+    const std::function<void(
+        const std::map<std::string, NodeFileSystem::fileMetadata>&)>& onPage) {
+  const std::string pageSizeStr = std::to_string(LIST_PAGE_SIZE);
+  auto issuePage = [&](const std::string& cursor) {
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    wrapper.issue(requestIdStr, "LIST", "", {prefix, cursor, pageSizeStr});
+    metrics_.addBytesOut(4 + prefix.length() + cursor.length() +
+                         pageSizeStr.length());
+    return requestIdStr;
+  };
+
+  std::string requestIdStr = issuePage("");
+  while (true) {
+    std::vector<zmq::message_t> recv_msgs;
+    bool replied;
+    {
+      RequestTrace::Scope clientSpan(tracePid_, "client LIST",
+                                     parseRequestId(requestIdStr),
+                                     wrapper.getIp() + " " + prefix,
+                                     RequestTrace::Flow::OUT);
+      replied = wrapper.awaitReply(requestIdStr, TIMEOUT_MS, recv_msgs);
+    }
+    if (!replied) {
+      std::cerr << "Timeout waiting for" << wrapper.getIp()
+                << "'s response. Proceeding." << std::endl;
+      wrapper.addTimeout();
+      wrapper.markFailure();
+      return false;
+    }
+    wrapper.markAlive();
+    if (recv_msgs.empty()) return true;
+    for (const auto& msg : recv_msgs) metrics_.addBytesIn(msg.size());
+
+    std::string nextCursor =
+        recv_msgs.size() > 1 ? recv_msgs[1].to_string() : "";
+    std::string pageIdStr = requestIdStr;
+    if (!nextCursor.empty()) requestIdStr = issuePage(nextCursor);
+
+    {
+      RequestTrace::Scope parseSpan(tracePid_, "parse json",
+                                    parseRequestId(pageIdStr));
+      std::string received_data(static_cast<char*>(recv_msgs[0].data()),
+                                recv_msgs[0].size());
+      onPage(NodeFileSystem::metadataFromJsonString(received_data));
+    }
+    if (nextCursor.empty()) return true;
+  }
+}
 
-      auto res = serverSocket_.send(msg, zmq::send_flags::none);
+// Updates "copyof" + fileName from the first peer that has fileName. We send
+// block signatures of our copy and the peer replies with a delta, so only
+// the changed blocks cross the network. The copy is read block by block and
+// the rebuilt file is written straight into a staged temporary, so neither
+// is held in memory. Returns false if no peer could produce a delta, the
+// caller then falls back to SEND.
+bool Node::syncFile(const std::string& fileName) {
+  const std::string copyName = "copyof" + fileName;
+  std::shared_ptr<FileHandle> basis = FileHandle::open(rootDir_ / copyName);
+  // peers refuse deltas of files this large anyway
+  if (!basis || basis->size() > MAX_DELTA_SIZE) return false;
+  const std::size_t blockSize = DeltaSync::chooseBlockSize(basis->size());
+  const std::string blockSizeStr = std::to_string(blockSize);
+  std::vector<DeltaSync::BlockSignature> signatures;
+  {
+    FileReader reader;
+    std::vector<char> block(blockSize);
+    if (!reader.open(basis)) return false;
+    // a short read is the tail, which has no signature
+    while (reader.read(block.data(), block.size()) == block.size()) {
+      signatures.push_back(DeltaSync::signature(block.data(), block.size()));
+    }
+  }
+  const std::string signatureStr = DeltaSync::encodeSignatures(signatures);
+
+  for (const auto& wrapper : clientSockets_) {
+    if (!wrapper->allowRequest()) continue;
+    if (!wrapper->mightHave(fileName)) {
+      metrics_.countFilterSkip();
+      continue;
     }
-    if (messagesStr[1] == "LIST") {
-      Json::Value jsonMap(Json::objectValue);
-      for (const auto& [filename, metadata] : myFileMdata) {
-        Json::Value metadataJson(Json::objectValue);
-        metadataJson["fileSize"] = metadata.fileSize;
-        metadataJson["lastModified"] = metadata.lastModified;
-        metadataJson["storedIpAddress"] = metadata.storedIpAddress;
 
-        jsonMap[filename] = metadataJson;
+    const std::uint64_t requestId = nextRequestId_++;
+    const std::string requestIdStr = formatRequestId(requestId);
+    std::vector<zmq::message_t> recv_msgs;
+    bool replied;
+    {
+      RequestTrace::Scope clientSpan(tracePid_, "client DELTA", requestId,
+                                     wrapper->getIp() + " " + fileName,
+                                     RequestTrace::Flow::OUT);
+      wrapper->issue(requestIdStr, "DELTA", fileName,
+                     {blockSizeStr, signatureStr});
+      metrics_.addBytesOut(5 + fileName.length() + blockSizeStr.length() +
+                           signatureStr.length());
+      replied = wrapper->awaitReply(requestIdStr, TIMEOUT_MS, recv_msgs);
+    }
+    if (!replied) {
+      std::cerr << "Timeout waiting for" << wrapper->getIp()
+                << "'s response. Proceeding." << std::endl;
+      wrapper->addTimeout();
+      wrapper->markFailure();
+      continue;
+    }
+    wrapper->markAlive();
+    for (const auto& msg : recv_msgs) metrics_.addBytesIn(msg.size());
+    // not found, or a peer without DELTA
+    if (recv_msgs.size() != 3) continue;
+
+    std::uint64_t ticket = fileSystem_.createWrite(copyName);
+    if (ticket == 0) {
+      std::cerr << "Failed to open file for writing.\n";
+      return false;
+    }
+    std::uint64_t written = 0;
+    DeltaSync::StrongHasher hasher;
+    auto append = [&](const char* data, std::size_t length) {
+      hasher.update(data, length);
+      bool appended = fileSystem_.writeAt(ticket, data, length, written);
+      written += length;
+      return appended;
+    };
+    // COPY ops are read from the old copy with pread, not kept in memory
+    auto copyBlocks = [&](std::uint64_t offset, std::uint64_t length) {
+      FileReader reader;
+      if (!reader.open(basis, offset, length)) return false;
+      while (length > 0) {
+        std::string_view block = reader.readView();
+        if (block.empty() || !append(block.data(), block.size())) return false;
+        length -= std::min<std::uint64_t>(block.size(), length);
       }
-      // serialize JSON to string
-      Json::StreamWriterBuilder builder;
-      std::string jsonString = Json::writeString(builder, jsonMap);
+      return true;
+    };
+    bool applied;
+    {
+      RequestTrace::Scope applySpan(tracePid_, "apply delta", requestId);
+      std::string_view delta(static_cast<const char*>(recv_msgs[2].data()),
+                             recv_msgs[2].size());
+      applied = DeltaSync::applyDelta(basis->size(), blockSize, delta,
+                                      copyBlocks, append) &&
+          basis->current() &&
+          hashToString(hasher.digest()) == recv_msgs[1].to_string();
+    }
+    if (!applied) {
+      fileSystem_.discardWrite(ticket);
+      std::cerr << "Delta of " << fileName << " from " << wrapper->getIp()
+                << " did not match, ignoring it." << std::endl;
+      continue;
+    }
 
-      // send jsonstring
-      zmq::message_t msg(jsonString.c_str(), jsonString.length());
+    // replaces the old copy only once the new one is durable
+    if (!fileSystem_.waitWrite(fileSystem_.stageCreated(ticket))) {
+      std::cerr << "Failed to open file for writing.\n";
+      return false;
+    }
 
-      // std::cout << "Sending " << msg.to_string() << std::endl;
+    std::cout << fileName << " updated, " << recv_msgs[2].size() << " of "
+              << written << " bytes transferred." << std::endl;
+    NodeFileSystem::fileMetadata tempMd = fileSystem_.getFileMetaData(copyName);
+    tempMd.storedIpAddress = wrapper->getIp();
+    myFileMdata.update([&](auto& files) { files[copyName] = tempMd; });
+    indexFile(copyName);
+    return true;
+  }
+  return false;
+}
 
-      auto res = serverSocket_.send(msg, zmq::send_flags::none);
+// Stages a SEND reply to be written to "copyof" + fileName. Returns false if
+// the peer did not have the file.
+bool Node::saveReceivedFile(const std::string& fileName, SocketWrapper& wrapper,
+                            std::vector<zmq::message_t>& recv_msgs,
+                            std::uint64_t requestId,
+                            std::vector<PendingWrite>& writes) {
+  // If file wasnt found do nothing!
+  if (recv_msgs.empty() || recv_msgs[0].to_string() == "FILE WAS NOT FOUND.") {
+    return false;
+  }
+  RequestTrace::Scope writeSpan(tracePid_, "write file", requestId);
+  // written straight from the messages
+  std::vector<std::string_view> parts;
+  for (zmq::message_t& msg : recv_msgs) {
+    parts.emplace_back(static_cast<const char*>(msg.data()), msg.size());
+  }
+  return stageReceivedFile(fileName, wrapper.getIp(), parts, writes);
+}
+
+bool Node::stageReceivedFile(const std::string& fileName,
+                             const std::string& storedIpAddress,
+                             const std::vector<std::string_view>& parts,
+                             std::vector<PendingWrite>& writes) {
+  std::uintmax_t fileSize = 0;
+  for (std::string_view part : parts) fileSize += part.size();
+  return addPendingWrite(fileSystem_.stageWrite(COPY_PREFIX + fileName, parts),
+                         fileName, storedIpAddress, fileSize, writes);
+}
+
+bool Node::addPendingWrite(std::uint64_t ticket, const std::string& fileName,
+                           const std::string& storedIpAddress,
+                           std::uintmax_t fileSize,
+                           std::vector<PendingWrite>& writes) {
+  if (ticket == 0) {
+    std::cerr << "Failed to open file for writing.\n";
+    return false;
+  }
+  PendingWrite write;
+  write.ticket = ticket;
+  write.fileName = fileName;
+  write.metadata.fileSize = fileSize;
+  // refresh() reads the real time later
+  write.metadata.lastModified =
+      fileTimeToISOString(std::filesystem::file_time_type::clock::now());
+  write.metadata.storedIpAddress = storedIpAddress;
+  writes.push_back(std::move(write));
+  return true;
+}
+
+// Tickets are committed in about the order they were staged, so waiting for
+// them in order blocks about once per batch.
+bool Node::commitWrites(std::vector<PendingWrite>& writes,
+                        std::set<std::string>* received) {
+  bool committed = true;
+  std::vector<const PendingWrite*> durable;
+  for (const auto& write : writes) {
+    if (fileSystem_.waitWrite(write.ticket)) {
+      durable.push_back(&write);
+      continue;
+    }
+    if (received != nullptr) received->erase(write.fileName);
+    committed = false;
+  }
+  // one new snapshot for all of them
+  myFileMdata.update([&](auto& files) {
+    for (const PendingWrite* write : durable) {
+      files[COPY_PREFIX + write->fileName] = write->metadata;
     }
-    if (messagesStr[1] ==
-        "CREATE") {  // will not be used permissions not implemented
-      fileSystem_.createFile(messagesStr[2]);
+  });
+  for (const PendingWrite* write : durable) {
+    indexFile(COPY_PREFIX + write->fileName);
+  }
+  writes.clear();
+  return committed;
+}
 
-      std::string reply = "Created file: " + messagesStr[2];
+void Node::setCommitLimits(std::size_t maxBatch, int maxDelayMs) {
+  fileSystem_.setCommitLimits(maxBatch, maxDelayMs);
+}
 
-      zmq::message_t msg(reply.c_str(), reply.length());
+// Asks each peer for every file still missing, keeping up to MAX_IN_FLIGHT
+// SENDs outstanding on the socket so small files are not paced by the RTT.
+void Node::getFiles(const std::vector<std::string>& fileNames,
+                    bool background) {
+  std::vector<std::string> missing;
+  NodeFileSystem::fileMetadata striped;
+  for (const auto& fileName : fileNames) {
+    if (std::filesystem::exists(rootDir_ / fileName)) {
+      std::cout << fileName << " already exists within node." << std::endl;
+    } else if (std::filesystem::exists(rootDir_ / ("copyof" + fileName)) &&
+               syncFile(fileName)) {
+      // an older copy only needed the changed blocks
+    } else if (stripedMetadata(fileName, striped) &&
+               fetchStriped(fileName, striped)) {
+      // read from every holder at once
+    } else {
+      missing.push_back(fileName);
+    }
+  }
+
+  // start at a random peer so readers spread over the replicas
+  std::size_t first =
+      clientSockets_.empty() ? 0 : threadRng()() % clientSockets_.size();
+  for (std::size_t n = 0; n < clientSockets_.size(); n++) {
+    const auto& wrapper = clientSockets_[(first + n) % clientSockets_.size()];
+    if (missing.empty()) break;
+    if (!wrapper->allowRequest()) continue;
+
+    // only ask for files the peer's filter says it might have
+    std::vector<std::string> candidates;
+    for (const auto& fileName : missing) {
+      if (wrapper->mightHave(fileName)) {
+        candidates.push_back(fileName);
+      } else {
+        metrics_.countFilterSkip();
+      }
+    }
+    if (candidates.empty()) continue;
+
+    // small files come packed, the rest and anything the peer did not pack
+    // one SEND each
+    std::set<std::string> received;
+    std::vector<std::string> bySend;
+    // files are recorded once their group commit made them durable
+    std::vector<PendingWrite> writes;
+    if (!fetchPacked(*wrapper, candidates, background, received, bySend,
+                     writes)) {
+      bySend.clear();
+    }
+    candidates = bySend;
+
+    std::map<std::string, std::string> pending;  // request id -> file name
+    std::set<std::string> pendingIds;
+    std::size_t next = 0;
+    auto issueNext = [&]() {
+      std::string requestIdStr = formatRequestId(nextRequestId_++);
+      std::vector<std::string> args = {SEND_STREAM_ARG};
+      if (background) args.push_back(SEND_BACKGROUND_ARG);
+      wrapper->issue(requestIdStr, "SEND", candidates[next], args, true);
+      metrics_.addBytesOut(4 + candidates[next].length());
+      pending[requestIdStr] = candidates[next];
+      pendingIds.insert(requestIdStr);
+      next++;
+    };
+    while (next < candidates.size() && pending.size() < MAX_IN_FLIGHT) {
+      issueNext();
+    }
 
-      // std::cout << "Sending " << msg.to_string() << std::endl;
+    while (!pending.empty()) {
+      std::string requestIdStr;
+      std::vector<zmq::message_t> recv_msgs;
+      if (!wrapper->awaitAny(pendingIds, TIMEOUT_MS, requestIdStr,
+                             recv_msgs)) {
+        std::cerr << "Timeout waiting for" << wrapper->getIp()
+                  << "'s response. Proceeding." << std::endl;
+        for (const auto& id : pendingIds) wrapper->cancel(id);
+        wrapper->addTimeout();
+        wrapper->markFailure();
+        break;
+      }
+      wrapper->markAlive();
+      for (const auto& msg : recv_msgs) metrics_.addBytesIn(msg.size());
+
+      std::string fileName = pending[requestIdStr];
+      pending.erase(requestIdStr);
+      pendingIds.erase(requestIdStr);
+      if (saveReceivedFile(fileName, *wrapper, recv_msgs,
+                           parseRequestId(requestIdStr), writes)) {
+        received.insert(fileName);
+      }
+      if (next < candidates.size()) issueNext();
+    }
+    commitWrites(writes, &received);
 
-      auto res = serverSocket_.send(msg, zmq::send_flags::none);
+    std::vector<std::string> stillMissing;
+    for (const auto& fileName : missing) {
+      if (!received.count(fileName)) stillMissing.push_back(fileName);
     }
-    if (messagesStr[1] == "UPDATE") {
-      sendRequest(FileOperation::UPDATED);
+    missing = stillMissing;
+  }
+
+  for (const auto& fileName : missing) {
+    std::cerr << fileName
+              << " does not exist on this node or any other online node."
+              << std::endl;
+  }
+  refresh();
+}
+
+// Up to PACK_IN_FLIGHT requests of PACK_MAX_FILES names are outstanding.
+// Files the peer's LIST showed to be too large are not asked for.
+bool Node::fetchPacked(SocketWrapper& wrapper,
+                       const std::vector<std::string>& fileNames,
+                       bool background, std::set<std::string>& received,
+                       std::vector<std::string>& bySend,
+                       std::vector<PendingWrite>& writes) {
+  std::deque<std::string> queue;
+  {
+    std::lock_guard<std::mutex> lock(otherMutex_);
+    for (const auto& fileName : fileNames) {
+      auto it = otherFileMData.find(fileName);
+      if (it != otherFileMData.end() && it->second.fileSize > PACK_FILE_SIZE) {
+        bySend.push_back(fileName);
+      } else {
+        queue.push_back(fileName);
+      }
     }
-    if (messagesStr[1] == "UPDATED") {
-      Json::Value jsonMap(Json::objectValue);
-      for (const auto& [filename, metadata] : myFileMdata) {
-        Json::Value metadataJson(Json::objectValue);
-        metadataJson["fileSize"] = metadata.fileSize;
-        metadataJson["lastModified"] = metadata.lastModified;
-        metadataJson["storedIpAddress"] = metadata.storedIpAddress;
+  }
 
-        jsonMap[filename] = metadataJson;
+  std::map<std::string, std::vector<std::string>> pending;  // id -> names
+  std::set<std::string> pendingIds;
+  auto issueNext = [&]() {
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    std::vector<std::string> args = {background ? SEND_BACKGROUND_ARG : ""};
+    std::vector<std::string>& names = pending[requestIdStr];
+    while (!queue.empty() && names.size() < PACK_MAX_FILES) {
+      names.push_back(std::move(queue.front()));
+      queue.pop_front();
+      args.push_back(names.back());
+      metrics_.addBytesOut(names.back().length());
+    }
+    wrapper.issue(requestIdStr, "PACK", "", args, true);
+    metrics_.addBytesOut(4);
+    pendingIds.insert(requestIdStr);
+  };
+  while (!queue.empty() && pending.size() < PACK_IN_FLIGHT) issueNext();
+
+  while (!pending.empty()) {
+    std::string requestIdStr;
+    std::vector<zmq::message_t> recv_msgs;
+    if (!wrapper.awaitAny(pendingIds, TIMEOUT_MS, requestIdStr, recv_msgs)) {
+      std::cerr << "Timeout waiting for" << wrapper.getIp()
+                << "'s response. Proceeding." << std::endl;
+      for (const auto& id : pendingIds) wrapper.cancel(id);
+      wrapper.addTimeout();
+      wrapper.markFailure();
+      return false;
+    }
+    wrapper.markAlive();
+    std::set<std::string> names(pending[requestIdStr].begin(),
+                                pending[requestIdStr].end());
+    pending.erase(requestIdStr);
+    pendingIds.erase(requestIdStr);
+
+    std::string packed;
+    for (const auto& msg : recv_msgs) {
+      metrics_.addBytesIn(msg.size());
+      packed.append(static_cast<const char*>(msg.data()), msg.size());
+    }
+    // a peer without PACK answers with something else, which leaves every
+    // name to a SEND
+    std::vector<PackedFiles::Entry> entries;
+    PackedFiles::parse(packed, entries);
+
+    RequestTrace::Scope writeSpan(tracePid_, "write packed files",
+                                  parseRequestId(requestIdStr));
+    std::size_t written = 0;
+    for (const auto& entry : entries) {
+      // only what was asked for, a peer cannot name other files
+      if (names.erase(entry.name) == 0) continue;
+      if (entry.status == PackedFiles::Status::DEFERRED) {
+        queue.push_back(entry.name);
+      } else if (entry.status == PackedFiles::Status::TOO_LARGE) {
+        bySend.push_back(entry.name);
+      } else if (entry.status == PackedFiles::Status::FOUND &&
+                 stageReceivedFile(entry.name, wrapper.getIp(),
+                                   {std::string_view(entry.data, entry.size)},
+                                   writes)) {
+        received.insert(entry.name);
+        written++;
       }
-      // serialize JSON to string
-      Json::StreamWriterBuilder builder;
-      std::string jsonString = Json::writeString(builder, jsonMap);
+    }
+    writeSpan.setDetail(fmt::format("{} files", written));
+    bySend.insert(bySend.end(), names.begin(), names.end());
 
-      // send jsonstring
-      zmq::message_t msg(jsonString.c_str(), jsonString.length());
+    while (!queue.empty() && pending.size() < PACK_IN_FLIGHT) issueNext();
+  }
+  return true;
+}
 
-      // std::cout << "Sending " << msg.to_string() << std::endl;
+// Splits each file into STRIPE_SIZE stripes dealt round-robin to us and the
+// reachable peers, so readers can fetch from all of us at once. A file's
+// stripe map is only published once every peer stored its stripes, until
+// then the file is read whole as before.
+void Node::stripeFiles(const std::vector<std::string>& fileNames) {
+  auto files = myFileMdata.load();
+  std::vector<std::string> names = fileNames;
+  if (names.empty()) {
+    for (const auto& [name, metadata] : *files) {
+      if (originalName(name).empty() && metadata.fileSize >= STRIPE_THRESHOLD) {
+        names.push_back(name);
+      }
+    }
+  }
+  // we hold the first stripe of every round, the peers the others. Holders
+  // are recorded by the name each gives itself, which every reader knows
+  // them by too, so peers that have not answered a heartbeat yet are left out.
+  std::vector<std::string> holders = {getNodeName()};
+  std::vector<SocketWrapper*> peers;
+  for (const auto& wrapper : clientSockets_) {
+    std::string name = wrapper->getPeerName();
+    if (name.empty() || !wrapper->allowRequest()) continue;
+    holders.push_back(name);
+    peers.push_back(wrapper.get());
+  }
+  if (peers.empty()) {
+    std::cerr << "No other online node to stripe across." << std::endl;
+    return;
+  }
 
-      auto res = serverSocket_.send(msg, zmq::send_flags::none);
+  bool striped = false;
+  for (const auto& fileName : names) {
+    std::shared_ptr<FileHandle> handle = FileHandle::open(rootDir_ / fileName);
+    if (!files->count(fileName) || !originalName(fileName).empty() ||
+        !handle) {
+      std::cerr << fileName
+                << " is not a file of this node. File was not striped."
+                << std::endl;
+      continue;
+    }
+    RequestTrace::Scope stripeSpan(tracePid_, "stripe file", 0, fileName);
+    // each peer is sent its stripes on its own thread
+    std::atomic<bool> stored{true};
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < peers.size(); p++) {
+      threads.emplace_back([&, p]() {
+        if (!putStripes(*peers[p], fileName, handle, p + 1, holders.size())) {
+          stored = false;
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    NodeFileSystem::fileMetadata metadata =
+        fileSystem_.getFileMetaData(fileName);
+    // the stripes are of what we read, a file changed since is not striped
+    if (!stored || metadata.fileSize != handle->size() ||
+        !handle->current()) {
+      std::cerr << "Failed to stripe " << fileName
+                << ", it is still read whole." << std::endl;
+      continue;
+    }
+    metadata.storedIpAddress = getNodeName();
+    metadata.stripeSize = STRIPE_SIZE;
+    metadata.stripeHolders = holders;
+    myFileMdata.update([&](auto& files) { files[fileName] = metadata; });
+    indexFile(fileName);
+    striped = true;
+    std::cout << fileName << " striped across " << holders.size() << " nodes."
+              << std::endl;
+  }
+  if (striped) saveStripeMaps();
+}
+
+// Sends wrapper the stripes first, first + step, ... of the file, up to
+// STRIPE_IN_FLIGHT at a time. True once the peer stored all of them.
+bool Node::putStripes(SocketWrapper& wrapper, const std::string& fileName,
+                      const std::shared_ptr<FileHandle>& handle,
+                      std::uint64_t first, std::uint64_t step) {
+  const std::uint64_t stripes =
+      (handle->size() + STRIPE_SIZE - 1) / STRIPE_SIZE;
+  std::set<std::string> pendingIds;
+  std::uint64_t next = first;
+  auto issueNext = [&]() {
+    FileReader reader;
+    std::string data;
+    if (reader.open(handle, next * STRIPE_SIZE, STRIPE_SIZE)) {
+      data.resize(reader.size());
+      data.resize(reader.read(&data[0], data.size()));
     }
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    metrics_.addBytesOut(6 + fileName.length() + data.size());
+    wrapper.issue(requestIdStr, "STRIPE", fileName,
+                  {"PUT", std::to_string(next), data});
+    pendingIds.insert(requestIdStr);
+    next += step;
+  };
+  while (next < stripes && pendingIds.size() < STRIPE_IN_FLIGHT) issueNext();
+
+  bool stored = true;
+  while (!pendingIds.empty()) {
+    std::string requestIdStr;
+    std::vector<zmq::message_t> reply;
+    if (!wrapper.awaitAny(pendingIds, TIMEOUT_MS, requestIdStr, reply)) {
+      std::cerr << "Timeout waiting for" << wrapper.getIp()
+                << "'s response. Proceeding." << std::endl;
+      for (const auto& id : pendingIds) wrapper.cancel(id);
+      wrapper.addTimeout();
+      wrapper.markFailure();
+      return false;
+    }
+    wrapper.markAlive();
+    pendingIds.erase(requestIdStr);
+    // a peer without STRIPE answers UNKNOWN OPERATION.
+    if (reply.empty() || reply[0].to_string() != "OK") stored = false;
+    if (stored && next < stripes) issueNext();
   }
+  return stored;
 }
 
-// will send two messages, first with operation, second with file name
-void Node::sendRequest(FileOperation operation, const std::string& fileName) {
-  for (const auto& wrapper : clientSockets_) {
-    std::string operationStr;
+// Striped copy of fileName's metadata from what peers listed, false if the
+// file is not striped.
+bool Node::stripedMetadata(const std::string& fileName,
+                           NodeFileSystem::fileMetadata& metadata) {
+  std::lock_guard<std::mutex> lock(otherMutex_);
+  auto it = otherFileMData.find(fileName);
+  if (it == otherFileMData.end() || it->second.stripeSize == 0 ||
+      it->second.stripeHolders.empty()) {
+    return false;
+  }
+  metadata = it->second;
+  return true;
+}
 
-    switch (operation) {
-      case FileOperation::LIST:
-        operationStr = "LIST";
-        break;
-      case FileOperation::DELETE:
-        operationStr = "DELETE";
-        break;
-      case FileOperation::SEND:
-        operationStr = "SEND";
-        break;
-      case FileOperation::CREATE:
-        operationStr = "CREATE";
-        break;
-      case FileOperation::UPDATE:
-        operationStr = "UPDATE";
-        break;
-      case FileOperation::UPDATED:
-        operationStr = "UPDATED";
-        break;
-      default:
-        operationStr = "ERROR";
-        break;
+// Every holder is asked for its stripes at once, each on its own thread, and
+// each stripe is written at its offset of the staged copy as it arrives, so
+// only the stripes in flight are ever in memory. Stripes a holder could not
+// send are asked of the owner, then of any peer. The copy is committed like
+// any other received file.
+bool Node::fetchStriped(const std::string& fileName,
+                        const NodeFileSystem::fileMetadata& metadata) {
+  RequestTrace::Scope fetchSpan(tracePid_, "fetch striped", 0, fileName);
+  const std::uint64_t stripes =
+      (metadata.fileSize + metadata.stripeSize - 1) / metadata.stripeSize;
+  std::uint64_t ticket = fileSystem_.createWrite(COPY_PREFIX + fileName);
+  if (ticket == 0) {
+    std::cerr << "Failed to open file for writing.\n";
+    return false;
+  }
+  auto peerNamed = [&](const std::string& name) -> SocketWrapper* {
+    for (const auto& wrapper : clientSockets_) {
+      if (wrapper->getPeerName() == name) return wrapper.get();
     }
+    return nullptr;
+  };
+
+  std::map<SocketWrapper*, std::vector<std::uint64_t>> byPeer;
+  std::vector<std::uint64_t> failed;
+  for (std::uint64_t i = 0; i < stripes; i++) {
+    const std::string& holder =
+        metadata.stripeHolders[i % metadata.stripeHolders.size()];
+    SocketWrapper* wrapper = peerNamed(holder);
+    if (holder == getNodeName()) {
+      // a stripe the owner gave us to keep
+      FileReader reader;
+      std::uint64_t offset = i * metadata.stripeSize;
+      std::uint64_t length =
+          std::min(metadata.stripeSize, metadata.fileSize - offset);
+      bool copied = reader.open(rootDir_ / stripeName(fileName, i)) &&
+                    reader.size() == length;
+      while (copied && length > 0) {
+        std::string_view block = reader.readView();
+        copied = !block.empty() &&
+                 fileSystem_.writeAt(ticket, block.data(), block.size(),
+                                     offset);
+        offset += block.size();
+        length -= std::min<std::uint64_t>(block.size(), length);
+      }
+      if (!copied) failed.push_back(i);
+    } else if (wrapper != nullptr && wrapper->allowRequest()) {
+      byPeer[wrapper].push_back(i);
+    } else {
+      failed.push_back(i);
+    }
+  }
 
-    const int fileNameLength = fileName.length(),
-              operationLength = operationStr.length();
-
-    zmq::message_t operationMessage(operationStr.c_str(), operationLength),
-        fileNameMessage(fileName.c_str(), fileNameLength);
+  std::mutex failedMutex;
+  std::vector<std::thread> threads;
+  for (auto& [wrapper, indexes] : byPeer) {
+    threads.emplace_back([&, wrapper = wrapper, &indexes = indexes]() {
+      std::vector<std::uint64_t> missed;
+      getStripes(*wrapper, fileName, metadata, indexes, ticket, missed);
+      std::lock_guard<std::mutex> lock(failedMutex);
+      failed.insert(failed.end(), missed.begin(), missed.end());
+    });
+  }
+  for (auto& thread : threads) thread.join();
 
-    // std::cout << "Sending " << operationMessage.to_string() << " "
-    //           << fileNameMessage.to_string() << std::endl;
+  // the owner has every stripe, any peer may have a copy of the file
+  SocketWrapper* owner = peerNamed(metadata.storedIpAddress);
+  std::vector<SocketWrapper*> fallbacks;
+  if (owner != nullptr) fallbacks.push_back(owner);
+  for (const auto& wrapper : clientSockets_) {
+    if (wrapper.get() != owner) fallbacks.push_back(wrapper.get());
+  }
+  for (SocketWrapper* wrapper : fallbacks) {
+    if (failed.empty()) break;
+    if (!wrapper->allowRequest()) continue;
+    std::vector<std::uint64_t> missed;
+    getStripes(*wrapper, fileName, metadata, failed, ticket, missed);
+    failed = std::move(missed);
+  }
+  fetchSpan.setDetail(fmt::format("{} stripes from {} holders", stripes,
+                                  byPeer.size()));
+  if (!failed.empty()) {
+    std::cerr << failed.size() << " stripes of " << fileName
+              << " could not be fetched." << std::endl;
+    fileSystem_.discardWrite(ticket);
+    return false;
+  }
 
-    auto res =
-        wrapper->getSocket()->send(operationMessage, zmq::send_flags::sndmore);
-    res = wrapper->getSocket()->send(fileNameMessage, zmq::send_flags::none);
+  std::vector<PendingWrite> writes;
+  if (!addPendingWrite(fileSystem_.stageCreated(ticket), fileName,
+                       metadata.storedIpAddress, metadata.fileSize, writes)) {
+    return false;
+  }
+  return commitWrites(writes);
+}
 
-    zmq_pollitem_t items[] = {{*(wrapper->getSocket()), 0, ZMQ_POLLIN, 0}};
-    int rc = zmq_poll(items, 1, std::chrono::milliseconds(TIMEOUT_MS).count());
+// Asks wrapper for the stripes in indexes, STRIPE_IN_FLIGHT at a time, and
+// writes each at its offset of the staged file ticket. Those it did not send
+// whole are added to failed.
+void Node::getStripes(SocketWrapper& wrapper, const std::string& fileName,
+                      const NodeFileSystem::fileMetadata& metadata,
+                      const std::vector<std::uint64_t>& indexes,
+                      std::uint64_t ticket,
+                      std::vector<std::uint64_t>& failed) {
+  const std::string stripeSizeStr = std::to_string(metadata.stripeSize);
+  std::map<std::string, std::uint64_t> pending;  // request id -> index
+  std::set<std::string> pendingIds;
+  std::size_t next = 0;
+  auto issueNext = [&]() {
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    wrapper.issue(requestIdStr, "STRIPE", fileName,
+                  {"GET", std::to_string(indexes[next]), stripeSizeStr, ""},
+                  true);
+    metrics_.addBytesOut(6 + fileName.length());
+    pending[requestIdStr] = indexes[next];
+    pendingIds.insert(requestIdStr);
+    next++;
+  };
+  while (next < indexes.size() && pending.size() < STRIPE_IN_FLIGHT) {
+    issueNext();
+  }
 
-    if (rc == -1) {
-      // Error during polling
-      std::cerr << "Error during polling: " << zmq_strerror(zmq_errno())
-                << std::endl;
-      return;
-    } else if (rc == 0) {
-      // Timeout reached, no response from server
-      std::cerr << "Timeout waiting for" << wrapper->getIp()
+  while (!pending.empty()) {
+    std::string requestIdStr;
+    std::vector<zmq::message_t> recv_msgs;
+    if (!wrapper.awaitAny(pendingIds, TIMEOUT_MS, requestIdStr, recv_msgs)) {
+      std::cerr << "Timeout waiting for" << wrapper.getIp()
                 << "'s response. Proceeding." << std::endl;
+      for (const auto& [id, index] : pending) {
+        wrapper.cancel(id);
+        failed.push_back(index);
+      }
+      failed.insert(failed.end(), indexes.begin() + next, indexes.end());
+      wrapper.addTimeout();
+      wrapper.markFailure();
       return;
     }
-    // get reply
-    std::vector<zmq::message_t> recv_msgs;
-
-    const auto ret = zmq::recv_multipart(*wrapper->getSocket(),
-                                         std::back_inserter(recv_msgs));
-    if (!ret) std::cerr << "Error accepting message (Sender)" << std::endl;
-    // std::cout << "Got " << *ret << " messages" << std::endl;
-
-    std::vector<std::string> messagesStr;
-
-    for (zmq::message_t& msg : recv_msgs) {
-      messagesStr.push_back(msg.to_string());
+    wrapper.markAlive();
+    std::uint64_t index = pending[requestIdStr];
+    pending.erase(requestIdStr);
+    pendingIds.erase(requestIdStr);
+
+    std::uint64_t offset = index * metadata.stripeSize;
+    std::uint64_t length =
+        std::min(metadata.stripeSize, metadata.fileSize - offset);
+    std::uint64_t received = 0;
+    for (const auto& msg : recv_msgs) received += msg.size();
+    metrics_.addBytesIn(received);
+    bool notFound = !recv_msgs.empty() &&
+                    recv_msgs[0].to_string() == "FILE WAS NOT FOUND.";
+    bool written = received == length && !notFound;
+    for (const auto& msg : recv_msgs) {
+      if (!written) break;
+      written = fileSystem_.writeAt(
+          ticket, static_cast<const char*>(msg.data()), msg.size(), offset);
+      offset += msg.size();
     }
+    if (!written) failed.push_back(index);
+    if (next < indexes.size()) issueNext();
+  }
+}
 
-    // for (std::string messageString : messagesStr) {
-    //   std::cout << " Recieved (Sender): " << messageString << std::endl;
-    // }
-    if (operationStr == "LIST") {
-      // convert string to json then json to vector
-      std::string received_data(static_cast<char*>(recv_msgs[0].data()),
-                                recv_msgs[0].size());
-      Json::CharReaderBuilder builder;
-      Json::Value jsonMap;
-      std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
-      std::string errors;
-      if (!reader->parse(received_data.c_str(),
-                         received_data.c_str() + received_data.size(), &jsonMap,
-                         &errors)) {
-        std::cerr << "Failed to parse JSON: " << errors << std::endl;
-        // todo error handling
-      }
-      std::map<std::string, NodeFileSystem::fileMetadata> fileMdata;
-      for (const auto& key : jsonMap.getMemberNames()) {
-        fileMdata[key] = NodeFileSystem::fileMetadata::fromJson(jsonMap[key]);
-      }
-      // insert into other map
-      // todo check for collisions
-      otherFileMData.insert(fileMdata.begin(), fileMdata.end());
+// The metadata is rebuilt from the directory, so our stripe maps are kept
+// in STRIPE_DIR as well. A map only applies while the file has the size and
+// modification time it was striped at.
+void Node::applyStripeMaps(
+    std::map<std::string, NodeFileSystem::fileMetadata>& fileMdata) {
+  std::string json;
+  if (!readWholeFile(rootDir_ / STRIPE_DIR / STRIPE_MAPS_FILE, json)) return;
+  for (const auto& [name, saved] :
+       NodeFileSystem::metadataFromJsonString(json)) {
+    auto it = fileMdata.find(name);
+    if (it == fileMdata.end() || it->second.fileSize != saved.fileSize ||
+        it->second.lastModified != saved.lastModified) {
+      continue;
     }
+    it->second.stripeSize = saved.stripeSize;
+    it->second.stripeHolders = saved.stripeHolders;
+  }
+}
 
-    //   if (operationStr == "DELETE") {
-    //   }
-    if (operationStr == "SEND") {
-      // Open file to write
-      // If file wasnt found do nothing!
-      if (messagesStr[0] != "FILE WAS NOT FOUND.") {
-        std::string fileNameCopy = "copyof" + fileName;
-        std::ofstream file(rootDir_ / fileNameCopy, std::ios::binary);
-        if (!file.is_open()) {
-          std::cerr << "Failed to open file for writing.\n";
-          // todo error handling
-        }
-        int count = 0;
-        for (zmq::message_t& msg : recv_msgs) {
-          // Access message data directly
-          const char* msgData = static_cast<const char*>(msg.data());
-
-          file.write(msgData, msg.size());
-          count++;
-        }
-        file.close();
-        // std::cout << fileName << " was successfully recieved." << std::endl;
-        NodeFileSystem::fileMetadata tempMd;
-        tempMd = fileSystem_.getFileMetaData("copyof" + fileName);
-        tempMd.storedIpAddress = wrapper->getIp();
-        myFileMdata["copyof" + fileName] = tempMd;
-      }
-    }
-    if (operationStr == "UPDATED") {
-      // convert string to json then json to vector
-      std::string received_data(static_cast<char*>(recv_msgs[0].data()),
-                                recv_msgs[0].size());
-      Json::CharReaderBuilder builder;
-      Json::Value jsonMap;
-      std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
-      std::string errors;
-      if (!reader->parse(received_data.c_str(),
-                         received_data.c_str() + received_data.size(), &jsonMap,
-                         &errors)) {
-        std::cerr << "Failed to parse JSON: " << errors << std::endl;
-        // todo error handling
-      }
-      std::map<std::string, NodeFileSystem::fileMetadata> fileMdata;
-      for (const auto& key : jsonMap.getMemberNames()) {
-        fileMdata[key] = NodeFileSystem::fileMetadata::fromJson(jsonMap[key]);
-      }
-      // insert into other map
+void Node::saveStripeMaps() {
+  std::map<std::string, NodeFileSystem::fileMetadata> striped;
+  for (const auto& [name, metadata] : *myFileMdata.load()) {
+    if (metadata.stripeSize > 0) striped.insert({name, metadata});
+  }
+  std::string json = NodeFileSystem::metadataToJsonString(striped);
+  std::error_code error;
+  std::filesystem::create_directories(rootDir_ / STRIPE_DIR, error);
+  if (error || !fileSystem_.waitWrite(fileSystem_.stageWrite(
+                   STRIPE_DIR + "/" + STRIPE_MAPS_FILE, json.data(),
+                   json.size()))) {
+    std::cerr << "Failed to save stripe maps." << std::endl;
+  }
+}
 
-      for (auto entry : fileMdata) {
-        otherFileMData[entry.first] = entry.second;
-      }
-    }
+std::string Node::operationToString(FileOperation operation) {
+  switch (operation) {
+    case FileOperation::LIST:
+      return "LIST";
+    case FileOperation::DELETE:
+      return "DELETE";
+    case FileOperation::SEND:
+      return "SEND";
+    case FileOperation::CREATE:
+      return "CREATE";
+    case FileOperation::UPDATE:
+      return "UPDATE";
+    case FileOperation::UPDATED:
+      return "UPDATED";
+    case FileOperation::STATS:
+      return "STATS";
+    case FileOperation::TRACE:
+      return "TRACE";
+    case FileOperation::PING:
+      return "PING";
+    case FileOperation::FILTER:
+      return "FILTER";
+    case FileOperation::MERKLE:
+      return "MERKLE";
+    case FileOperation::DELTA:
+      return "DELTA";
+    case FileOperation::HOT:
+      return "HOT";
+    case FileOperation::PACK:
+      return "PACK";
+    case FileOperation::STRIPE:
+      return "STRIPE";
+    case FileOperation::CANCEL:
+      return "CANCEL";
+    default:
+      return "ERROR";
   }
 }
 
 std::map<std::string, NodeFileSystem::fileMetadata> Node::getMyFileData() {
-  return myFileMdata;
+  return *myFileMdata.load();
 }
 
 std::map<std::string, NodeFileSystem::fileMetadata> Node::getOtherFileData() {
+  std::lock_guard<std::mutex> lock(otherMutex_);
   return otherFileMData;
 }
 
@@ -374,39 +2501,49 @@ void Node::addFileData() {}
 
 void Node::setFileData(
     std::map<std::string, NodeFileSystem::fileMetadata> fileMData) {
-  myFileMdata = fileMData;
+  myFileMdata.store(std::move(fileMData));
+  rebuildIndexes();
 }
 
 void Node::createFile(std::string fileName) {
-  if (myFileMdata.find(fileName) != myFileMdata.end()) {
+  if (myFileMdata.load()->count(fileName)) {
     std::cerr << fileName << " already exists. File was not created."
               << std::endl;
   } else {
     NodeFileSystem::fileMetadata fileMetadata =
         fileSystem_.createFile(fileName);
-    fileMetadata.storedIpAddress = ipAddress_ + ":" + std::to_string(port_);
-    myFileMdata.insert({fileName, fileMetadata});
+    fileMetadata.storedIpAddress = getNodeName();
+    myFileMdata.update(
+        [&](auto& files) { files.insert({fileName, fileMetadata}); });
+    indexFile(fileName);
   }
 }
 
 void Node::deleteFile(std::string fileName) {
-  if (myFileMdata.find(fileName) == myFileMdata.end()) {
+  if (!myFileMdata.load()->count(fileName)) {
     std::cerr << fileName << " was not found. File was not deleted."
               << std::endl;
   } else {
     fileSystem_.deleteFile(fileName);
-    auto it = myFileMdata.find(fileName);
-    myFileMdata.erase(it);
+    myFileMdata.update([&](auto& files) { files.erase(fileName); });
+    unindexFile(fileName);
   }
 }
 
 void Node::readFile(std::string fileName) {
+  // a copy we already hold, e.g. a hot file replica, is read in place
+  if (!std::filesystem::exists(rootDir_ / fileName) &&
+      std::filesystem::exists(rootDir_ / (COPY_PREFIX + fileName))) {
+    fileSystem_.readFile(COPY_PREFIX + fileName);
+    return;
+  }
   if (!std::filesystem::exists(rootDir_ / fileName)) {
     sendRequest(Node::FileOperation::SEND, fileName);
     std::string copyFileNameStr = "copyof" + fileName;
     if (std::filesystem::exists(rootDir_ / copyFileNameStr)) {
       fileSystem_.readFile(copyFileNameStr);
       fileSystem_.deleteFile(copyFileNameStr);
+      servingCache_.invalidate(rootDir_ / copyFileNameStr);
       return;
     }
   }
@@ -419,6 +2556,11 @@ void Node::readFile(std::string fileName) {
   }
 }
 
+bool Node::openFile(const std::string& fileName, FileReader& reader) {
+  return fileSystem_.openFile(fileName, reader) ||
+         fileSystem_.openFile(COPY_PREFIX + fileName, reader);
+}
+
 void Node::getFile(std::string fileName) {
   if (std::filesystem::exists(rootDir_ / fileName)) {
     std::cout
@@ -426,6 +2568,18 @@ void Node::getFile(std::string fileName) {
         << std::endl;
         return;
   } else if (!std::filesystem::exists(rootDir_ / fileName)) {
+    // an older copy only needs the blocks that changed
+    if (std::filesystem::exists(rootDir_ / ("copyof" + fileName)) &&
+        syncFile(fileName)) {
+      refresh();
+      return;
+    }
+    // a striped file is read from all its holders at once
+    NodeFileSystem::fileMetadata striped;
+    if (stripedMetadata(fileName, striped) && fetchStriped(fileName, striped)) {
+      refresh();
+      return;
+    }
     sendRequest(Node::FileOperation::SEND, fileName);
     refresh();
     return;
@@ -460,9 +2614,11 @@ void printLine(std::string fileName, NodeFileSystem::fileMetadata metaData,
 
 // Format:
 // Name | On Node | IP | File size | Last modified
-void Node::listFiles() {
-  otherFileMData.clear();
-  sendRequest(Node::FileOperation::LIST, "No File Name");
+void Node::listFiles(const std::string& prefix) {
+  {
+    std::lock_guard<std::mutex> lock(otherMutex_);
+    otherFileMData.clear();
+  }
 
   printElement("Name", 20);
   printElement("On Node", 10);
@@ -470,25 +2626,338 @@ void Node::listFiles() {
   printElement("Size (kb)", 10);
   printElement("Last Modified", 20);
   std::cout << std::endl;
-  for (auto [filename, metadata] : myFileMdata) {
-    printLine(filename, metadata, true);
+  auto files = myFileMdata.load();
+  for (auto it = files->lower_bound(prefix);
+       it != files->end() && it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    printLine(it->first, it->second, true);
     std::cout << std::endl;
   }
-  for (auto [filename, metadata] : otherFileMData) {
-    printLine(filename, metadata, false);
-    std::cout << std::endl;
+  // print each page as it arrives instead of waiting for every peer
+  for (const auto& wrapper : clientSockets_) {
+    if (!wrapper->allowRequest()) continue;
+    listPeerFiles(*wrapper, prefix, [this](const auto& page) {
+      for (const auto& [filename, metadata] : page) {
+        printLine(filename, metadata, false);
+        std::cout << std::endl;
+      }
+      std::lock_guard<std::mutex> lock(otherMutex_);
+      otherFileMData.insert(page.begin(), page.end());
+    });
   }
 }
 
 void Node::refresh() {
-  myFileMdata.clear();
+  // built on the side, readers keep the old snapshot until it is published
+  std::map<std::string, NodeFileSystem::fileMetadata> fileMdata;
   for (const auto& entry : std::filesystem::directory_iterator(rootDir_)) {
+    // a write still waiting for its commit, or STRIPE_DIR
+    if (GroupCommit::isTemporary(entry.path().filename().string()) ||
+        !entry.is_regular_file()) {
+      continue;
+    }
     NodeFileSystem::fileMetadata tempMd;
     tempMd = fileSystem_.getFileMetaData(entry.path().filename());
-    myFileMdata[entry.path().filename()] = tempMd;
+    fileMdata[entry.path().filename()] = tempMd;
+  }
+  for (auto& [filename, metadata] : fileMdata) {
+    metadata.storedIpAddress = getNodeName();
+  }
+  applyStripeMaps(fileMdata);
+  myFileMdata.store(std::move(fileMdata));
+  rebuildIndexes();
+}
+
+// room for twice the current names before it has to grow
+// copies are in the filter under their original name as well
+BloomFilter buildFilter(
+    const std::map<std::string, NodeFileSystem::fileMetadata>& fileMdata) {
+  BloomFilter filter(2 * fileMdata.size());
+  for (const auto& entry : fileMdata) {
+    filter.add(entry.first);
+    std::string original = originalName(entry.first);
+    if (!original.empty()) filter.add(original);
+  }
+  return filter;
+}
+
+void Node::rebuildIndexes() {
+  servingCache_.clear();
+  auto files = myFileMdata.load();
+  BloomFilter filter = buildFilter(*files);
+  std::lock_guard<std::mutex> lock(indexMutex_);
+  fileFilter_ = std::move(filter);
+  filterVersion_++;
+  merkle_.clear();
+  for (const auto& [filename, metadata] : *files) {
+    merkle_.set(filename, metadata);
+  }
+}
+
+void Node::indexFile(const std::string& fileName) {
+  servingCache_.invalidate(rootDir_ / fileName);
+  auto files = myFileMdata.load();
+  auto it = files->find(fileName);
+  if (it == files->end()) return;
+  std::lock_guard<std::mutex> lock(indexMutex_);
+  // a changed file only changes the tree, the filter has its name already
+  if (!merkle_.set(fileName, it->second)) return;
+  std::string original = originalName(fileName);
+  if (fileFilter_.size() + 2 <= fileFilter_.capacity()) {
+    fileFilter_.add(fileName);
+    if (!original.empty()) fileFilter_.add(original);
+  } else {
+    fileFilter_ = buildFilter(*files);
+  }
+  filterVersion_++;
+}
+
+void Node::unindexFile(const std::string& fileName) {
+  servingCache_.invalidate(rootDir_ / fileName);
+  std::lock_guard<std::mutex> lock(indexMutex_);
+  // removing a name that was never added would corrupt the counters
+  if (!merkle_.erase(fileName)) return;
+  fileFilter_.remove(fileName);
+  std::string original = originalName(fileName);
+  if (!original.empty()) fileFilter_.remove(original);
+  filterVersion_++;
+}
+
+// Asks every peer for its hot files and fetches the ones we do not have, so
+// later reads of them are served here and by us to others. Copies that no
+// peer has reported hot for COLD_REPLICA_MS are deleted again.
+void Node::replicateHotFiles() {
+  // age our own counts so a spike fades once it is over
+  readSketch_.decay();
+  {
+    std::lock_guard<std::mutex> lock(hotMutex_);
+    for (auto it = hotFiles_.begin(); it != hotFiles_.end();) {
+      it->second = readSketch_.estimate(it->first);
+      it = it->second < HOT_THRESHOLD ? hotFiles_.erase(it) : std::next(it);
+    }
+  }
+
+  std::set<std::string> hotNow;
+  for (const auto& wrapper : clientSockets_) {
+    if (!wrapper->allowRequest()) continue;
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    wrapper->issue(requestIdStr, "HOT", "");
+    std::vector<zmq::message_t> recv_msgs;
+    if (!wrapper->awaitReply(requestIdStr, TIMEOUT_MS, recv_msgs)) {
+      wrapper->addTimeout();
+      wrapper->markFailure();
+      continue;
+    }
+    wrapper->markAlive();
+    if (recv_msgs.empty()) continue;
+    metrics_.addBytesIn(recv_msgs[0].size());
+    std::string reply = recv_msgs[0].to_string();
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    Json::Value hot;
+    std::string errors;
+    if (!reader->parse(reply.c_str(), reply.c_str() + reply.size(), &hot,
+                       &errors) ||
+        !hot.isObject()) {
+      continue;  // a peer without HOT
+    }
+    for (const auto& name : hot.getMemberNames()) hotNow.insert(name);
+  }
+
+  const std::int64_t now = steadyNowMs();
+  std::vector<std::string> toFetch;
+  for (const auto& name : hotNow) {
+    if (std::filesystem::exists(rootDir_ / name)) continue;
+    if (!std::filesystem::exists(rootDir_ / (COPY_PREFIX + name))) {
+      toFetch.push_back(name);
+    } else if (!hotReplicas_.count(name)) {
+      continue;  // a copy the user asked for, not ours to drop
+    }
+    hotReplicas_[name] = now;
+  }
+  if (!toFetch.empty()) getFiles(toFetch, true);
+
+  for (auto it = hotReplicas_.begin(); it != hotReplicas_.end();) {
+    if (now - it->second < COLD_REPLICA_MS) {
+      ++it;
+      continue;
+    }
+    deleteFile(COPY_PREFIX + it->first);
+    it = hotReplicas_.erase(it);
+  }
+  std::size_t hotFiles;
+  {
+    std::lock_guard<std::mutex> lock(hotMutex_);
+    hotFiles = hotFiles_.size();
+  }
+  metrics_.setReplication(hotFiles, hotReplicas_.size());
+}
+
+void Node::runReplication(std::atomic<bool>& running) {
+  std::int64_t nextRunMs = steadyNowMs() + REPLICATION_INTERVAL_MS;
+  while (running.load()) {
+    if (steadyNowMs() >= nextRunMs) {
+      replicateHotFiles();
+      nextRunMs = steadyNowMs() + REPLICATION_INTERVAL_MS;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+// Fetches the given tree nodes of a peer's Merkle tree, pipelined like
+// getFiles. Replies are returned in the order of nodes.
+bool Node::fetchMerkle(SocketWrapper& wrapper,
+                       const std::vector<std::pair<int, std::size_t>>& nodes,
+                       std::vector<std::string>& replies) {
+  replies.assign(nodes.size(), "");
+  std::map<std::string, std::size_t> pending;  // request id -> node
+  std::set<std::string> pendingIds;
+  std::size_t next = 0;
+  auto issueNext = [&]() {
+    std::string requestIdStr = formatRequestId(nextRequestId_++);
+    std::vector<std::string> args = {std::to_string(nodes[next].first),
+                                     std::to_string(nodes[next].second)};
+    wrapper.issue(requestIdStr, "MERKLE", "", args);
+    metrics_.addBytesOut(6 + args[0].length() + args[1].length());
+    pending[requestIdStr] = next++;
+    pendingIds.insert(requestIdStr);
+  };
+  while (next < nodes.size() && pending.size() < MAX_IN_FLIGHT) issueNext();
+
+  while (!pending.empty()) {
+    std::string requestIdStr;
+    std::vector<zmq::message_t> recv_msgs;
+    if (!wrapper.awaitAny(pendingIds, TIMEOUT_MS, requestIdStr, recv_msgs)) {
+      for (const auto& id : pendingIds) wrapper.cancel(id);
+      wrapper.addTimeout();
+      wrapper.markFailure();
+      return false;
+    }
+    wrapper.markAlive();
+    if (!recv_msgs.empty()) {
+      metrics_.addBytesIn(recv_msgs[0].size());
+      replies[pending[requestIdStr]] = recv_msgs[0].to_string();
+    }
+    pending.erase(requestIdStr);
+    pendingIds.erase(requestIdStr);
+    if (next < nodes.size()) issueNext();
+  }
+  return true;
+}
+
+// Compares the peer's tree with our mirror of it level by level, descending
+// only where hashes differ, then refetches the buckets that differ. An
+// unchanged peer costs one reply of 17 hashes.
+bool Node::reconcilePeer(std::size_t peerIndex) {
+  SocketWrapper& wrapper = *clientSockets_[peerIndex];
+  std::lock_guard<std::mutex> lock(mirrorMutex_);
+  MerkleTree& mirror = peerTrees_[peerIndex];
+  RequestTrace::Scope span(tracePid_, "reconcile", 0, wrapper.getIp());
+
+  std::vector<std::pair<int, std::size_t>> frontier = {{0, 0}};
+  std::vector<std::pair<int, std::size_t>> staleBuckets;
+  for (int level = 0; level < MerkleTree::DEPTH && !frontier.empty();
+       level++) {
+    std::vector<std::string> replies;
+    if (!fetchMerkle(wrapper, frontier, replies)) return false;
+    std::vector<std::pair<int, std::size_t>> next;
+    for (std::size_t i = 0; i < frontier.size(); i++) {
+      std::vector<std::uint64_t> hashes = MerkleTree::decodeHashes(replies[i]);
+      // peers without MERKLE answer UNKNOWN OPERATION.
+      if (hashes.size() != MerkleTree::FANOUT + 1) return false;
+      auto [nodeLevel, nodeIndex] = frontier[i];
+      if (hashes[0] == mirror.hash(nodeLevel, nodeIndex)) continue;
+      std::vector<std::uint64_t> ours = mirror.childHashes(nodeLevel, nodeIndex);
+      for (std::size_t c = 0; c < MerkleTree::FANOUT; c++) {
+        if (hashes[c + 1] == ours[c]) continue;
+        std::pair<int, std::size_t> child = {nodeLevel + 1,
+                                             nodeIndex * MerkleTree::FANOUT + c};
+        if (child.first == MerkleTree::DEPTH) {
+          staleBuckets.push_back(child);
+        } else {
+          next.push_back(child);
+        }
+      }
+    }
+    frontier = next;
+  }
+  if (staleBuckets.empty()) return true;
+
+  std::vector<std::string> replies;
+  if (!fetchMerkle(wrapper, staleBuckets, replies)) return false;
+  std::size_t changed = 0;
+  for (std::size_t i = 0; i < staleBuckets.size(); i++) {
+    std::map<std::string, NodeFileSystem::fileMetadata> entries =
+        NodeFileSystem::metadataFromJsonString(replies[i]);
+    std::lock_guard<std::mutex> otherLock(otherMutex_);
+    for (const auto& name : mirror.bucketNames(staleBuckets[i].second)) {
+      mirror.erase(name);
+      otherFileMData.erase(name);
+    }
+    for (const auto& [name, metadata] : entries) {
+      mirror.set(name, metadata);
+      otherFileMData[name] = metadata;
+    }
+    changed += entries.size();
+  }
+  span.setDetail(fmt::format("{} buckets, {} entries", staleBuckets.size(),
+                             changed));
+  return true;
+}
+
+bool Node::reconcilePeers() {
+  bool reconciled = true;
+  for (std::size_t i = 0; i < clientSockets_.size(); i++) {
+    if (!clientSockets_[i]->allowRequest() || !reconcilePeer(i)) {
+      reconciled = false;
+    }
+  }
+  return reconciled;
+}
+
+// Stripes are kept by index, for as long as some peer's map still deals
+// that index to us. The maps are only trusted right after every peer was
+// reconciled, so an owner we could not reach does not lose its stripes.
+void Node::sweepStripes() {
+  const std::string self = getNodeName();
+  const auto now = std::filesystem::file_time_type::clock::now();
+  std::error_code error;
+  std::lock_guard<std::mutex> lock(otherMutex_);
+  for (const auto& entry :
+       std::filesystem::directory_iterator(rootDir_ / STRIPE_DIR, error)) {
+    // STRIPE_DIR holds name.index files, our maps and commit temporaries
+    std::string stripe = entry.path().filename().string();
+    std::size_t dot = stripe.rfind('.');
+    if (!entry.is_regular_file() || dot == std::string::npos ||
+        stripe == STRIPE_MAPS_FILE || GroupCommit::isTemporary(stripe) ||
+        now - entry.last_write_time() <
+            std::chrono::milliseconds(STRIPE_SWEEP_GRACE_MS)) {
+      continue;
+    }
+    std::uint64_t index =
+        std::strtoull(stripe.c_str() + dot + 1, nullptr, 10);
+    auto it = otherFileMData.find(stripe.substr(0, dot));
+    if (it != otherFileMData.end() && it->second.stripeSize > 0 &&
+        !it->second.stripeHolders.empty() &&
+        index * it->second.stripeSize < it->second.fileSize &&
+        it->second.stripeHolders[index % it->second.stripeHolders.size()] ==
+            self) {
+      continue;
+    }
+    std::error_code removeError;
+    std::filesystem::remove(entry.path(), removeError);
   }
-  for (auto& [filename, metadata] : myFileMdata) {
-    metadata.storedIpAddress = ipAddress_ + ":" + std::to_string(port_);
+}
+
+void Node::runAntiEntropy(std::atomic<bool>& running) {
+  std::int64_t nextRunMs = steadyNowMs();
+  while (running.load()) {
+    // an UPDATE from a peer runs a round right away
+    if (reconcileRequested_.exchange(false) || steadyNowMs() >= nextRunMs) {
+      if (reconcilePeers()) sweepStripes();
+      nextRunMs = steadyNowMs() + ANTI_ENTROPY_INTERVAL_MS;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 }
 
@@ -497,13 +2966,423 @@ void Node::update() {
   sendRequest(Node::FileOperation::UPDATE, "");
 }
 
-SocketWrapper::SocketWrapper(zmq::socket_t* socket, std::string ip, int port)
-    : socket_(socket) {
-  ip_ = ip + ":" + std::to_string(port);
+void Node::setFaultInjection(int latencyMs, double lossRate) {
+  faultLatencyMs_ = latencyMs;
+  faultLossRate_ = lossRate;
+}
+
+// A node bound to every interface is known by its host name, the address
+// alone would be the same "*" everywhere.
+std::string Node::getNodeName() {
+  if (isEndpoint(ipAddress_)) return ipAddress_;
+  std::string host = ipAddress_;
+  if (host == "*" || host == "0.0.0.0" || host.empty()) {
+#ifndef _WIN32
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) == 0) host = name;
+#else
+    if (const char* name = std::getenv("COMPUTERNAME")) host = name;
+#endif
+  }
+  return host + ":" + std::to_string(port_);
+}
+
+bool Node::dumpTrace(const std::string& path, bool includePeers) {
+  collectedTraceEvents_ = RequestTrace::eventsJson(tracePid_, getNodeName());
+  if (includePeers) sendRequest(Node::FileOperation::TRACE);
+
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open " << path << " for writing." << std::endl;
+    return false;
+  }
+  file << RequestTrace::traceDocument(collectedTraceEvents_);
+  collectedTraceEvents_.clear();
+  return true;
+}
+
+std::string Node::formatRequestId(std::uint64_t requestId) {
+  return fmt::format("{:016x}", requestId);
+}
+
+std::uint64_t Node::parseRequestId(const std::string& requestIdStr) {
+  if (requestIdStr.empty()) return 0;
+  try {
+    return std::stoull(requestIdStr, nullptr, 16);
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+std::string Node::getStats(bool prometheus) {
+  std::vector<NodeMetrics::PeerStats> peers;
+  for (const auto& wrapper : clientSockets_) {
+    peers.push_back({wrapper->getIp(), wrapper->getTimeouts(),
+                     wrapper->getStateName(), wrapper->expectedUs(0),
+                     wrapper->getBusyReplies()});
+  }
+  return prometheus ? metrics_.toPrometheus(peers) : metrics_.toText(peers);
+}
+
+SocketWrapper::SocketWrapper(zmq::context_t& context, std::string ip,
+                             int port, std::string endpoint)
+    : context_(context), endpoint_(endpoint) {
+  ip_ = isEndpoint(ip) ? ip : ip + ":" + std::to_string(port);
 }
 
-SocketWrapper::~SocketWrapper() { delete socket_; }
+SocketWrapper::~SocketWrapper() { close(); }
+
+void SocketWrapper::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [thread, channel] : channels_) channel->socket.close();
+  channels_.clear();
+}
 
-zmq::socket_t* SocketWrapper::getSocket() const { return socket_; }
+// Threads come and go, so channels nobody is using and that have nothing in
+// flight are dropped whenever a new one is made. A thread whose channel was
+// dropped simply gets a new one.
+std::shared_ptr<SocketWrapper::Channel> SocketWrapper::channel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = channels_.find(std::this_thread::get_id());
+  if (it != channels_.end()) return it->second;
+  for (auto idle = channels_.begin(); idle != channels_.end();) {
+    Channel& other = *idle->second;
+    // references are only taken under mutex_, so a count of 1 stays 1
+    bool unused = idle->second.use_count() == 1 && other.inUse.try_lock();
+    if (unused) {
+      unused = other.inFlight.empty() && other.ready.empty() &&
+               other.sent.empty();
+      other.inUse.unlock();
+    }
+    if (unused) {
+      other.socket.close();
+      idle = channels_.erase(idle);
+    } else {
+      ++idle;
+    }
+  }
+  auto created = std::make_shared<Channel>();
+  created->socket = zmq::socket_t(context_, zmq::socket_type::dealer);
+  created->socket.set(zmq::sockopt::linger, 0);
+  created->socket.connect(endpoint_);
+  channels_[std::this_thread::get_id()] = created;
+  return created;
+}
 
 std::string SocketWrapper::getIp() { return ip_; }
+
+void SocketWrapper::addTimeout() {
+  timeouts_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t SocketWrapper::getTimeouts() const {
+  return timeouts_.load(std::memory_order_relaxed);
+}
+
+std::string SocketWrapper::getEndpoint() const { return endpoint_; }
+
+void SocketWrapper::issue(const std::string& requestIdStr,
+                          const std::string& operation,
+                          const std::string& fileName,
+                          const std::vector<std::string>& args,
+                          bool streamed) {
+  std::shared_ptr<Channel> channel = this->channel();
+  std::lock_guard<std::mutex> inUse(channel->inUse);
+  Sent& sent = channel->sent[requestIdStr];
+  sent.frames = {operation, fileName, requestIdStr};
+  sent.frames.insert(sent.frames.end(), args.begin(), args.end());
+  sent.streamed = streamed;
+  sendFrames(*channel, sent.frames);
+  channel->inFlight[requestIdStr] = steadyNowMs();
+  channel->inFlightCount = channel->inFlight.size();
+  if (streamed) channel->streamed.insert(requestIdStr);
+}
+
+void SocketWrapper::sendFrames(Channel& channel,
+                               const std::vector<std::string>& frames) {
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    zmq::message_t message(frames[i].c_str(), frames[i].length());
+    auto res = channel.socket.send(message, i + 1 < frames.size()
+                                                ? zmq::send_flags::sndmore
+                                                : zmq::send_flags::none);
+  }
+}
+
+std::int64_t SocketWrapper::resendDue(Channel& channel) {
+  std::int64_t now = steadyNowMs(), nextMs = -1;
+  for (auto& [requestIdStr, sent] : channel.sent) {
+    if (sent.retryAtMs == 0) continue;
+    if (sent.retryAtMs <= now) {
+      sendFrames(channel, sent.frames);
+      sent.retryAtMs = 0;
+      continue;
+    }
+    std::int64_t waitMs = sent.retryAtMs - now;
+    nextMs = nextMs < 0 ? waitMs : std::min(nextMs, waitMs);
+  }
+  return nextMs;
+}
+
+// Moves every reply already waiting on the socket into ready. Replies for
+// requests that are no longer in flight (timed out or cancelled) are dropped.
+bool SocketWrapper::receiveReady(Channel& channel) {
+  bool received = false;
+  while (true) {
+    std::vector<zmq::message_t> recv_msgs;
+    auto ret = zmq::recv_multipart(channel.socket,
+                                   std::back_inserter(recv_msgs),
+                                   zmq::recv_flags::dontwait);
+    if (!ret) return received;
+    if (recv_msgs.empty()) continue;
+    std::string requestIdStr = recv_msgs[0].to_string();
+    auto inFlight = channel.inFlight.find(requestIdStr);
+    if (inFlight == channel.inFlight.end()) {
+      staleReplies_++;
+      continue;
+    }
+    // only what belongs to the request keeps it from timing out
+    inFlight->second = steadyNowMs();
+    received = true;
+    // first frame is the request id, the payload follows
+    recv_msgs.erase(recv_msgs.begin());
+    if (channel.streamed.count(requestIdStr)) {
+      // then a slice flag, the reply is done after the SLICE_LAST slice
+      bool last = recv_msgs.empty() || recv_msgs[0].to_string() != SLICE_MORE;
+      if (!recv_msgs.empty()) recv_msgs.erase(recv_msgs.begin());
+      auto& parts = channel.partial[requestIdStr];
+      std::move(recv_msgs.begin(), recv_msgs.end(), std::back_inserter(parts));
+      if (!last) continue;
+      recv_msgs = std::move(parts);
+      channel.partial.erase(requestIdStr);
+      channel.streamed.erase(requestIdStr);
+    }
+    auto sent = channel.sent.find(requestIdStr);
+    if (sent != channel.sent.end() && isBusyReply(recv_msgs)) {
+      busyReplies_++;
+      if (++sent->second.busyReplies <= MAX_BUSY_RETRIES) {
+        // Doubles with each BUSY and is never below the peer's hint. The
+        // jitter keeps requesters a busy peer turned away together from
+        // all coming back together.
+        std::int64_t hintMs =
+            std::strtoll(recv_msgs[1].to_string().c_str(), nullptr, 10);
+        std::int64_t backoffMs = std::clamp<std::int64_t>(
+            std::max<std::int64_t>(
+                hintMs, BUSY_RETRY_MS << sent->second.busyReplies),
+            BUSY_RETRY_MS, MAX_BUSY_RETRY_MS);
+        sent->second.retryAtMs =
+            steadyNowMs() + backoffMs / 2 +
+            std::uniform_int_distribution<std::int64_t>(
+                0, backoffMs / 2)(threadRng());
+        if (sent->second.streamed) channel.streamed.insert(requestIdStr);
+        continue;
+      }
+      // every caller takes an empty reply as a failed request
+      recv_msgs.clear();
+    }
+    if (sent != channel.sent.end()) channel.sent.erase(sent);
+    channel.inFlight.erase(requestIdStr);
+    channel.inFlightCount = channel.inFlight.size();
+    channel.ready[requestIdStr] = std::move(recv_msgs);
+  }
+}
+
+bool SocketWrapper::awaitAny(const std::set<std::string>& requestIds,
+                             int timeoutMs, std::string& requestIdStr,
+                             std::vector<zmq::message_t>& reply) {
+  std::shared_ptr<Channel> channel = this->channel();
+  std::lock_guard<std::mutex> inUse(channel->inUse);
+  std::int64_t deadline = steadyNowMs() + timeoutMs;
+  while (true) {
+    for (const auto& id : requestIds) {
+      auto it = channel->ready.find(id);
+      if (it != channel->ready.end()) {
+        requestIdStr = id;
+        reply = std::move(it->second);
+        channel->ready.erase(it);
+        return true;
+      }
+    }
+    std::int64_t remaining = deadline - steadyNowMs();
+    if (remaining <= 0) return false;
+    std::int64_t retryMs = resendDue(*channel);
+    if (retryMs >= 0) remaining = std::min(remaining, retryMs);
+    zmq_pollitem_t items[] = {{channel->socket, 0, ZMQ_POLLIN, 0}};
+    // a slow peer that keeps sending slices is not timed out
+    if (zmq_poll(items, 1, remaining) > 0 && receiveReady(*channel)) {
+      deadline = steadyNowMs() + timeoutMs;
+    }
+  }
+}
+
+bool SocketWrapper::awaitReply(const std::string& requestIdStr, int timeoutMs,
+                               std::vector<zmq::message_t>& reply) {
+  std::string repliedId;
+  if (awaitAny({requestIdStr}, timeoutMs, repliedId, reply)) return true;
+  cancel(requestIdStr);
+  return false;
+}
+
+bool SocketWrapper::awaitUntil(const std::string& requestIdStr,
+                               std::int64_t deadlineMs,
+                               std::vector<zmq::message_t>& reply) {
+  std::shared_ptr<Channel> channel = this->channel();
+  std::lock_guard<std::mutex> inUse(channel->inUse);
+  while (true) {
+    auto it = channel->ready.find(requestIdStr);
+    if (it != channel->ready.end()) {
+      reply = std::move(it->second);
+      channel->ready.erase(it);
+      return true;
+    }
+    std::int64_t remaining = deadlineMs - steadyNowMs();
+    if (remaining <= 0) return false;
+    std::int64_t retryMs = resendDue(*channel);
+    if (retryMs >= 0) remaining = std::min(remaining, retryMs);
+    zmq_pollitem_t items[] = {{channel->socket, 0, ZMQ_POLLIN, 0}};
+    if (zmq_poll(items, 1, remaining) > 0) receiveReady(*channel);
+  }
+}
+
+std::int64_t SocketWrapper::getLastReceiveMs(const std::string& requestIdStr) {
+  std::shared_ptr<Channel> channel = this->channel();
+  std::lock_guard<std::mutex> inUse(channel->inUse);
+  auto it = channel->inFlight.find(requestIdStr);
+  return it == channel->inFlight.end() ? 0 : it->second;
+}
+
+void SocketWrapper::cancel(const std::string& requestIdStr) {
+  std::shared_ptr<Channel> channel = this->channel();
+  std::lock_guard<std::mutex> inUse(channel->inUse);
+  channel->inFlight.erase(requestIdStr);
+  channel->inFlightCount = channel->inFlight.size();
+  channel->ready.erase(requestIdStr);
+  channel->streamed.erase(requestIdStr);
+  channel->partial.erase(requestIdStr);
+  channel->sent.erase(requestIdStr);
+}
+
+// Gains of 1/8 and 1/4 as in TCP's RTT estimator. The deviation is taken
+// before the sample is learnt from, so it measures how wrong we were.
+void SocketWrapper::recordReply(std::int64_t elapsedUs, std::uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(estimateMutex_);
+  double elapsed = std::max<std::int64_t>(elapsedUs, 1);
+  bool large = bytes >= THROUGHPUT_MIN_BYTES;
+  if (large ? bytesPerUs_ > 0 : rttUs_ > 0) {
+    double expected = rttUs_ + (large ? bytes / bytesPerUs_ : 0);
+    deviationUs_ += (std::abs(elapsed - expected) - deviationUs_) / 4;
+  }
+  if (!large) {
+    if (rttUs_ == 0) deviationUs_ = elapsed / 2;
+    rttUs_ = rttUs_ > 0 ? rttUs_ + (elapsed - rttUs_) / 8 : elapsed;
+    return;
+  }
+  // the round trip is part of every reply, the rest is transfer
+  double rate = bytes / std::max(elapsed - rttUs_, elapsed / 2);
+  bytesPerUs_ =
+      bytesPerUs_ > 0 ? bytesPerUs_ + (rate - bytesPerUs_) / 8 : rate;
+}
+
+std::int64_t SocketWrapper::expectedUs(std::uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(estimateMutex_);
+  double transfer = bytesPerUs_ > 0 ? bytes / bytesPerUs_ : 0;
+  return static_cast<std::int64_t>(rttUs_ + transfer);
+}
+
+std::int64_t SocketWrapper::hedgeDelayMs(std::uint64_t bytes) {
+  std::int64_t expected = expectedUs(bytes);
+  std::lock_guard<std::mutex> lock(estimateMutex_);
+  if (expected == 0 ||
+      (bytes >= THROUGHPUT_MIN_BYTES && bytesPerUs_ == 0)) {
+    return HEDGE_UNKNOWN_MS;
+  }
+  // for roughly normal reply times the mean deviation is 0.8 standard
+  // deviations, so two of them past the mean is about the 95th percentile
+  return std::max<std::int64_t>(
+      HEDGE_MIN_MS, (expected + 2 * deviationUs_) / 1000 + 1);
+}
+
+std::size_t SocketWrapper::getInFlight() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t inFlight = 0;
+  for (const auto& [thread, channel] : channels_) {
+    inFlight += channel->inFlightCount.load();
+  }
+  return inFlight;
+}
+
+std::uint64_t SocketWrapper::getStaleReplies() const {
+  return staleReplies_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t SocketWrapper::getBusyReplies() const {
+  return busyReplies_.load(std::memory_order_relaxed);
+}
+
+void SocketWrapper::setFilter(std::uint64_t version, BloomFilter filter) {
+  std::lock_guard<std::mutex> lock(filterMutex_);
+  filter_ = std::move(filter);
+  filterVersion_ = version;
+  filterKnown_ = true;
+}
+
+bool SocketWrapper::hasFilter(std::uint64_t version) {
+  std::lock_guard<std::mutex> lock(filterMutex_);
+  return filterKnown_ && filterVersion_ == version;
+}
+
+bool SocketWrapper::mightHave(const std::string& fileName) {
+  std::lock_guard<std::mutex> lock(filterMutex_);
+  return !filterKnown_ || filter_.mightContain(fileName);
+}
+
+void SocketWrapper::setPeerName(const std::string& name) {
+  std::lock_guard<std::mutex> lock(nameMutex_);
+  peerName_ = name;
+}
+
+std::string SocketWrapper::getPeerName() {
+  std::lock_guard<std::mutex> lock(nameMutex_);
+  return peerName_;
+}
+
+PeerState SocketWrapper::getState() const { return state_.load(); }
+
+std::string SocketWrapper::getStateName() const {
+  switch (getState()) {
+    case PeerState::LIVE:
+      return "live";
+    case PeerState::SUSPECT:
+      return "suspect";
+    default:
+      return "dead";
+  }
+}
+
+bool SocketWrapper::allowRequest() {
+  if (getState() != PeerState::DEAD) return true;
+  // half open: the first caller after the probe time gets through
+  std::int64_t now = steadyNowMs();
+  std::int64_t nextProbe = nextProbeMs_.load();
+  return now >= nextProbe &&
+         nextProbeMs_.compare_exchange_strong(nextProbe,
+                                              now + DEAD_PROBE_INTERVAL_MS);
+}
+
+void SocketWrapper::markAlive() {
+  failures_ = 0;
+  if (state_.exchange(PeerState::LIVE) == PeerState::DEAD) {
+    std::cerr << ip_ << " is responding again." << std::endl;
+  }
+}
+
+void SocketWrapper::markFailure() {
+  int failures = ++failures_;
+  if (failures >= FAILURES_UNTIL_DEAD) {
+    if (state_.exchange(PeerState::DEAD) != PeerState::DEAD) {
+      nextProbeMs_ = steadyNowMs() + DEAD_PROBE_INTERVAL_MS;
+      std::cerr << ip_ << " is not responding, skipping it." << std::endl;
+    }
+  } else {
+    state_ = PeerState::SUSPECT;
+  }
+}
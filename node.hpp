@@ -4,44 +4,239 @@
 #include <jsoncpp/json/json.h>
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <zmq.hpp>
 #include <zmq_addon.hpp>
 
+#include "bloom_filter.hpp"
+#include "count_min_sketch.hpp"
+#include "delta_sync.hpp"
+#include "file_reader.hpp"
+#include "merkle_tree.hpp"
 #include "node_filesystem.hpp"
+#include "node_metrics.hpp"
+#include "request_scheduler.hpp"
+#include "request_trace.hpp"
+#include "serving_cache.hpp"
+#include "snapshot.hpp"
+#include "token_bucket.hpp"
+
+// LIVE answers, SUSPECT missed a heartbeat or request, DEAD missed several
+// in a row and is skipped until a probe gets through.
+enum class PeerState { LIVE, SUSPECT, DEAD };
 
 class SocketWrapper {
 public:
-    explicit SocketWrapper(zmq::socket_t* socket, std::string ip, int port);
+    explicit SocketWrapper(zmq::context_t& context, std::string ip, int port,
+                           std::string endpoint);
 
     ~SocketWrapper();
 
-    zmq::socket_t* getSocket() const;
-    
+    // closes every thread's socket, before the context is closed
+    void close();
+
     std::string getIp();
 
+    // endpoint the socket is connected to, e.g. "ipc:///tmp/sdfss-31416.ipc"
+    std::string getEndpoint() const;
+
+    // In-flight table. Many requests can be outstanding on the socket and
+    // replies are matched by request id in any order. Replies to requests
+    // that timed out or were cancelled are dropped when they turn up.
+    // A streamed request's reply comes in slices that are put back together
+    // here, and each slice restarts the wait's timeout.
+    // Every thread talks to the peer over its own socket and table, so a
+    // thread waiting on a slow reply never holds up another's requests. A
+    // request is awaited and cancelled by the thread that issued it.
+    void issue(const std::string& requestIdStr, const std::string& operation,
+               const std::string& fileName,
+               const std::vector<std::string>& args = {},
+               bool streamed = false);
+    bool awaitReply(const std::string& requestIdStr, int timeoutMs,
+                    std::vector<zmq::message_t>& reply);
+    // waits for whichever of requestIds is answered first
+    bool awaitAny(const std::set<std::string>& requestIds, int timeoutMs,
+                  std::string& requestIdStr,
+                  std::vector<zmq::message_t>& reply);
+    // waits for requestIdStr until deadlineMs at the latest, even while
+    // slices of it keep arriving
+    bool awaitUntil(const std::string& requestIdStr, std::int64_t deadlineMs,
+                    std::vector<zmq::message_t>& reply);
+    // Steady clock ms when requestIdStr was issued or last got a slice or
+    // BUSY, 0 once it is done. Only the issuing thread sees its requests.
+    std::int64_t getLastReceiveMs(const std::string& requestIdStr);
+    void cancel(const std::string& requestIdStr);
+    std::size_t getInFlight();
+    std::uint64_t getStaleReplies() const;
+    // A request the peer answered BUSY is sent again once the retry hint,
+    // grown with each BUSY and jittered, has passed. That happens inside
+    // the awaits, so callers only see the final reply, or an empty one
+    // after MAX_BUSY_RETRIES.
+    std::uint64_t getBusyReplies() const;
+
+    // Reply time estimates, kept the way TCP keeps its RTT: moving averages
+    // of the round trip of small replies, of the throughput of large ones
+    // and of how far replies stray from the estimate. elapsedUs is from
+    // issuing the request to the whole reply being in.
+    void recordReply(std::int64_t elapsedUs, std::uint64_t bytes);
+    // expected time for a reply of bytes, 0 while nothing was recorded
+    std::int64_t expectedUs(std::uint64_t bytes);
+    // how long a reply of bytes may take before a read is hedged, about the
+    // 95th percentile of reply times
+    std::int64_t hedgeDelayMs(std::uint64_t bytes);
+
+    // requests to this peer that got no reply within TIMEOUT_MS
+    void addTimeout();
+    std::uint64_t getTimeouts() const;
+
+    // Circuit breaker. Requests may go to LIVE and SUSPECT peers. A DEAD
+    // peer lets one request through every DEAD_PROBE_INTERVAL_MS, and the
+    // first reply closes the breaker again.
+    PeerState getState() const;
+    std::string getStateName() const;
+    bool allowRequest();
+    void markAlive();
+    void markFailure();
+
+    // Peer's file name filter, kept current by the heartbeat. Until one
+    // arrives every name might be on the peer.
+    void setFilter(std::uint64_t version, BloomFilter filter);
+    bool hasFilter(std::uint64_t version);
+    bool mightHave(const std::string& fileName);
+
+    // the name the peer gives itself in PONGs, empty until one arrived
+    void setPeerName(const std::string& name);
+    std::string getPeerName();
+
 private:
-    zmq::socket_t* socket_;
+    // a request as sent, kept until it is answered for BUSY retries
+    struct Sent {
+      std::vector<std::string> frames;  // operation, file name, id, args
+      bool streamed = false;
+      int busyReplies = 0;
+      std::int64_t retryAtMs = 0;  // 0 unless waiting to be sent again
+    };
+
+    // one thread's socket and in-flight table, only touched by that thread
+    struct Channel {
+      std::mutex inUse;  // held by the owning thread during each call
+      zmq::socket_t socket;
+      // request id -> steady clock ms of its last reply frames or its issue
+      std::map<std::string, std::int64_t> inFlight;
+      std::map<std::string, std::vector<zmq::message_t>> ready;
+      std::set<std::string> streamed;
+      std::map<std::string, std::vector<zmq::message_t>> partial;
+      std::map<std::string, Sent> sent;
+      std::atomic<std::size_t> inFlightCount{0};  // read by getInFlight
+    };
+
+    // the calling thread's channel, connected on first use
+    std::shared_ptr<Channel> channel();
+    // returns whether anything arrived for a request still in flight
+    bool receiveReady(Channel& channel);
+    void sendFrames(Channel& channel, const std::vector<std::string>& frames);
+    // sends the requests whose backoff is over, returns the ms until the
+    // next one is due or -1
+    std::int64_t resendDue(Channel& channel);
+
+    zmq::context_t& context_;
     std::string ip_;
+    std::string endpoint_;
+    std::mutex mutex_;  // channels_
+    std::map<std::thread::id, std::shared_ptr<Channel>> channels_;
+    std::atomic<std::uint64_t> staleReplies_{0};
+    std::atomic<std::uint64_t> busyReplies_{0};
+    std::mutex estimateMutex_;
+    double rttUs_ = 0;         // smoothed small reply time, 0 while unknown
+    double bytesPerUs_ = 0;    // smoothed throughput, 0 while unknown
+    double deviationUs_ = 0;   // smoothed distance from the estimate
+    std::atomic<std::uint64_t> timeouts_{0};
+    std::atomic<PeerState> state_{PeerState::LIVE};
+    std::atomic<int> failures_{0};
+    std::atomic<std::int64_t> nextProbeMs_{0};
+    std::mutex filterMutex_;
+    bool filterKnown_ = false;
+    std::uint64_t filterVersion_ = 0;
+    BloomFilter filter_;
+    std::mutex nameMutex_;
+    std::string peerName_;
 };
 
 class Node {
  public:
   // Construcotr, root dir to create the file system, target nodes <ip, port>
+  // A target ip may also be a full zmq endpoint such as "ipc:///tmp/node.ipc"
+  // or "inproc://node-2", in which case its port is ignored.
   Node(const std::filesystem::path& rootDir,
        const std::vector<std::pair<std::string, int>>& initialTargetNodes,
        const std::string ipAddress, int port);
+
+  // Shares a zmq context with other nodes in the same process. Such nodes
+  // also listen on inproc and reach each other without copying messages.
+  Node(const std::filesystem::path& rootDir,
+       const std::vector<std::pair<std::string, int>>& initialTargetNodes,
+       const std::string ipAddress, int port, zmq::context_t& sharedContext);
   ~Node();
 
   /* todo Add write functionality
    * SEND: Sends a copy file. Could be written or for reading
    * DELETE: Removes file
-   * LIST: Sends the {filename, metadata} vector
+   * LIST: Sends the {filename, metadata} vector, or one page of it when
+   *   given a prefix, cursor and page size
    * CREATE: Creates a file
+   * STATS: Sends the node's metrics in Prometheus text format
+   * TRACE: Sends the node's recorded spans as Chrome trace events
+   * PING: Heartbeat, answered with PONG and the node's filter version
+   * FILTER: Sends the Bloom filter of the node's file names
+   * MERKLE: Sends hashes or a bucket of the node's metadata Merkle tree
+   * DELTA: Sends copy/literal instructions that update an old copy of a file
+   * HOT: Sends the node's most read files
+   * PACK: Sends many small files packed into a few large frames
+   * STRIPE: Stores or sends one stripe of a file striped across nodes
+   * CANCEL: Stops a streamed reply the sender no longer wants
    */
-  enum class FileOperation { SEND, DELETE, LIST, CREATE, UPDATE, UPDATED };
+  enum class FileOperation {
+    SEND,
+    DELETE,
+    LIST,
+    CREATE,
+    UPDATE,
+    UPDATED,
+    STATS,
+    TRACE,
+    PING,
+    FILTER,
+    MERKLE,
+    DELTA,
+    HOT,
+    PACK,
+    STRIPE,
+    CANCEL
+  };
+
+  // Outbound file transfer limits in bytes per second, 0 for none. Each
+  // requester gets peerBytesPerSec within nodeBytesPerSec, and background
+  // transfers (replication) are also held to backgroundBytesPerSec so they
+  // cannot use up the node's budget. burstBytes is how much a budget can
+  // save up while idle.
+  struct BandwidthLimits {
+    std::uint64_t nodeBytesPerSec = 0;
+    std::uint64_t peerBytesPerSec = 0;
+    std::uint64_t backgroundBytesPerSec = 0;
+    std::uint64_t burstBytes = 0;
+  };
 
   // Function to initialize zmq sockets
   void initialize();
@@ -49,10 +244,34 @@ class Node {
   // Function to listen on server socket and handle incoming requests
   void handleRequests(std::atomic<bool>& runServer);
 
+  // Pings every peer on its own sockets and keeps their PeerState current.
+  // Runs until running is false, meant for its own thread.
+  void runHeartbeat(std::atomic<bool>& running);
+
+  // Reconciles otherFileMData with every peer's Merkle tree every
+  // ANTI_ENTROPY_INTERVAL_MS until running is false, meant for its own thread.
+  // It also runs the rounds UPDATE requests ask for, so a serving node must
+  // run it.
+  void runAntiEntropy(std::atomic<bool>& running);
+
+  // one reconciliation round with every reachable peer, true if every peer
+  // was reachable and reconciled
+  bool reconcilePeers();
+
+  // Every REPLICATION_INTERVAL_MS copies peers' hot files here and drops
+  // copies that went cold, until running is false. Meant for its own thread.
+  void runReplication(std::atomic<bool>& running);
+
   // Function to send file request messages to other nodes
   void sendRequest(FileOperation operation,
                    const std::string& fileName = "No File Name");
 
+  // call before handleRequests starts
+  void setBandwidthLimits(const BandwidthLimits& limits);
+
+  // how many received files, arriving within maxDelayMs, share one sync
+  void setCommitLimits(std::size_t maxBatch, int maxDelayMs);
+
   // Function to set target nodes
   void setTargetNodes(
       const std::vector<std::pair<std::string, int>>& newTargetNodes);
@@ -74,15 +293,227 @@ class Node {
   // reads file. If not on users node asks other nodes for file.
   void readFile(std::string fileName);
 
+  // Opens our file or our copy of it to be streamed, without asking peers.
+  // Reading it holds a few blocks in memory however large it is.
+  bool openFile(const std::string& fileName, FileReader& reader);
+
+  // fetches a file, or only its changed blocks if we have an older copy
   void getFile(std::string fileName);
 
- 
-  void listFiles();
+  // Gets several files, pipelining the requests to each peer. Small files
+  // are asked for in PACK requests, the rest one SEND each. Background
+  // fetches are sent under the peers' background bandwidth budget.
+  void getFiles(const std::vector<std::string>& fileNames,
+                bool background = false);
+
+  // Stripes files of this node across it and every reachable peer so they
+  // are read from all of them at once. With no names, every file of at
+  // least STRIPE_THRESHOLD bytes is striped.
+  void stripeFiles(const std::vector<std::string>& fileNames = {});
+
+  // Lists files whose name starts with prefix. Peers' files are printed a
+  // page at a time as they arrive.
+  void listFiles(const std::string& prefix = "");
 
   void refresh();
 
   void update();
+
+  // metrics as Prometheus text or a short human readable summary
+  std::string getStats(bool prometheus);
+
+  // "ip:port" this node is bound to
+  std::string getNodeName();
+
+  // For simulation: delays every incoming request by latencyMs and drops a
+  // lossRate fraction of them without a reply. Delayed requests wait side by
+  // side, so the handler keeps serving those that are due.
+  void setFaultInjection(int latencyMs, double lossRate);
+
+  // Writes recorded spans as a Chrome/Perfetto trace. With includePeers the
+  // spans of every reachable peer are merged into the same file.
+  bool dumpTrace(const std::string& path, bool includePeers);
+
+  // request ids travel as 16 hex digits
+  static std::string formatRequestId(std::uint64_t requestId);
+  static std::uint64_t parseRequestId(const std::string& requestIdStr);
+
+  static std::string operationToString(FileOperation operation);
+
  private:
+  Node(const std::filesystem::path& rootDir,
+       const std::vector<std::pair<std::string, int>>& initialTargetNodes,
+       const std::string ipAddress, int port, zmq::context_t* sharedContext);
+
+  // a streamed SEND, sent a slice at a time between other requests
+  struct SendJob {
+    std::string identity;
+    std::string requestIdStr;
+    FileReader file;
+    // served from memory instead of file when set
+    std::shared_ptr<const std::string> content;
+    std::size_t contentPos = 0;
+    std::uintmax_t bytesLeft = 0;
+    bool background = false;
+    bool packed = false;  // a PACK reply, sent as one frame per slice
+    // a SEND from an older requester, answered by one reply without slice
+    // flags: chunks are read a slice per turn and sent after the last
+    bool legacy = false;
+    std::vector<zmq::message_t> frames;
+    int slices = 0;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration diskTime{0}, sendTime{0};
+    std::unique_ptr<RequestTrace::Scope> span;
+  };
+
+  RequestClass classifyRequest(const std::vector<zmq::message_t>& request);
+  // a DELTA reply computed on a worker, sent by the handler once ready
+  struct DeltaReply {
+    std::string identity;
+    std::string requestIdStr;
+    std::vector<std::string> frames;  // after the request id
+  };
+  void startDeltaJob(const std::string& identity,
+                     const std::string& requestIdStr,
+                     const std::string& fileName, std::size_t blockSize,
+                     std::vector<DeltaSync::BlockSignature> basis);
+  // sends the replies of finished DELTAs, returns how many still run
+  std::size_t sendFinishedDeltas();
+  // a reply held until the request's write is committed, so the handler
+  // never waits out a group commit
+  struct CommitReply {
+    std::string identity;
+    std::string requestIdStr;
+    std::uint64_t ticket;
+    // runs on the handler once the write is done, returns the reply
+    std::function<std::string(bool committed)> finish;
+  };
+  // sends the replies whose writes are done, returns how many still wait
+  std::size_t sendCommittedReplies();
+  // Turns request away with a BUSY reply when its class's queue is full,
+  // streams are at MAX_SEND_JOBS or its sender has MAX_CLIENT_REQUESTS
+  // queued and streaming. Heartbeats and cancels always get in.
+  bool admitRequest(const std::vector<zmq::message_t>& request,
+                    std::size_t queued, std::int64_t retryAfterMs);
+  // one of the sender's requests was answered or its stream ended
+  void releaseClient(const std::string& identity);
+  void handleRequest(std::vector<zmq::message_t>& recv_msgs);
+  // myFileMdata as the JSON of a LIST or UPDATED reply
+  std::shared_ptr<const std::string> encodedMetadata(
+      const std::string& requestIdStr);
+  // handle of fileName or, failing that, of our copy of it
+  std::shared_ptr<FileHandle> lookupServed(
+      const std::string& fileName, std::shared_ptr<const std::string>& content);
+  // Points job at what a SEND of fileName serves, false if we have neither
+  // the file nor a copy. Counts the read for hot file tracking.
+  bool openForSend(const std::string& fileName, SendJob& job);
+  zmq::message_t readChunk(SendJob& job, std::size_t chunkSize);
+  std::unique_ptr<SendJob> newSendJob(const std::string& identity,
+                                      const std::string& requestIdStr,
+                                      const std::string& operation,
+                                      const std::string& detail,
+                                      bool background);
+  // sends the first slice of job, or a not found reply unless found
+  void runSendJob(std::unique_ptr<SendJob> job, bool found);
+  void startSendJob(const std::string& identity,
+                    const std::string& requestIdStr,
+                    const std::string& fileName, bool background,
+                    bool legacy = false);
+  void startStripeJob(const std::string& identity,
+                      const std::string& requestIdStr,
+                      const std::string& fileName, std::uint64_t index,
+                      std::uint64_t stripeSize, bool background);
+  // packs the small ones of fileNames and sends them like a streamed SEND
+  void startPackJob(const std::string& identity,
+                    const std::string& requestIdStr,
+                    const std::vector<std::string>& fileNames,
+                    bool background);
+  // forgets requesters that have been idle long enough to refill
+  void prunePeerBuckets();
+  // bytes the job may send now, or false and how long until it may
+  bool sliceBudget(const SendJob& job, std::uintmax_t& bytes,
+                   std::int64_t& waitMs);
+  bool sendSlice(SendJob& job);
+
+  bool isLocalAddress(const std::string& ip) const;
+  std::string resolveEndpoint(const std::string& ip, int port) const;
+
+  // Fetches a peer's files starting with prefix page by page, calling onPage
+  // for each. Returns false if the peer stopped answering.
+  bool listPeerFiles(
+      SocketWrapper& wrapper, const std::string& prefix,
+      const std::function<void(
+          const std::map<std::string, NodeFileSystem::fileMetadata>&)>& onPage);
+
+  // keep fileFilter_ and merkle_ in step with myFileMdata. indexFile is
+  // called after an entry was added or changed, unindexFile after removal.
+  void rebuildIndexes();
+  void indexFile(const std::string& fileName);
+  void unindexFile(const std::string& fileName);
+
+  void replicateHotFiles();
+
+  bool fetchMerkle(SocketWrapper& wrapper,
+                   const std::vector<std::pair<int, std::size_t>>& nodes,
+                   std::vector<std::string>& replies);
+  bool reconcilePeer(std::size_t peerIndex);
+
+  bool syncFile(const std::string& fileName);
+
+  bool fetchHedged(const std::string& fileName);
+  void cancelRequest(SocketWrapper& wrapper, const std::string& requestIdStr);
+
+  // a received file staged with the group commit, its metadata is added
+  // once it is durable
+  struct PendingWrite {
+    std::uint64_t ticket;
+    std::string fileName;  // as asked for, without "copyof"
+    NodeFileSystem::fileMetadata metadata;
+  };
+  // stages a received copy of fileName made of parts, false on failure
+  bool stageReceivedFile(const std::string& fileName,
+                         const std::string& storedIpAddress,
+                         const std::vector<std::string_view>& parts,
+                         std::vector<PendingWrite>& writes);
+  // records a write staged under ticket, false if ticket is 0
+  bool addPendingWrite(std::uint64_t ticket, const std::string& fileName,
+                       const std::string& storedIpAddress,
+                       std::uintmax_t fileSize,
+                       std::vector<PendingWrite>& writes);
+  // Waits for writes to be committed and records the files. Those that
+  // failed are removed from received when given. True if all committed.
+  bool commitWrites(std::vector<PendingWrite>& writes,
+                    std::set<std::string>* received = nullptr);
+  bool saveReceivedFile(const std::string& fileName, SocketWrapper& wrapper,
+                        std::vector<zmq::message_t>& recv_msgs,
+                        std::uint64_t requestId,
+                        std::vector<PendingWrite>& writes);
+  // Fetches fileNames from wrapper in PACK requests and stages what comes
+  // back in writes. Names the peer did not pack are added to bySend.
+  // Returns false if the peer stopped answering.
+  bool fetchPacked(SocketWrapper& wrapper,
+                   const std::vector<std::string>& fileNames, bool background,
+                   std::set<std::string>& received,
+                   std::vector<std::string>& bySend,
+                   std::vector<PendingWrite>& writes);
+
+  bool putStripes(SocketWrapper& wrapper, const std::string& fileName,
+                  const std::shared_ptr<FileHandle>& handle,
+                  std::uint64_t first, std::uint64_t step);
+  bool stripedMetadata(const std::string& fileName,
+                       NodeFileSystem::fileMetadata& metadata);
+  bool fetchStriped(const std::string& fileName,
+                    const NodeFileSystem::fileMetadata& metadata);
+  void getStripes(SocketWrapper& wrapper, const std::string& fileName,
+                  const NodeFileSystem::fileMetadata& metadata,
+                  const std::vector<std::uint64_t>& indexes,
+                  std::uint64_t ticket, std::vector<std::uint64_t>& failed);
+  void applyStripeMaps(
+      std::map<std::string, NodeFileSystem::fileMetadata>& fileMdata);
+  void saveStripeMaps();
+  // deletes the stripes we keep that no map deals to us any more
+  void sweepStripes();
+
   NodeFileSystem fileSystem_;
 
   std::filesystem::path rootDir_;
@@ -92,8 +523,10 @@ class Node {
   std::string mode_;
 
   int port_;
-  // context
-  zmq::context_t context_;
+  // context, owned unless the node was given a shared one
+  bool sharedContext_;
+  std::unique_ptr<zmq::context_t> ownedContext_;
+  zmq::context_t* context_;
   // Accepts requests for file, returning file conent
   std::vector<std::unique_ptr<SocketWrapper>> clientSockets_;
   // Requests file, accepts file content
@@ -101,8 +534,69 @@ class Node {
 
   std::vector<std::pair<std::string, int>> targetNodes_;
 
-  std::map<std::string, NodeFileSystem::fileMetadata> myFileMdata,
-      otherFileMData;
+  // read by the handler while the CLI, replication and anti-entropy threads
+  // change it, so readers take a snapshot and writers publish a new one
+  Snapshot<std::map<std::string, NodeFileSystem::fileMetadata>> myFileMdata;
+  // the last LIST reply and the metadata version it was encoded from, only
+  // touched by the request handler
+  std::shared_ptr<const std::string> encodedMetadata_;
+  std::uint64_t encodedVersion_ = 0;
+  std::map<std::string, NodeFileSystem::fileMetadata> otherFileMData;
+  // otherFileMData is written by the handler and anti-entropy threads too
+  std::mutex otherMutex_;
+
+  NodeMetrics metrics_;
+
+  // handles and small hot files' contents for SEND, invalidated whenever
+  // we write or delete a file under rootDir_
+  ServingCache servingCache_;
+
+  // bulk transfers in progress and their budgets, only touched by the
+  // request handler
+  std::deque<std::unique_ptr<SendJob>> sendJobs_;
+  TokenBucket nodeBucket_;
+  TokenBucket backgroundBucket_;
+  std::uint64_t peerBytesPerSec_ = 0;
+  std::uint64_t bucketBurst_ = 0;
+  std::map<std::string, TokenBucket> peerBuckets_;  // by requester identity
+  // requests queued or streaming per requester identity, for admitRequest
+  std::map<std::string, std::size_t> clientLoad_;
+
+  std::atomic<std::uint64_t> nextRequestId_;
+
+  // identifies this node's spans in trace files
+  int tracePid_;
+
+  // names in myFileMdata, the version changes whenever the filter does
+  std::mutex indexMutex_;  // fileFilter_ and merkle_
+  BloomFilter fileFilter_;
+  std::atomic<std::uint64_t> filterVersion_;
+  MerkleTree merkle_;
+
+  // what we last saw of each peer's tree, parallel to clientSockets_
+  std::mutex mirrorMutex_;
+  std::vector<MerkleTree> peerTrees_;
+  std::atomic<bool> reconcileRequested_{false};
+
+  // reads served per file, decayed every REPLICATION_INTERVAL_MS
+  CountMinSketch readSketch_;
+  std::mutex hotMutex_;
+  std::map<std::string, std::uint32_t> hotFiles_;  // name -> recent reads
+  // copies made because a peer reported them hot -> last time it did,
+  // only touched by the replication thread
+  std::map<std::string, std::int64_t> hotReplicas_;
+
+  std::atomic<int> faultLatencyMs_{0};
+  std::atomic<double> faultLossRate_{0};
+
+  // peers' trace events gathered by sendRequest(TRACE)
+  std::string collectedTraceEvents_;
+
+  // only touched by the request handler
+  std::deque<CommitReply> commitReplies_;
+  // DELTAs being computed, only touched by the request handler. Last so
+  // they are waited for before anything they use is destroyed.
+  std::deque<std::future<DeltaReply>> deltaJobs_;
 };
 
 #endif  // NODE_H
\ No newline at end of file
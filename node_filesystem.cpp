@@ -1,9 +1,11 @@
 #include "node_filesystem.hpp"
 
 #include <chrono>
+#include <cstdio>
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 
 // helper functions to conver filetime to string form
@@ -34,7 +36,7 @@ std::string fileTimeToISOString(
 
 // Creates root dir if doesnt exist
 NodeFileSystem::NodeFileSystem(const std::filesystem::path& rootDir)
-    : rootDir_(rootDir) {
+    : rootDir_(rootDir), commit_(std::make_shared<GroupCommit>()) {
   if (!std::filesystem::exists(rootDir_)) {
     std::filesystem::create_directory(rootDir_);
     std::cout << "Created directory at " << rootDir_ << std::endl;
@@ -42,8 +44,13 @@ NodeFileSystem::NodeFileSystem(const std::filesystem::path& rootDir)
     std::cout << "Directory at " << rootDir_ << " already exists." << std::endl;
   }
 
+  // writes a crash interrupted before their commit
+  GroupCommit::removeTemporaries(rootDir_);
+
   std::map<std::string, NodeFileSystem::fileMetadata> tempMap;
   for (const auto& entry : std::filesystem::directory_iterator(rootDir_)) {
+    // e.g. the stripes other nodes keep here
+    if (!entry.is_regular_file()) continue;
     NodeFileSystem::fileMetadata tempMd;
     tempMd.fileSize = file_size(entry);
     tempMd.lastModified = fileTimeToISOString(last_write_time(entry));
@@ -56,18 +63,45 @@ NodeFileSystem::NodeFileSystem(const std::filesystem::path& rootDir)
   // }
 }
 
+std::string NodeFileSystem::metadataToJsonString(
+    const std::map<std::string, NodeFileSystem::fileMetadata>& fileMdata) {
+  Json::Value jsonMap(Json::objectValue);
+  for (const auto& [filename, metadata] : fileMdata) {
+    jsonMap[filename] = metadata.toJson();
+  }
+  // serialize JSON to string
+  Json::StreamWriterBuilder builder;
+  return Json::writeString(builder, jsonMap);
+}
+
+std::map<std::string, NodeFileSystem::fileMetadata>
+NodeFileSystem::metadataFromJsonString(const std::string& jsonString) {
+  Json::CharReaderBuilder builder;
+  Json::Value jsonMap;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string errors;
+  if (!reader->parse(jsonString.c_str(),
+                     jsonString.c_str() + jsonString.size(), &jsonMap,
+                     &errors)) {
+    std::cerr << "Failed to parse JSON: " << errors << std::endl;
+    // todo error handling
+  }
+  std::map<std::string, NodeFileSystem::fileMetadata> fileMdata;
+  for (const auto& key : jsonMap.getMemberNames()) {
+    fileMdata[key] = NodeFileSystem::fileMetadata::fromJson(jsonMap[key]);
+  }
+  return fileMdata;
+}
+
 // Creates file from filename returns file metadata
 NodeFileSystem::fileMetadata NodeFileSystem::createFile(
     const std::string& fileName) {
-  std::ofstream file(rootDir_ / fileName);
-  if (file.is_open()) {
-    file.close();
+  if (waitWrite(stageWrite(fileName, "", 0))) {
     std::cout << "File \"" << fileName << "\" created successfully.\n";
     NodeFileSystem::fileMetadata tempMd;
     tempMd.lastModified =
         fileTimeToISOString(last_write_time(rootDir_ / fileName));
     tempMd.fileSize = file_size(rootDir_ / fileName);
-    fileMData[fileName] = tempMd;
     return tempMd;
   } else {
     std::cerr << "Failed to create the file \"" << fileName << "\".\n";
@@ -78,16 +112,25 @@ NodeFileSystem::fileMetadata NodeFileSystem::createFile(
 
 // Reads file as string
 void NodeFileSystem::readFile(const std::string& fileName) {
-  std::ifstream file(rootDir_ / fileName);
-  std::string content((std::istreambuf_iterator<char>(file)),
-                      std::istreambuf_iterator<char>());
-  if (file.is_open()) {
-    std::cout << "Contents of \"" << fileName << "\":\n"
-              << content << std::endl;
-    file.close();
-  } else {
+  FileReader reader;
+  if (!openFile(fileName, reader)) {
     std::cerr << "Failed to read the file \"" << fileName << "\".\n";
+    return;
   }
+  std::cout << "Contents of \"" << fileName << "\":\n";
+  // the file goes to stdout's descriptor directly, so what was printed
+  // through the streams has to be out first
+  std::cout.flush();
+  std::fflush(stdout);
+  std::uintmax_t written = reader.sendTo(fileno(stdout));
+  std::cout << std::endl;
+  if (written != reader.size()) {
+    std::cerr << "Failed to read the file \"" << fileName << "\".\n";
+  }
+}
+
+bool NodeFileSystem::openFile(const std::string& fileName, FileReader& reader) {
+  return reader.open(rootDir_ / fileName);
 }
 
 std::string NodeFileSystem::deleteFile(const std::string& fileName) {
@@ -126,7 +169,6 @@ NodeFileSystem::fileMetadata NodeFileSystem::getFileMetaData(
     tempMd.lastModified =
         fileTimeToISOString(last_write_time(rootDir_ / fileName));
     tempMd.fileSize = file_size(rootDir_ / fileName);
-    fileMData[fileName] = tempMd;
     return tempMd;
   } else {
     std::cerr << "Failed to get file metadata of \"" << fileName << "\".\n";
@@ -135,3 +177,42 @@ NodeFileSystem::fileMetadata NodeFileSystem::getFileMetaData(
     return tempMd;
   }
 }
+
+std::uint64_t NodeFileSystem::stageWrite(const std::string& fileName,
+                                         const char* data, std::size_t size) {
+  return commit_->stage(rootDir_ / fileName, data, size);
+}
+
+std::uint64_t NodeFileSystem::stageWrite(
+    const std::string& fileName, const std::vector<std::string_view>& parts) {
+  return commit_->stage(rootDir_ / fileName, parts);
+}
+
+bool NodeFileSystem::waitWrite(std::uint64_t ticket) {
+  return commit_->wait(ticket);
+}
+
+bool NodeFileSystem::pollWrite(std::uint64_t ticket, bool& committed) {
+  return commit_->poll(ticket, committed);
+}
+
+std::uint64_t NodeFileSystem::createWrite(const std::string& fileName) {
+  return commit_->create(rootDir_ / fileName);
+}
+
+bool NodeFileSystem::writeAt(std::uint64_t ticket, const char* data,
+                             std::size_t size, std::uint64_t offset) {
+  return commit_->writeAt(ticket, data, size, offset);
+}
+
+std::uint64_t NodeFileSystem::stageCreated(std::uint64_t ticket) {
+  return commit_->stage(ticket);
+}
+
+void NodeFileSystem::discardWrite(std::uint64_t ticket) {
+  commit_->discard(ticket);
+}
+
+void NodeFileSystem::setCommitLimits(std::size_t maxBatch, int maxDelayMs) {
+  commit_->setLimits(maxBatch, maxDelayMs);
+}
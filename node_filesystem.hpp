@@ -3,11 +3,21 @@
 
 #include <jsoncpp/json/json.h>
 
+#include <cstdint>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "file_reader.hpp"
+#include "group_commit.hpp"
+
+// converts a filesystem timestamp to "YYYY-MM-DDTHH:MM:SSZ"
+std::string fileTimeToISOString(
+    const std::filesystem::file_time_type& fileTime);
+
 class NodeFileSystem {
  public:
   // creates root dir one doesnt exist
@@ -18,6 +28,10 @@ class NodeFileSystem {
     std::string storedIpAddress;
     std::uintmax_t fileSize;
     std::string lastModified;
+    // Striped files only: stripe i, of stripeSize bytes, is also held by
+    // stripeHolders[i % stripeHolders.size()]. The owner has the whole file.
+    std::uint64_t stripeSize = 0;
+    std::vector<std::string> stripeHolders;
 
     // refactor code to use this
     Json::Value toJson() const {
@@ -25,6 +39,12 @@ class NodeFileSystem {
       val["storedIpAddress"] = storedIpAddress;
       val["fileSize"] = Json::UInt64(fileSize);
       val["lastModified"] = lastModified;
+      if (stripeSize > 0) {
+        val["stripeSize"] = Json::UInt64(stripeSize);
+        Json::Value holders(Json::arrayValue);
+        for (const auto& holder : stripeHolders) holders.append(holder);
+        val["stripeHolders"] = holders;
+      }
       return val;
     }
 
@@ -34,21 +54,61 @@ class NodeFileSystem {
       metadata.storedIpAddress = val["storedIpAddress"].asString();
       metadata.fileSize = val["fileSize"].asUInt64();
       metadata.lastModified = val["lastModified"].asString();
+      metadata.stripeSize = val["stripeSize"].asUInt64();
+      for (const auto& holder : val["stripeHolders"]) {
+        metadata.stripeHolders.push_back(holder.asString());
+      }
       return metadata;
     }
   };
 
+  // LIST/UPDATED wire format: {filename: metadata} as a JSON string
+  static std::string metadataToJsonString(
+      const std::map<std::string, fileMetadata>& fileMdata);
+  static std::map<std::string, fileMetadata> metadataFromJsonString(
+      const std::string& jsonString);
+
   NodeFileSystem::fileMetadata createFile(const std::string& fileName);
+  // prints fileName to stdout a block at a time, however large it is
   void readFile(const std::string& fileName);
+  // Opens fileName to be streamed with FileReader's read, readView or
+  // sendTo, which hold at most a few blocks in memory. False if it cannot
+  // be opened.
+  bool openFile(const std::string& fileName, FileReader& reader);
   void getFile(const std::string& fileName);
   std::string deleteFile(const std::string& fileName);
   std::vector<std::string> listFiles();
+  // the files found when this was constructed
   std::map<std::string, NodeFileSystem::fileMetadata> getFilesMetadata();
+  // Metadata of fileName as it is on disk now. Like createFile it is only
+  // returned, callers publish it through their own snapshot, so any thread
+  // may call it.
   NodeFileSystem::fileMetadata getFileMetaData(std::string fileName);
 
+  // Durable writes through the group commit: stageWrite returns a ticket
+  // (0 on failure) that waitWrite blocks on until fileName is in place.
+  std::uint64_t stageWrite(const std::string& fileName, const char* data,
+                           std::size_t size);
+  std::uint64_t stageWrite(const std::string& fileName,
+                           const std::vector<std::string_view>& parts);
+  bool waitWrite(std::uint64_t ticket);
+  // false while ticket is not committed yet, see GroupCommit::poll
+  bool pollWrite(std::uint64_t ticket, bool& committed);
+  // fileName written in pieces at offsets, see GroupCommit::create
+  std::uint64_t createWrite(const std::string& fileName);
+  bool writeAt(std::uint64_t ticket, const char* data, std::size_t size,
+               std::uint64_t offset);
+  std::uint64_t stageCreated(std::uint64_t ticket);
+  void discardWrite(std::uint64_t ticket);
+  // at most maxBatch files, collected over at most maxDelayMs, per sync
+  void setCommitLimits(std::size_t maxBatch, int maxDelayMs);
+
  private:
   std::filesystem::path rootDir_;
+  // filled by the constructor only, so readers need no lock
   std::map<std::string, NodeFileSystem::fileMetadata> fileMData;
+  // shared so the file system stays copyable
+  std::shared_ptr<GroupCommit> commit_;
 };
 
 #endif  // NODEFILESYSTEM_H
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include "node_metrics.hpp"
+
+#include <fmt/core.h>
+
+const std::vector<std::string> NodeMetrics::OPCODES = {
+    "SEND", "DELETE", "LIST", "CREATE", "UPDATE", "UPDATED", "STATS", "TRACE",
+    "PING", "FILTER", "MERKLE", "DELTA", "HOT", "PACK", "STRIPE",
+    "CANCEL", "OTHER"};
+
+// histogram buckets exported to Prometheus, in microseconds
+const std::vector<std::uint64_t> PROMETHEUS_BUCKETS = {
+    50,     100,    250,     500,     1000,    2500,    5000,
+    10000,  25000,  50000,   100000,  250000,  500000,  1000000,
+    2500000, 5000000, 10000000};
+
+std::size_t NodeMetrics::opcodeIndex(const std::string& operation) {
+  for (std::size_t i = 0; i + 1 < OPCODES.size(); i++) {
+    if (OPCODES[i] == operation) return i;
+  }
+  return OPCODES.size() - 1;
+}
+
+const char* NodeMetrics::phaseName(Phase phase) {
+  switch (phase) {
+    case Phase::REQUEST:
+      return "request";
+    case Phase::DISK_READ:
+      return "disk_read";
+    case Phase::SERIALIZE:
+      return "serialize";
+    case Phase::SEND:
+      return "send";
+    default:
+      return "unknown";
+  }
+}
+
+void NodeMetrics::countRequest(const std::string& operation) {
+  requests_[opcodeIndex(operation)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeMetrics::addBytesIn(std::uint64_t bytes) {
+  bytesIn_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void NodeMetrics::addBytesOut(std::uint64_t bytes) {
+  bytesOut_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void NodeMetrics::countFilterSkip() {
+  filterSkips_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeMetrics::countSendCache(bool hit) {
+  (hit ? sendCacheHits_ : sendCacheMisses_)
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeMetrics::countHedge(bool won) {
+  hedges_.fetch_add(1, std::memory_order_relaxed);
+  if (won) hedgeWins_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeMetrics::countBusy() {
+  busy_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeMetrics::setReplication(std::uint64_t hotFiles,
+                                 std::uint64_t hotReplicas) {
+  hotFiles_.store(hotFiles, std::memory_order_relaxed);
+  hotReplicas_.store(hotReplicas, std::memory_order_relaxed);
+}
+
+void NodeMetrics::setQueueDepth(std::uint64_t depth) {
+  queueDepth_.store(depth, std::memory_order_relaxed);
+}
+
+void NodeMetrics::recordLatency(Phase phase,
+                                std::chrono::steady_clock::duration elapsed) {
+  latency_[static_cast<std::size_t>(phase)].record(
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+std::string NodeMetrics::toPrometheus(
+    const std::vector<PeerStats>& peers) const {
+  std::string out;
+  out += "# HELP sdfss_requests_total Requests handled, by opcode.\n";
+  out += "# TYPE sdfss_requests_total counter\n";
+  for (std::size_t i = 0; i < OPCODES.size(); i++) {
+    out += fmt::format("sdfss_requests_total{{op=\"{}\"}} {}\n", OPCODES[i],
+                       requests_[i].load(std::memory_order_relaxed));
+  }
+  out += "# HELP sdfss_bytes_in_total Payload bytes received.\n";
+  out += "# TYPE sdfss_bytes_in_total counter\n";
+  out += fmt::format("sdfss_bytes_in_total {}\n", bytesIn_.load());
+  out += "# HELP sdfss_bytes_out_total Payload bytes sent.\n";
+  out += "# TYPE sdfss_bytes_out_total counter\n";
+  out += fmt::format("sdfss_bytes_out_total {}\n", bytesOut_.load());
+  out += "# HELP sdfss_queue_depth Requests waiting in the handler.\n";
+  out += "# TYPE sdfss_queue_depth gauge\n";
+  out += fmt::format("sdfss_queue_depth {}\n", queueDepth_.load());
+  out += "# HELP sdfss_filter_skips_total Peers not asked for a file because "
+         "their filter ruled it out.\n";
+  out += "# TYPE sdfss_filter_skips_total counter\n";
+  out += fmt::format("sdfss_filter_skips_total {}\n", filterSkips_.load());
+  out += "# HELP sdfss_busy_replies_total Requests turned away as BUSY.\n";
+  out += "# TYPE sdfss_busy_replies_total counter\n";
+  out += fmt::format("sdfss_busy_replies_total {}\n", busy_.load());
+  out += "# HELP sdfss_send_cache_hits_total SENDs served from memory.\n";
+  out += "# TYPE sdfss_send_cache_hits_total counter\n";
+  out += fmt::format("sdfss_send_cache_hits_total {}\n", sendCacheHits_.load());
+  out += "# HELP sdfss_send_cache_misses_total SENDs read from disk.\n";
+  out += "# TYPE sdfss_send_cache_misses_total counter\n";
+  out += fmt::format("sdfss_send_cache_misses_total {}\n",
+                     sendCacheMisses_.load());
+  out += "# HELP sdfss_hedged_reads_total Reads also asked of a second "
+         "replica.\n";
+  out += "# TYPE sdfss_hedged_reads_total counter\n";
+  out += fmt::format("sdfss_hedged_reads_total {}\n", hedges_.load());
+  out += "# HELP sdfss_hedge_wins_total Hedged reads the second replica "
+         "answered first.\n";
+  out += "# TYPE sdfss_hedge_wins_total counter\n";
+  out += fmt::format("sdfss_hedge_wins_total {}\n", hedgeWins_.load());
+  out += "# HELP sdfss_hot_files Files of ours read often enough to be hot.\n";
+  out += "# TYPE sdfss_hot_files gauge\n";
+  out += fmt::format("sdfss_hot_files {}\n", hotFiles_.load());
+  out += "# HELP sdfss_hot_replicas Copies held of peers' hot files.\n";
+  out += "# TYPE sdfss_hot_replicas gauge\n";
+  out += fmt::format("sdfss_hot_replicas {}\n", hotReplicas_.load());
+  out += "# HELP sdfss_peer_timeouts_total Requests to a peer that timed out.\n";
+  out += "# TYPE sdfss_peer_timeouts_total counter\n";
+  for (const auto& peer : peers) {
+    out += fmt::format("sdfss_peer_timeouts_total{{peer=\"{}\"}} {}\n",
+                       peer.peer, peer.timeouts);
+  }
+  out += "# HELP sdfss_peer_busy_total BUSY replies from a peer.\n";
+  out += "# TYPE sdfss_peer_busy_total counter\n";
+  for (const auto& peer : peers) {
+    out += fmt::format("sdfss_peer_busy_total{{peer=\"{}\"}} {}\n", peer.peer,
+                       peer.busy);
+  }
+  out += "# HELP sdfss_peer_up 1 live, 0.5 suspect, 0 dead.\n";
+  out += "# TYPE sdfss_peer_up gauge\n";
+  for (const auto& peer : peers) {
+    const char* up = peer.state == "live"      ? "1"
+                     : peer.state == "suspect" ? "0.5"
+                                               : "0";
+    out += fmt::format("sdfss_peer_up{{peer=\"{}\"}} {}\n", peer.peer, up);
+  }
+  out += "# HELP sdfss_peer_expected_microseconds Estimated time for a peer "
+         "to answer a small request.\n";
+  out += "# TYPE sdfss_peer_expected_microseconds gauge\n";
+  for (const auto& peer : peers) {
+    out += fmt::format("sdfss_peer_expected_microseconds{{peer=\"{}\"}} {}\n",
+                       peer.peer, peer.expectedUs);
+  }
+  out += "# HELP sdfss_latency_microseconds Time spent per phase.\n";
+  out += "# TYPE sdfss_latency_microseconds histogram\n";
+  for (std::size_t p = 0; p < latency_.size(); p++) {
+    const LatencyHistogram& histogram = latency_[p];
+    const char* phase = phaseName(static_cast<Phase>(p));
+    std::uint64_t cumulative = 0;
+    std::size_t bucket = 0;
+    for (std::uint64_t le : PROMETHEUS_BUCKETS) {
+      while (bucket < LatencyHistogram::NUM_BUCKETS &&
+             LatencyHistogram::bucketUpperBound(bucket) <= le) {
+        cumulative += histogram.bucketCount(bucket++);
+      }
+      out += fmt::format(
+          "sdfss_latency_microseconds_bucket{{phase=\"{}\",le=\"{}\"}} {}\n",
+          phase, le, cumulative);
+    }
+    out += fmt::format(
+        "sdfss_latency_microseconds_bucket{{phase=\"{}\",le=\"+Inf\"}} {}\n",
+        phase, histogram.count());
+    out += fmt::format("sdfss_latency_microseconds_sum{{phase=\"{}\"}} {}\n",
+                       phase, histogram.sum());
+    out += fmt::format("sdfss_latency_microseconds_count{{phase=\"{}\"}} {}\n",
+                       phase, histogram.count());
+  }
+  return out;
+}
+
+std::string NodeMetrics::toText(const std::vector<PeerStats>& peers) const {
+  std::string out = "Requests:";
+  for (std::size_t i = 0; i < OPCODES.size(); i++) {
+    out += fmt::format(" {}={}", OPCODES[i], requests_[i].load());
+  }
+  out += fmt::format(
+      "\nBytes in: {} Bytes out: {} Queue depth: {} Filter skips: {}\n"
+      "Hot files: {} Hot replicas: {} Send cache hits: {} misses: {}\n"
+      "Hedged reads: {} won by the hedge: {} Turned away as busy: {}\n",
+      bytesIn_.load(), bytesOut_.load(), queueDepth_.load(),
+      filterSkips_.load(), hotFiles_.load(), hotReplicas_.load(),
+      sendCacheHits_.load(), sendCacheMisses_.load(), hedges_.load(),
+      hedgeWins_.load(), busy_.load());
+  for (const auto& peer : peers) {
+    out += fmt::format("Peer {} is {}, {} timeouts, {} busy, ~{} us replies\n",
+                       peer.peer, peer.state, peer.timeouts, peer.busy,
+                       peer.expectedUs);
+  }
+  for (std::size_t p = 0; p < latency_.size(); p++) {
+    out += fmt::format("{:<10} {}\n", phaseName(static_cast<Phase>(p)),
+                       latency_[p].summary());
+  }
+  return out;
+}
@@ -0,0 +1,92 @@
+#ifndef NODEMETRICS_H
+#define NODEMETRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.hpp"
+
+// Counters and latency histograms for a node. Every update is a relaxed
+// atomic so the request handler and CLI threads can record without locking.
+class NodeMetrics {
+ public:
+  // opcodes with their own counter, anything else is counted as OTHER
+  static const std::vector<std::string> OPCODES;
+
+  enum class Phase { REQUEST, DISK_READ, SERIALIZE, SEND, COUNT };
+
+  // per peer values owned by the node's SocketWrappers
+  struct PeerStats {
+    std::string peer;
+    std::uint64_t timeouts;
+    std::string state;  // live, suspect or dead
+    std::int64_t expectedUs;  // estimated reply time, 0 while unknown
+    std::uint64_t busy;  // BUSY replies the peer sent us
+  };
+
+  void countRequest(const std::string& operation);
+  void addBytesIn(std::uint64_t bytes);
+  void addBytesOut(std::uint64_t bytes);
+  void setQueueDepth(std::uint64_t depth);
+  // a peer was not asked for a file because its filter ruled it out
+  void countFilterSkip();
+  // whether a SEND was served from cached contents or read from disk
+  void countSendCache(bool hit);
+  // a read that was also asked of a second replica, and whether the second
+  // one answered first
+  void countHedge(bool won);
+  // a request turned away with a BUSY reply
+  void countBusy();
+  // our hot files and the hot files of peers we hold copies of
+  void setReplication(std::uint64_t hotFiles, std::uint64_t hotReplicas);
+  void recordLatency(Phase phase, std::chrono::steady_clock::duration elapsed);
+
+  // Prometheus text exposition
+  std::string toPrometheus(const std::vector<PeerStats>& peers) const;
+
+  // short human readable version for the CLI
+  std::string toText(const std::vector<PeerStats>& peers) const;
+
+ private:
+  static std::size_t opcodeIndex(const std::string& operation);
+  static const char* phaseName(Phase phase);
+
+  static constexpr std::size_t MAX_OPCODES = 32;
+  std::array<std::atomic<std::uint64_t>, MAX_OPCODES> requests_{};
+  std::atomic<std::uint64_t> bytesIn_{0};
+  std::atomic<std::uint64_t> bytesOut_{0};
+  std::atomic<std::uint64_t> queueDepth_{0};
+  std::atomic<std::uint64_t> filterSkips_{0};
+  std::atomic<std::uint64_t> sendCacheHits_{0};
+  std::atomic<std::uint64_t> sendCacheMisses_{0};
+  std::atomic<std::uint64_t> hedges_{0};
+  std::atomic<std::uint64_t> hedgeWins_{0};
+  std::atomic<std::uint64_t> busy_{0};
+  std::atomic<std::uint64_t> hotFiles_{0};
+  std::atomic<std::uint64_t> hotReplicas_{0};
+  std::array<LatencyHistogram, static_cast<std::size_t>(Phase::COUNT)>
+      latency_;
+};
+
+// Records the time from construction to destruction into a phase.
+class ScopedLatency {
+ public:
+  ScopedLatency(NodeMetrics& metrics, NodeMetrics::Phase phase)
+      : metrics_(metrics),
+        phase_(phase),
+        start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    metrics_.recordLatency(phase_, std::chrono::steady_clock::now() - start_);
+  }
+
+ private:
+  NodeMetrics& metrics_;
+  NodeMetrics::Phase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif  // NODEMETRICS_H
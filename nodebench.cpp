@@ -0,0 +1,322 @@
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "delta_sync.hpp"
+#include "file_reader.hpp"
+#include "group_commit.hpp"
+#include "node_filesystem.hpp"
+#include "packed_files.hpp"
+
+// Micro benchmarks for the parts of a node that do not need networking.
+// Run with: ./nodebench --benchmark_filter=<regex>
+
+namespace {
+
+const std::filesystem::path BENCH_DIR =
+    std::filesystem::temp_directory_path() / "sdfss_bench";
+
+// directory filled with numFiles small files, created once per size
+std::filesystem::path benchDirectory(int numFiles) {
+  std::filesystem::path dir = BENCH_DIR / ("dir" + std::to_string(numFiles));
+  if (!std::filesystem::exists(dir)) {
+    std::filesystem::create_directories(dir);
+    for (int i = 0; i < numFiles; i++) {
+      std::ofstream file(dir / ("file" + std::to_string(i) + ".txt"));
+      file << "benchmark file " << i;
+    }
+  }
+  return dir;
+}
+
+// single file of fileSize bytes used by the chunk read benchmark
+std::filesystem::path benchFile(std::uintmax_t fileSize) {
+  std::filesystem::path path =
+      BENCH_DIR / ("chunk" + std::to_string(fileSize) + ".bin");
+  if (!std::filesystem::exists(path) ||
+      std::filesystem::file_size(path) != fileSize) {
+    std::filesystem::create_directories(BENCH_DIR);
+    std::ofstream file(path, std::ios::binary);
+    std::vector<char> block(1 << 20, 'x');
+    for (std::uintmax_t written = 0; written < fileSize;) {
+      std::uintmax_t n = std::min<std::uintmax_t>(block.size(), fileSize - written);
+      file.write(block.data(), n);
+      written += n;
+    }
+  }
+  return path;
+}
+
+std::map<std::string, NodeFileSystem::fileMetadata> makeMetadata(
+    int numEntries) {
+  std::map<std::string, NodeFileSystem::fileMetadata> fileMdata;
+  for (int i = 0; i < numEntries; i++) {
+    NodeFileSystem::fileMetadata metadata;
+    metadata.storedIpAddress = "192.168.0.10:31415";
+    metadata.fileSize = 1024 + i;
+    metadata.lastModified = "2024-01-01T00:00:00Z";
+    fileMdata["file" + std::to_string(i) + ".txt"] = metadata;
+  }
+  return fileMdata;
+}
+
+std::string randomBytes(std::size_t size) {
+  std::mt19937_64 rng(42);
+  std::string data(size, '\0');
+  for (auto& c : data) c = static_cast<char>(rng());
+  return data;
+}
+
+}  // namespace
+
+static void BM_NodeFileSystemConstruct(benchmark::State& state) {
+  std::filesystem::path dir = benchDirectory(state.range(0));
+  for (auto _ : state) {
+    NodeFileSystem fileSystem(dir);
+    benchmark::DoNotOptimize(fileSystem);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_NodeFileSystemConstruct)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_FileTimeToISOString(benchmark::State& state) {
+  std::filesystem::file_time_type fileTime =
+      std::filesystem::file_time_type::clock::now();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fileTimeToISOString(fileTime));
+  }
+}
+BENCHMARK(BM_FileTimeToISOString);
+
+static void BM_MetadataJsonRoundTrip(benchmark::State& state) {
+  NodeFileSystem::fileMetadata metadata;
+  metadata.storedIpAddress = "192.168.0.10:31415";
+  metadata.fileSize = 123456;
+  metadata.lastModified = "2024-01-01T00:00:00Z";
+  for (auto _ : state) {
+    Json::Value val = metadata.toJson();
+    benchmark::DoNotOptimize(NodeFileSystem::fileMetadata::fromJson(val));
+  }
+}
+BENCHMARK(BM_MetadataJsonRoundTrip);
+
+static void BM_ListJsonBuild(benchmark::State& state) {
+  auto fileMdata = makeMetadata(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(NodeFileSystem::metadataToJsonString(fileMdata));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ListJsonBuild)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_ListJsonParse(benchmark::State& state) {
+  std::string jsonString =
+      NodeFileSystem::metadataToJsonString(makeMetadata(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        NodeFileSystem::metadataFromJsonString(jsonString));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * jsonString.size());
+}
+BENCHMARK(BM_ListJsonParse)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+// The std::ifstream loop the SEND handler used before FileReader, minus the
+// socket. Arg is the chunk size.
+static void BM_ChunkRead(benchmark::State& state) {
+  const std::uintmax_t fileSize = 64 << 20;
+  std::filesystem::path path = benchFile(fileSize);
+  std::vector<char> buffer(state.range(0));
+  for (auto _ : state) {
+    std::ifstream file(path, std::ios::binary);
+    while (true) {
+      file.read(buffer.data(), buffer.size());
+      std::streamsize bytes_read = file.gcount();
+      benchmark::DoNotOptimize(bytes_read);
+      if (file.eof()) break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize);
+}
+BENCHMARK(BM_ChunkRead)
+    ->Arg(1024)
+    ->Arg(64 * 1024)
+    ->Arg(1024 * 1024)
+    ->Unit(benchmark::kMillisecond);
+
+// Same loop as the SEND handler, with read-ahead. Arg is the chunk size.
+static void BM_FileReaderRead(benchmark::State& state) {
+  const std::uintmax_t fileSize = 64 << 20;
+  std::filesystem::path path = benchFile(fileSize);
+  std::vector<char> buffer(state.range(0));
+  for (auto _ : state) {
+    FileReader file;
+    file.open(path);
+    while (true) {
+      std::size_t bytes_read = file.read(buffer.data(), buffer.size());
+      benchmark::DoNotOptimize(bytes_read);
+      if (bytes_read < buffer.size()) break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize);
+}
+BENCHMARK(BM_FileReaderRead)
+    ->Arg(1024)
+    ->Arg(64 * 1024)
+    ->Arg(1024 * 1024)
+    ->Unit(benchmark::kMillisecond);
+
+// A reader per request, as the handler opens one for each SEND. Arg is the
+// bytes read, past one block the reader reads ahead.
+static void BM_FileReaderOpen(benchmark::State& state) {
+  std::filesystem::path path = benchFile(64 << 20);
+  std::shared_ptr<FileHandle> handle = FileHandle::open(path);
+  for (auto _ : state) {
+    FileReader file;
+    file.open(handle, 0, state.range(0));
+    for (std::string_view view = file.readView(); !view.empty();
+         view = file.readView()) {
+      benchmark::DoNotOptimize(view.data());
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FileReaderOpen)->Arg(64 * 1024)->Arg(256 * 1024);
+
+// How the CLI read printed a file before: all of it into a string through
+// istreambuf_iterator, then out. Written to /dev/null here.
+static void BM_LocalReadString(benchmark::State& state) {
+  const std::uintmax_t fileSize = 64 << 20;
+  std::filesystem::path path = benchFile(fileSize);
+  std::ofstream out("/dev/null", std::ios::binary);
+  for (auto _ : state) {
+    std::ifstream file(path);
+    std::string content((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+    out << content;
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize);
+}
+BENCHMARK(BM_LocalReadString)->Unit(benchmark::kMillisecond);
+
+// The streaming read path, FileReader::sendTo to /dev/null.
+static void BM_LocalReadSendTo(benchmark::State& state) {
+  const std::uintmax_t fileSize = 64 << 20;
+  std::filesystem::path path = benchFile(fileSize);
+  int fd = ::open("/dev/null", O_WRONLY);
+  for (auto _ : state) {
+    FileReader file;
+    file.open(path);
+    benchmark::DoNotOptimize(file.sendTo(fd));
+  }
+  ::close(fd);
+  state.SetBytesProcessed(state.iterations() * fileSize);
+}
+BENCHMARK(BM_LocalReadSendTo)->Unit(benchmark::kMillisecond);
+
+static void BM_WeakChecksum(benchmark::State& state) {
+  std::string data = randomBytes(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        DeltaSync::weakChecksum(data.data(), data.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_WeakChecksum)->Arg(1024)->Arg(64 * 1024);
+
+static void BM_StrongHash(benchmark::State& state) {
+  std::string data = randomBytes(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DeltaSync::strongHash(data.data(), data.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_StrongHash)->Arg(1024)->Arg(64 * 1024);
+
+// Sender side of a delta sync of a 64 MB file after a few percent was
+// appended. Arg is the appended percentage.
+static void BM_ComputeDelta(benchmark::State& state) {
+  std::string newData = randomBytes(64 << 20);
+  std::string oldData =
+      newData.substr(0, newData.size() * (100 - state.range(0)) / 100);
+  std::size_t blockSize = DeltaSync::chooseBlockSize(oldData.size());
+  auto basis = DeltaSync::signatures(oldData, blockSize);
+  std::size_t deltaSize = 0;
+  for (auto _ : state) {
+    std::string delta = DeltaSync::computeDelta(newData, blockSize, basis);
+    deltaSize = delta.size();
+  }
+  state.SetBytesProcessed(state.iterations() * newData.size());
+  state.counters["delta_bytes"] = deltaSize;
+}
+BENCHMARK(BM_ComputeDelta)->Arg(1)->Arg(5)->Unit(benchmark::kMillisecond);
+
+// Packing and unpacking a PACK reply of small files, without the disk.
+// Arg is the file size.
+static void BM_PackedFilesRoundTrip(benchmark::State& state) {
+  const int numFiles = 256;
+  std::string data = randomBytes(state.range(0));
+  std::vector<PackedFiles::Entry> entries;
+  for (auto _ : state) {
+    std::string packed;
+    for (int i = 0; i < numFiles; i++) {
+      PackedFiles::append(packed, "file" + std::to_string(i) + ".txt",
+                          PackedFiles::Status::FOUND, data.data(), data.size());
+    }
+    entries.clear();
+    benchmark::DoNotOptimize(PackedFiles::parse(packed, entries));
+  }
+  state.SetItemsProcessed(state.iterations() * numFiles);
+}
+BENCHMARK(BM_PackedFilesRoundTrip)->Arg(100)->Arg(4096);
+
+// Writing 256 small files the way received files are written. Arg 0 is a
+// plain std::ofstream per file without any sync, otherwise Arg is the group
+// commit's batch size, so 1 syncs every file on its own.
+static void BM_ReceivedFileWrite(benchmark::State& state) {
+  const int numFiles = 256;
+  std::filesystem::path dir = BENCH_DIR / "writes";
+  std::filesystem::create_directories(dir);
+  std::string data = randomBytes(1024);
+  GroupCommit commit;
+  commit.setLimits(state.range(0), GroupCommit::DEFAULT_MAX_DELAY_MS);
+  for (auto _ : state) {
+    std::vector<std::uint64_t> tickets;
+    for (int i = 0; i < numFiles; i++) {
+      std::filesystem::path path = dir / ("file" + std::to_string(i));
+      if (state.range(0) == 0) {
+        std::ofstream file(path, std::ios::binary);
+        file.write(data.data(), data.size());
+      } else {
+        tickets.push_back(commit.stage(path, data.data(), data.size()));
+      }
+    }
+    for (std::uint64_t ticket : tickets) commit.wait(ticket);
+  }
+  state.SetItemsProcessed(state.iterations() * numFiles);
+}
+BENCHMARK(BM_ReceivedFileWrite)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(64)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
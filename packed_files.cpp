@@ -0,0 +1,65 @@
+#include "packed_files.hpp"
+
+namespace PackedFiles {
+
+namespace {
+
+void putUint(std::string& out, std::uint64_t value, int bytes) {
+  for (int byte = 0; byte < bytes; byte++) {
+    out.push_back(static_cast<char>((value >> (8 * byte)) & 0xff));
+  }
+}
+
+bool getUint(const std::string& in, std::size_t& pos, int bytes,
+             std::uint64_t& value) {
+  if (pos > in.size() || in.size() - pos < static_cast<std::size_t>(bytes)) {
+    return false;
+  }
+  value = 0;
+  for (int byte = 0; byte < bytes; byte++) {
+    value |= std::uint64_t(static_cast<unsigned char>(in[pos + byte]))
+             << (8 * byte);
+  }
+  pos += bytes;
+  return true;
+}
+
+}  // namespace
+
+void append(std::string& out, const std::string& name, Status status,
+            const char* data, std::uint64_t size) {
+  if (status != Status::FOUND) size = 0;
+  out.reserve(out.size() + 11 + name.size() + size);
+  putUint(out, name.size(), 2);
+  out += name;
+  putUint(out, static_cast<std::uint8_t>(status), 1);
+  putUint(out, size, 8);
+  if (size > 0) out.append(data, size);
+}
+
+bool parse(const std::string& packed, std::vector<Entry>& entries) {
+  std::size_t pos = 0;
+  while (pos < packed.size()) {
+    std::uint64_t nameLength, status, size;
+    if (!getUint(packed, pos, 2, nameLength) ||
+        packed.size() - pos < nameLength) {
+      return false;
+    }
+    Entry entry;
+    entry.name = packed.substr(pos, nameLength);
+    pos += nameLength;
+    if (!getUint(packed, pos, 1, status) ||
+        status > static_cast<std::uint8_t>(Status::DEFERRED) ||
+        !getUint(packed, pos, 8, size) || packed.size() - pos < size) {
+      return false;
+    }
+    entry.status = static_cast<Status>(status);
+    entry.data = packed.data() + pos;
+    entry.size = size;
+    pos += size;
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+}  // namespace PackedFiles
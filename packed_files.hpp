@@ -0,0 +1,37 @@
+#ifndef PACKEDFILES_H
+#define PACKEDFILES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Many small files in one buffer, each as a header and its contents, so a
+// directory of tiny files moves in a few large frames instead of a reply per
+// file. The header is the name length (u16), the name, a Status (u8) and the
+// data length (u64), all little endian.
+namespace PackedFiles {
+
+enum class Status : std::uint8_t {
+  FOUND = 0,
+  MISSING = 1,
+  TOO_LARGE = 2,  // ask for it with a SEND instead
+  DEFERRED = 3    // did not fit in this reply, ask again
+};
+
+struct Entry {
+  std::string name;
+  Status status;
+  const char* data;  // points into the packed buffer
+  std::uint64_t size;
+};
+
+// only FOUND entries carry data
+void append(std::string& out, const std::string& name, Status status,
+            const char* data = nullptr, std::uint64_t size = 0);
+// false if packed is truncated or malformed, entries then holds the ones
+// before the damage
+bool parse(const std::string& packed, std::vector<Entry>& entries);
+
+}  // namespace PackedFiles
+
+#endif  // PACKEDFILES_H
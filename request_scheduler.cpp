@@ -0,0 +1,20 @@
+#include "request_scheduler.hpp"
+
+WeightedScheduler::WeightedScheduler(
+    std::array<int, NUM_REQUEST_CLASSES> weights)
+    : weights_(weights), credits_(weights) {}
+
+RequestClass WeightedScheduler::next(
+    const std::array<bool, NUM_REQUEST_CLASSES>& hasWork) {
+  for (int round = 0; round < 2; round++) {
+    for (std::size_t c = 0; c < NUM_REQUEST_CLASSES; c++) {
+      if (hasWork[c] && credits_[c] > 0) {
+        credits_[c]--;
+        return static_cast<RequestClass>(c);
+      }
+    }
+    // every class with work used up its turns, start a new round
+    credits_ = weights_;
+  }
+  return RequestClass::COUNT;
+}
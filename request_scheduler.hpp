@@ -0,0 +1,30 @@
+#ifndef REQUESTSCHEDULER_H
+#define REQUESTSCHEDULER_H
+
+#include <array>
+#include <cstddef>
+
+// Control requests (LIST, PING, ...) come first, then reads of small files,
+// then bulk transfers, which are served a slice at a time.
+enum class RequestClass { CONTROL, INTERACTIVE, BULK, COUNT };
+
+const std::size_t NUM_REQUEST_CLASSES =
+    static_cast<std::size_t>(RequestClass::COUNT);
+
+// Weighted round robin over the request classes. Each round a class may be
+// picked as often as its weight, so bulk work still moves while control
+// traffic is heavy, and a lone class gets every turn.
+class WeightedScheduler {
+ public:
+  explicit WeightedScheduler(
+      std::array<int, NUM_REQUEST_CLASSES> weights = {8, 4, 1});
+
+  // the class to serve next among those with work, COUNT if none has any
+  RequestClass next(const std::array<bool, NUM_REQUEST_CLASSES>& hasWork);
+
+ private:
+  std::array<int, NUM_REQUEST_CLASSES> weights_;
+  std::array<int, NUM_REQUEST_CLASSES> credits_;
+};
+
+#endif  // REQUESTSCHEDULER_H
@@ -0,0 +1,154 @@
+#include "request_trace.hpp"
+
+#include <fmt/core.h>
+#include <jsoncpp/json/json.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RequestTrace {
+
+namespace {
+
+// The mutex is only contended while a dump copies the ring out.
+struct Ring {
+  std::mutex mutex;
+  std::vector<Span> spans = std::vector<Span>(RING_SIZE);
+  std::size_t next = 0;
+  std::size_t size = 0;
+  std::uint64_t tid = 0;
+};
+
+std::mutex registryMutex;
+std::vector<std::shared_ptr<Ring>> registry;
+
+Ring& threadRing() {
+  thread_local std::shared_ptr<Ring> ring = [] {
+    auto newRing = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    newRing->tid = registry.size() + 1;
+    registry.push_back(newRing);
+    return newRing;
+  }();
+  return *ring;
+}
+
+template <std::size_t N>
+void copyText(char (&dest)[N], const std::string& text) {
+  std::size_t n = std::min(text.size(), N - 1);
+  std::memcpy(dest, text.data(), n);
+  dest[n] = '\0';
+}
+
+std::string toJson(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+}  // namespace
+
+std::int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void record(const Span& span) {
+  Ring& ring = threadRing();
+  std::lock_guard<std::mutex> lock(ring.mutex);
+  ring.spans[ring.next] = span;
+  ring.next = (ring.next + 1) % RING_SIZE;
+  ring.size = std::min(ring.size + 1, RING_SIZE);
+}
+
+std::string eventsJson(int pid, const std::string& processName) {
+  std::vector<std::string> events;
+
+  Json::Value meta;
+  meta["name"] = "process_name";
+  meta["ph"] = "M";
+  meta["pid"] = pid;
+  meta["args"]["name"] = processName;
+  events.push_back(toJson(meta));
+
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    rings = registry;
+  }
+  for (const auto& ring : rings) {
+    std::vector<Span> spans;
+    {
+      std::lock_guard<std::mutex> lock(ring->mutex);
+      spans = ring->spans;
+      spans.resize(ring->size);
+    }
+    for (const Span& span : spans) {
+      if (span.pid != pid) continue;
+      std::string id = fmt::format("{:016x}", span.requestId);
+
+      Json::Value event;
+      event["name"] = span.name;
+      event["cat"] = "sdfss";
+      event["ph"] = "X";
+      event["ts"] = Json::Int64(span.startUs);
+      event["dur"] = Json::Int64(span.durationUs);
+      event["pid"] = pid;
+      event["tid"] = Json::UInt64(ring->tid);
+      event["args"]["request_id"] = id;
+      if (span.detail[0] != '\0') event["args"]["detail"] = span.detail;
+      events.push_back(toJson(event));
+
+      // flow arrows join a client's request span to the server's span
+      if (span.flow != Flow::NONE) {
+        Json::Value flow;
+        flow["name"] = "request";
+        flow["cat"] = "sdfss";
+        flow["ph"] = span.flow == Flow::OUT ? "s" : "f";
+        if (span.flow == Flow::IN) flow["bp"] = "e";
+        flow["id"] = id;
+        flow["ts"] = Json::Int64(span.startUs);
+        flow["pid"] = pid;
+        flow["tid"] = Json::UInt64(ring->tid);
+        events.push_back(toJson(flow));
+      }
+    }
+  }
+
+  std::string out;
+  for (std::size_t i = 0; i < events.size(); i++) {
+    if (i) out += ",\n";
+    out += events[i];
+  }
+  return out;
+}
+
+std::string traceDocument(const std::string& events) {
+  return "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" + events + "\n]}\n";
+}
+
+Scope::Scope(int pid, const std::string& name, std::uint64_t requestId,
+             const std::string& detail, Flow flow) {
+  copyText(span_.name, name);
+  span_.requestId = requestId;
+  span_.startUs = nowUs();
+  span_.durationUs = 0;
+  span_.pid = pid;
+  span_.flow = flow;
+  copyText(span_.detail, detail);
+}
+
+Scope::~Scope() {
+  span_.durationUs = nowUs() - span_.startUs;
+  record(span_);
+}
+
+void Scope::setDetail(const std::string& detail) {
+  copyText(span_.detail, detail);
+}
+
+}  // namespace RequestTrace
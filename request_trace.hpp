@@ -0,0 +1,56 @@
+#ifndef REQUESTTRACE_H
+#define REQUESTTRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Spans are kept in a ring buffer per thread, so recording never contends
+// with other threads. Timestamps are wall clock microseconds so spans dumped
+// from two nodes line up on one timeline.
+namespace RequestTrace {
+
+// how a span joins the spans of other nodes in the viewer
+enum class Flow { NONE, OUT, IN };
+
+struct Span {
+  char name[32];
+  std::uint64_t requestId;
+  std::int64_t startUs;
+  std::int64_t durationUs;
+  int pid;  // per node, so nodes sharing a process stay apart
+  Flow flow;
+  char detail[64];
+};
+
+// spans kept per thread before the oldest are overwritten
+const std::size_t RING_SIZE = 4096;
+
+std::int64_t nowUs();
+
+void record(const Span& span);
+
+// Chrome/Perfetto trace events (without the enclosing array) for every span
+// recorded with this pid, comma separated.
+std::string eventsJson(int pid, const std::string& processName);
+
+// wraps a list of events in a trace document
+std::string traceDocument(const std::string& events);
+
+// Records one span from construction to destruction.
+class Scope {
+ public:
+  Scope(int pid, const std::string& name, std::uint64_t requestId,
+        const std::string& detail = "", Flow flow = Flow::NONE);
+  ~Scope();
+
+  // replaces the detail text, e.g. once sizes are known
+  void setDetail(const std::string& detail);
+
+ private:
+  Span span_;
+};
+
+}  // namespace RequestTrace
+
+#endif  // REQUESTTRACE_H
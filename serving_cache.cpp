@@ -0,0 +1,128 @@
+#include "serving_cache.hpp"
+
+#include <chrono>
+
+namespace {
+
+std::int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+std::shared_ptr<FileHandle> ServingCache::lookup(
+    const std::filesystem::path& path,
+    std::shared_ptr<const std::string>& content) {
+  const std::string key = path.string();
+  std::shared_ptr<FileHandle> cached;
+  std::uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      if (nowMs() - it->second.checkedMs < REVALIDATE_MS) {
+        content = it->second.content;
+        return it->second.handle;
+      }
+      cached = it->second.handle;
+    }
+    generation = generation_;
+  }
+
+  // the stat and the open are done without the lock, so a slow disk only
+  // holds up the lookups of this file
+  if (cached && cached->current()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    content = nullptr;
+    if (it != entries_.end() && it->second.handle == cached) {
+      it->second.checkedMs = nowMs();
+      content = it->second.content;
+    }
+    return cached;
+  }
+  std::shared_ptr<FileHandle> handle = FileHandle::open(path);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end() && it->second.handle != cached) {
+    // another lookup reopened the file meanwhile
+    content = it->second.content;
+    return it->second.handle;
+  }
+  if (it != entries_.end()) erase(it);
+  content = nullptr;
+  // Misses are not kept, names that were never there would fill the cache.
+  // Nor is a handle opened before an invalidate(), it may be the old file.
+  if (!handle || generation != generation_) return handle;
+  Entry entry;
+  entry.handle = handle;
+  entry.checkedMs = nowMs();
+  lru_.push_front(key);
+  entry.lru = lru_.begin();
+  entries_.emplace(key, std::move(entry));
+  evict();
+  return handle;
+}
+
+std::shared_ptr<const std::string> ServingCache::cacheContent(
+    const std::shared_ptr<FileHandle>& handle) {
+  if (!handle || handle->size() > MAX_CONTENT_FILE_SIZE) return nullptr;
+  FileReader reader;
+  if (!reader.open(handle)) return nullptr;
+  auto data = std::make_shared<std::string>(handle->size(), '\0');
+  if (reader.read(&(*data)[0], data->size()) != data->size()) return nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(handle->path().string());
+  // invalidated or reopened while we read
+  if (it == entries_.end() || it->second.handle != handle) return data;
+  if (!it->second.content) {
+    it->second.content = data;
+    contentBytes_ += data->size();
+    evict();
+  }
+  return data;
+}
+
+void ServingCache::invalidate(const std::filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  auto it = entries_.find(path.string());
+  if (it != entries_.end()) erase(it);
+}
+
+void ServingCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  entries_.clear();
+  lru_.clear();
+  contentBytes_ = 0;
+}
+
+void ServingCache::erase(std::unordered_map<std::string, Entry>::iterator it) {
+  if (it->second.content) contentBytes_ -= it->second.content->size();
+  lru_.erase(it->second.lru);
+  entries_.erase(it);
+}
+
+// drops least recently used entries until both limits hold again
+void ServingCache::evict() {
+  auto victim = lru_.end();
+  while ((entries_.size() > MAX_ENTRIES || contentBytes_ > MAX_CONTENT_BYTES) &&
+         victim != lru_.begin()) {
+    --victim;
+    auto it = entries_.find(*victim);
+    if (entries_.size() > MAX_ENTRIES) {
+      victim = std::next(victim);
+      erase(it);
+    } else if (it->second.content) {
+      // over the byte limit only, the handle can stay
+      contentBytes_ -= it->second.content->size();
+      it->second.content.reset();
+    }
+  }
+}
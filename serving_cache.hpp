@@ -0,0 +1,63 @@
+#ifndef SERVINGCACHE_H
+#define SERVINGCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "file_reader.hpp"
+
+// What SENDs are served from: a bounded LRU of open handles of recently sent
+// files, with the contents of small ones kept in memory. Missing files are
+// not remembered. An entry is checked against the file's size and mtime at
+// most every REVALIDATE_MS, so a cached file is served without any syscall.
+// The node calls invalidate() when it changes a file itself, so only
+// changes made outside the node can be missed for up to REVALIDATE_MS.
+class ServingCache {
+ public:
+  static const std::size_t MAX_ENTRIES = 256;
+  static const std::size_t MAX_CONTENT_BYTES = 32 << 20;
+  static const std::size_t MAX_CONTENT_FILE_SIZE = 64 << 10;
+  static const std::int64_t REVALIDATE_MS = 1000;
+
+  // Handle of the file at path, or nullptr if there is none. Sets content
+  // too when the file's contents are in memory.
+  std::shared_ptr<FileHandle> lookup(
+      const std::filesystem::path& path,
+      std::shared_ptr<const std::string>& content);
+
+  // Reads a file of at most MAX_CONTENT_FILE_SIZE into memory and keeps it
+  // with its handle. Returns the contents, nullptr if the file is larger or
+  // could not be read.
+  std::shared_ptr<const std::string> cacheContent(
+      const std::shared_ptr<FileHandle>& handle);
+
+  void invalidate(const std::filesystem::path& path);
+  void clear();
+
+ private:
+  struct Entry {
+    std::shared_ptr<FileHandle> handle;
+    std::shared_ptr<const std::string> content;
+    std::int64_t checkedMs = 0;
+    std::list<std::string>::iterator lru;
+  };
+
+  void erase(std::unordered_map<std::string, Entry>::iterator it);
+  void evict();
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // most recently used first
+  std::size_t contentBytes_ = 0;
+  // bumped by invalidate() and clear(), a lookup that opened a file before
+  // either does not cache it
+  std::uint64_t generation_ = 0;
+};
+
+#endif  // SERVINGCACHE_H
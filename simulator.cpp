@@ -0,0 +1,260 @@
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+
+#include "latency_histogram.hpp"
+#include "node.hpp"
+
+// Runs many nodes in one process over inproc to see how LIST, update
+// propagation and transfers scale with cluster size.
+//
+//   simulator [--nodes N] [--topology full|ring|random] [--degree K]
+//             [--latency-ms L] [--loss P] [--fail F] [--files M]
+//             [--file-size B] [--ops O] [--seed S]
+//
+// Every node gets a temporary root directory with M files of B bytes. F
+// random nodes are stopped before measuring. Full mesh needs N*N sockets, so
+// use random with a small degree for hundreds of nodes.
+
+using Clock = std::chrono::steady_clock;
+
+struct SimConfig {
+  int nodes = 50;
+  std::string topology = "random";
+  int degree = 8;
+  int latencyMs = 0;
+  double loss = 0;
+  int fail = 0;
+  int files = 20;
+  std::uint64_t fileSize = 4096;
+  int ops = 50;
+  unsigned seed = 1;
+};
+
+struct SimNode {
+  std::unique_ptr<Node> node;
+  std::atomic<bool> running{true};
+  std::thread server;
+  std::thread heartbeat;
+  std::thread antiEntropy;
+};
+
+std::string nodeEndpoint(int i) { return fmt::format("inproc://sim-{}", i); }
+
+// peer lists for each node
+std::vector<std::vector<int>> buildTopology(const SimConfig& config,
+                                            std::mt19937& rng) {
+  std::vector<std::set<int>> peers(config.nodes);
+  for (int i = 0; i < config.nodes; i++) {
+    if (config.topology == "full") {
+      for (int j = 0; j < config.nodes; j++) {
+        if (j != i) peers[i].insert(j);
+      }
+    } else if (config.topology == "ring") {
+      peers[i].insert((i + 1) % config.nodes);
+      peers[i].insert((i + config.nodes - 1) % config.nodes);
+    } else {
+      std::uniform_int_distribution<int> pick(0, config.nodes - 1);
+      while (static_cast<int>(peers[i].size()) <
+             std::min(config.degree, config.nodes - 1)) {
+        int j = pick(rng);
+        if (j == i) continue;
+        // links go both ways so every node can be reached
+        peers[i].insert(j);
+        peers[j].insert(i);
+      }
+    }
+  }
+  std::vector<std::vector<int>> result;
+  for (const auto& p : peers) result.emplace_back(p.begin(), p.end());
+  return result;
+}
+
+void writeFiles(const std::filesystem::path& dir, int nodeIndex,
+                const SimConfig& config) {
+  std::filesystem::create_directories(dir);
+  std::string content(config.fileSize, 'x');
+  for (int f = 0; f < config.files; f++) {
+    std::ofstream file(dir / fmt::format("n{}_f{}", nodeIndex, f),
+                       std::ios::binary);
+    file << content;
+  }
+}
+
+std::uint64_t elapsedUs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+int main(int argc, char* argv[]) {
+  SimConfig config;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (std::size_t i = 0; i + 1 < args.size(); i += 2) {
+    const std::string& flag = args[i];
+    const std::string& value = args[i + 1];
+    if (flag == "--nodes") config.nodes = std::stoi(value);
+    else if (flag == "--topology") config.topology = value;
+    else if (flag == "--degree") config.degree = std::stoi(value);
+    else if (flag == "--latency-ms") config.latencyMs = std::stoi(value);
+    else if (flag == "--loss") config.loss = std::stod(value);
+    else if (flag == "--fail") config.fail = std::stoi(value);
+    else if (flag == "--files") config.files = std::stoi(value);
+    else if (flag == "--file-size") config.fileSize = std::stoull(value);
+    else if (flag == "--ops") config.ops = std::stoi(value);
+    else if (flag == "--seed") config.seed = std::stoul(value);
+    else {
+      std::cerr << "Unknown option " << flag << std::endl;
+      return -1;
+    }
+  }
+  if (config.nodes < 2) {
+    std::cerr << "Need at least 2 nodes." << std::endl;
+    return -1;
+  }
+
+  std::mt19937 rng(config.seed);
+  auto topology = buildTopology(config, rng);
+  std::filesystem::path simDir =
+      std::filesystem::temp_directory_path() /
+      fmt::format("sdfss-sim-{}", std::random_device{}());
+
+  // the nodes are chatty, keep the report readable
+  std::streambuf* coutBuf = std::cout.rdbuf();
+  std::ofstream nullStream;
+  std::cout.rdbuf(nullStream.rdbuf());
+
+  zmq::context_t context;
+  std::vector<std::unique_ptr<SimNode>> nodes;
+  auto setupStart = Clock::now();
+  for (int i = 0; i < config.nodes; i++) {
+    std::filesystem::path rootDir = simDir / fmt::format("node{}", i);
+    writeFiles(rootDir, i, config);
+    std::vector<std::pair<std::string, int>> targets;
+    for (int peer : topology[i]) targets.push_back({nodeEndpoint(peer), 0});
+
+    auto simNode = std::make_unique<SimNode>();
+    simNode->node = std::make_unique<Node>(rootDir, targets, nodeEndpoint(i),
+                                           i, context);
+    simNode->node->setFaultInjection(config.latencyMs, config.loss);
+    nodes.push_back(std::move(simNode));
+  }
+  for (auto& simNode : nodes) {
+    SimNode* n = simNode.get();
+    n->server = std::thread([n] { n->node->handleRequests(n->running); });
+    n->heartbeat = std::thread([n] { n->node->runHeartbeat(n->running); });
+    n->antiEntropy =
+        std::thread([n] { n->node->runAntiEntropy(n->running); });
+  }
+  double setupSec =
+      std::chrono::duration<double>(Clock::now() - setupStart).count();
+
+  // stop some nodes and give the heartbeats time to notice
+  std::vector<int> order(config.nodes);
+  for (int i = 0; i < config.nodes; i++) order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  std::set<int> failed(order.begin(),
+                       order.begin() + std::min(config.fail, config.nodes - 1));
+  for (int i : failed) {
+    nodes[i]->running = false;
+    nodes[i]->server.join();
+    nodes[i]->heartbeat.join();
+    nodes[i]->antiEntropy.join();
+  }
+  if (!failed.empty()) std::this_thread::sleep_for(std::chrono::seconds(4));
+
+  std::vector<int> alive;
+  for (int i = 0; i < config.nodes; i++) {
+    if (!failed.count(i)) alive.push_back(i);
+  }
+  std::uniform_int_distribution<std::size_t> pickAlive(0, alive.size() - 1);
+
+  // LIST from random live nodes
+  LatencyHistogram listLatency;
+  std::uint64_t listEntries = 0;
+  for (int op = 0; op < config.ops; op++) {
+    Node& node = *nodes[alive[pickAlive(rng)]]->node;
+    auto start = Clock::now();
+    node.sendRequest(Node::FileOperation::LIST);
+    listLatency.record(elapsedUs(start));
+    listEntries += node.getOtherFileData().size();
+  }
+
+  // transfers of a random neighbour's file
+  LatencyHistogram getLatency;
+  int received = 0;
+  for (int op = 0; op < config.ops; op++) {
+    int from = alive[pickAlive(rng)];
+    int owner = topology[from][rng() % topology[from].size()];
+    std::string fileName = fmt::format("n{}_f{}", owner, rng() % config.files);
+    auto start = Clock::now();
+    nodes[from]->node->getFile(fileName);
+    getLatency.record(elapsedUs(start));
+    if (std::filesystem::exists(simDir / fmt::format("node{}", from) /
+                                ("copyof" + fileName))) {
+      received++;
+    }
+  }
+
+  // update propagation: a new file on one node, then how many nodes know
+  int origin = alive[pickAlive(rng)];
+  std::string newFile = fmt::format("n{}_new", origin);
+  auto propagationStart = Clock::now();
+  nodes[origin]->node->createFile(newFile);
+  nodes[origin]->node->update();
+  int informed = 0;
+  std::uint64_t propagationUs = 0;
+  for (int attempt = 0; attempt < 50; attempt++) {
+    informed = 0;
+    for (int i : alive) {
+      if (nodes[i]->node->getOtherFileData().count(newFile)) informed++;
+    }
+    propagationUs = elapsedUs(propagationStart);
+    if (informed >= static_cast<int>(topology[origin].size())) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  std::cout.rdbuf(coutBuf);
+  std::cout << fmt::format(
+                   "{} nodes ({} failed), topology {} degree {}, latency {} "
+                   "ms, loss {}",
+                   config.nodes, failed.size(), config.topology,
+                   topology[0].size(), config.latencyMs, config.loss)
+            << std::endl;
+  std::cout << fmt::format("setup: {:.2f}s", setupSec) << std::endl;
+  std::cout << fmt::format("list: {} avg entries {}", listLatency.summary(),
+                           listEntries / std::max(1, config.ops))
+            << std::endl;
+  std::cout << fmt::format("get: {} received {}/{}", getLatency.summary(),
+                           received, config.ops)
+            << std::endl;
+  std::cout << fmt::format(
+                   "update: {} of {} neighbours of node {} informed after "
+                   "{:.1f} ms",
+                   informed, topology[origin].size(), origin,
+                   propagationUs / 1000.0)
+            << std::endl;
+
+  for (int i = 0; i < config.nodes; i++) {
+    if (failed.count(i)) continue;
+    nodes[i]->running = false;
+    nodes[i]->server.join();
+    nodes[i]->heartbeat.join();
+    nodes[i]->antiEntropy.join();
+  }
+  nodes.clear();
+  std::filesystem::remove_all(simDir);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// A value shared between threads as immutable snapshots, RCU style. Readers
+// take the current snapshot without the writers' lock and keep it alive for
+// as long as they hold it. Writers copy the current value, change the copy
+// and publish it as a whole, so a reader never sees half an update. Writers
+// are serialized among themselves only. Every published snapshot gets the
+// next version, so derived data can be cached by version.
+template <typename T>
+class Snapshot {
+ public:
+  explicit Snapshot(T value = T())
+      : current_(std::make_shared<const Published>(
+            Published{std::move(value), 0})) {}
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  std::shared_ptr<const T> load() const {
+    std::uint64_t version;
+    return load(version);
+  }
+  // also gives the snapshot's version
+  std::shared_ptr<const T> load(std::uint64_t& version) const {
+    std::shared_ptr<const Published> current = std::atomic_load(&current_);
+    version = current->version;
+    // shares ownership of the whole snapshot, points at its value
+    return std::shared_ptr<const T>(current, &current->value);
+  }
+
+  void store(T value) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    publish(std::move(value));
+  }
+
+  // edit(T&) changes a copy of the current value, which is then published.
+  // Batch changes into one update, each copies the whole value.
+  template <typename Edit>
+  void update(Edit edit) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    T next = std::atomic_load(&current_)->value;
+    edit(next);
+    publish(std::move(next));
+  }
+
+ private:
+  struct Published {
+    T value;
+    std::uint64_t version;
+  };
+
+  // called with writeMutex_ held
+  void publish(T value) {
+    std::uint64_t version = current_->version + 1;
+    std::atomic_store(&current_, std::make_shared<const Published>(
+                                     Published{std::move(value), version}));
+  }
+
+  std::shared_ptr<const Published> current_;
+  std::mutex writeMutex_;
+};
+
+#endif  // SNAPSHOT_H
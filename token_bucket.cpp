@@ -0,0 +1,47 @@
+#include "token_bucket.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+TokenBucket::TokenBucket(std::uint64_t rate, std::uint64_t burst)
+    : rate_(rate),
+      // without a burst size it saves up one second's worth
+      burst_(static_cast<double>(burst > 0 ? burst : rate)),
+      tokens_(burst_),
+      last_(std::chrono::steady_clock::now()) {}
+
+bool TokenBucket::unlimited() const { return rate_ == 0; }
+
+bool TokenBucket::full() {
+  refill();
+  return tokens_ >= burst_;
+}
+
+void TokenBucket::refill() {
+  auto now = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(now - last_).count();
+  last_ = now;
+  tokens_ = std::min(burst_, tokens_ + seconds * rate_);
+}
+
+std::uint64_t TokenBucket::available() {
+  if (unlimited()) return std::numeric_limits<std::uint64_t>::max();
+  refill();
+  return tokens_ > 0 ? static_cast<std::uint64_t>(tokens_) : 0;
+}
+
+void TokenBucket::take(std::uint64_t tokens) {
+  if (unlimited()) return;
+  refill();
+  tokens_ -= static_cast<double>(tokens);
+}
+
+std::int64_t TokenBucket::waitMs(std::uint64_t tokens) {
+  if (unlimited()) return 0;
+  refill();
+  // more than a burst never fits, wait for a full bucket instead
+  double missing = std::min<double>(tokens, burst_) - tokens_;
+  if (missing <= 0) return 0;
+  return static_cast<std::int64_t>(std::ceil(missing * 1000 / rate_));
+}
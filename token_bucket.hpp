@@ -0,0 +1,32 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <chrono>
+#include <cstdint>
+
+// Bytes per second with bursts of up to burst bytes. A rate of 0 means no
+// limit. Not thread safe, each bucket belongs to one thread.
+class TokenBucket {
+ public:
+  TokenBucket(std::uint64_t rate = 0, std::uint64_t burst = 0);
+
+  bool unlimited() const;
+  // whether it has been idle long enough to be full again
+  bool full();
+
+  // tokens that can be taken now
+  std::uint64_t available();
+  void take(std::uint64_t tokens);
+  // ms until tokens are available, 0 if they are now
+  std::int64_t waitMs(std::uint64_t tokens);
+
+ private:
+  void refill();
+
+  std::uint64_t rate_;
+  double burst_;
+  double tokens_;
+  std::chrono::steady_clock::time_point last_;
+};
+
+#endif  // TOKENBUCKET_H